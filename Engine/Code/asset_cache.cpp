@@ -0,0 +1,116 @@
+//
+// asset_cache.cpp: LRU eviction of unreferenced assets. Referenced assets count
+// towards the budgets but are never evicted.
+//
+
+#include "asset_cache.h"
+#include <imgui.h>
+#include <algorithm>
+
+struct CachedAsset
+{
+    u64  lastUsedFrame;
+    u32  handle;
+    bool isModel;
+};
+
+void InitAssetCache(AssetCache& cache)
+{
+    cache.enabled = true;
+    cache.cpuBudgetBytes = MB(512);
+    cache.gpuBudgetBytes = MB(768);
+}
+
+static void MeasureAssetCache(App* app)
+{
+    AssetCache& cache = app->assetCache;
+
+    cache.cpuBytes = 0;
+    cache.gpuBytes = app->streaming.residentBytes;
+    for (Mesh& mesh : app->meshes)
+    {
+        cache.cpuBytes += mesh.cpuBytes;
+        cache.gpuBytes += mesh.gpuBytes;
+    }
+}
+
+static bool IsOverBudget(const AssetCache& cache)
+{
+    if (!cache.enabled)
+        return true;
+    return cache.cpuBytes > cache.cpuBudgetBytes || cache.gpuBytes > cache.gpuBudgetBytes;
+}
+
+void UpdateAssetCache(App* app)
+{
+    AssetCache& cache = app->assetCache;
+    cache.frame++;
+
+    std::vector<CachedAsset> cached;
+    for (u32 slot = 0; slot < app->textures.SlotCount(); ++slot)
+    {
+        if (!app->textures.IsSlotAlive(slot))
+            continue;
+        u32 texIdx = app->textures.HandleAt(slot);
+        if (app->textures.GetRefCount(texIdx) == 0)
+            cached.push_back(CachedAsset{ app->textures[texIdx].lastUsedFrame, texIdx, false });
+    }
+    cache.cachedTextures = (u32)cached.size();
+
+    for (u32 slot = 0; slot < app->models.SlotCount(); ++slot)
+    {
+        if (!app->models.IsSlotAlive(slot))
+            continue;
+        u32 modelIdx = app->models.HandleAt(slot);
+        if (app->models.GetRefCount(modelIdx) == 0)
+            cached.push_back(CachedAsset{ app->models[modelIdx].lastUsedFrame, modelIdx, true });
+    }
+    cache.cachedModels = (u32)cached.size() - cache.cachedTextures;
+
+    MeasureAssetCache(app);
+    if (!IsOverBudget(cache))
+        return;
+
+    std::sort(cached.begin(), cached.end(), [](const CachedAsset& a, const CachedAsset& b) {
+        return a.lastUsedFrame < b.lastUsedFrame;
+    });
+
+    // Textures released by an evicted model become cached themselves and are
+    // considered from the next frame on
+    for (const CachedAsset& asset : cached)
+    {
+        if (asset.isModel)
+        {
+            UnloadModel(app, asset.handle);
+            cache.cachedModels--;
+        }
+        else
+        {
+            UnloadTexture(app, asset.handle);
+            cache.cachedTextures--;
+        }
+        cache.evictions++;
+
+        MeasureAssetCache(app);
+        if (!IsOverBudget(cache))
+            break;
+    }
+}
+
+void AssetCacheGui(App* app)
+{
+    AssetCache& cache = app->assetCache;
+
+    ImGui::Begin("Asset cache");
+    ImGui::Checkbox("Keep unreferenced assets", &cache.enabled);
+    int cpuBudgetMB = (int)(cache.cpuBudgetBytes / MB(1));
+    if (ImGui::SliderInt("CPU budget (MB)", &cpuBudgetMB, 1, 4096))
+        cache.cpuBudgetBytes = (u64)cpuBudgetMB * MB(1);
+    int gpuBudgetMB = (int)(cache.gpuBudgetBytes / MB(1));
+    if (ImGui::SliderInt("GPU budget (MB)", &gpuBudgetMB, 1, 8192))
+        cache.gpuBudgetBytes = (u64)gpuBudgetMB * MB(1);
+    ImGui::Text("CPU: %.2f MB, GPU: %.2f MB", cache.cpuBytes / (f64)MB(1), cache.gpuBytes / (f64)MB(1));
+    ImGui::Text("Cached textures: %u, models: %u", cache.cachedTextures, cache.cachedModels);
+    ImGui::Text("Hits: %u, misses: %u, evictions: %u", cache.hits, cache.misses, cache.evictions);
+    ImGui::End();
+}
@@ -0,0 +1,17 @@
+//
+// asset_cache.h: Keeps unreferenced textures and models loaded so loading them
+// again is free, evicting the least recently used ones to fit the CPU and GPU
+// memory budgets.
+//
+
+#pragma once
+
+#include "engine.h"
+
+void InitAssetCache(AssetCache& cache);
+
+// Measures memory usage and evicts cached assets over budget. Call once per
+// frame from the main thread, before texture streaming.
+void UpdateAssetCache(App* app);
+
+void AssetCacheGui(App* app);
@@ -4,12 +4,52 @@
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <vector>
+#include <algorithm>
 #include "engine.h"
+#include "../assimp_model_loading.h"
+#include "texture_processing.h"
+#include "mesh_storage.h"
+#include "point_cloud.h"
+#include "pipeline_warmup.h"
 
-void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+u32 GetAssimpVertexStride(const aiMesh* mesh)
 {
+    u32 floatCount = 6;
+    if (mesh->mTextureCoords[0])
+        floatCount += 2;
+    if (mesh->mTangents != nullptr && mesh->mBitangents)
+        floatCount += 6;
+    return floatCount * sizeof(float);
+}
+
+GLenum GetAssimpPrimitiveType(const aiMesh* mesh)
+{
+    // aiProcess_SortByPType leaves a single primitive type per mesh
+    if (mesh->mPrimitiveTypes == aiPrimitiveType_POINT)
+        return GL_POINTS;
+    if (mesh->mPrimitiveTypes == aiPrimitiveType_LINE)
+        return GL_LINES;
+    return GL_TRIANGLES;
+}
+
+u64 GetAssimpIndexCount(const aiMesh* mesh)
+{
+    if (GetAssimpPrimitiveType(mesh) == GL_POINTS)
+        return 0;
+
+    u64 indexCount = 0;
+    for (unsigned int i = 0; i < mesh->mNumFaces; i++)
+        indexCount += mesh->mFaces[i].mNumIndices;
+    return indexCount;
+}
+
+SubmeshData ProcessAssimpMesh(const aiMesh *mesh)
+{
+    const GLenum primitiveType = GetAssimpPrimitiveType(mesh);
     std::vector<float> vertices;
     std::vector<u32> indices;
+    vertices.reserve((u64)mesh->mNumVertices * GetAssimpVertexStride(mesh) / sizeof(float));
+    indices.reserve(GetAssimpIndexCount(mesh));
 
     bool hasTexCoords = false;
     bool hasTangentSpace = false;
@@ -20,9 +60,11 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 bas
         vertices.push_back(mesh->mVertices[i].x);
         vertices.push_back(mesh->mVertices[i].y);
         vertices.push_back(mesh->mVertices[i].z);
-        vertices.push_back(mesh->mNormals[i].x);
-        vertices.push_back(mesh->mNormals[i].y);
-        vertices.push_back(mesh->mNormals[i].z);
+        // points and lines don't get normals generated
+        const aiVector3D normal = mesh->mNormals ? mesh->mNormals[i] : aiVector3D(0.0f, 0.0f, 0.0f);
+        vertices.push_back(normal.x);
+        vertices.push_back(normal.y);
+        vertices.push_back(normal.z);
 
         if(mesh->mTextureCoords[0]) // does the mesh contain texture coordinates?
         {
@@ -52,18 +94,34 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 bas
         }
     }
 
-    // process indices
-    for(unsigned int i = 0; i < mesh->mNumFaces; i++)
+    // process indices, points are drawn straight from the vertices
+    f32 surfaceArea = 0.0f;
+    f32 uvArea = 0.0f;
+    for(unsigned int i = 0; i < mesh->mNumFaces && primitiveType != GL_POINTS; i++)
     {
         aiFace face = mesh->mFaces[i];
         for(unsigned int j = 0; j < face.mNumIndices; j++)
         {
             indices.push_back(face.mIndices[j]);
         }
-    }
 
-    // store the proper (previously proceessed) material for this mesh
-    submeshMaterialIndices.push_back(baseMeshMaterialIndex + mesh->mMaterialIndex);
+        // world and texture space areas, used by texture streaming
+        if (face.mNumIndices == 3)
+        {
+            const aiVector3D& p0 = mesh->mVertices[face.mIndices[0]];
+            const aiVector3D& p1 = mesh->mVertices[face.mIndices[1]];
+            const aiVector3D& p2 = mesh->mVertices[face.mIndices[2]];
+            surfaceArea += 0.5f * ((p1 - p0) ^ (p2 - p0)).Length();
+
+            if (mesh->mTextureCoords[0])
+            {
+                const aiVector3D& t0 = mesh->mTextureCoords[0][face.mIndices[0]];
+                const aiVector3D& t1 = mesh->mTextureCoords[0][face.mIndices[1]];
+                const aiVector3D& t2 = mesh->mTextureCoords[0][face.mIndices[2]];
+                uvArea += 0.5f * fabsf((t1.x - t0.x) * (t2.y - t0.y) - (t2.x - t0.x) * (t1.y - t0.y));
+            }
+        }
+    }
 
     // create the vertex format
     VertexBufferLayout vertexBufferLayout = {};
@@ -84,12 +142,25 @@ void ProcessAssimpMesh(const aiScene* scene, aiMesh *mesh, Mesh *myMesh, u32 bas
         vertexBufferLayout.stride += 3 * sizeof(float);
     }
 
-    // add the submesh into the mesh
-    Submesh submesh = {};
+    SubmeshData submesh = {};
+    submesh.primitiveType = primitiveType;
     submesh.vertexBufferLayout = vertexBufferLayout;
     submesh.vertices.swap(vertices);
     submesh.indices.swap(indices);
-    myMesh->submeshes.push_back( submesh );
+    submesh.surfaceArea = surfaceArea;
+    submesh.uvDensity = surfaceArea > 0.0f ? sqrtf(uvArea / surfaceArea) : 0.0f;
+    return submesh;
+}
+
+void GetAssimpTexturePath(aiMaterial* material, aiTextureType type, String directory, std::string& filepath)
+{
+    if (material->GetTextureCount(type) > 0)
+    {
+        aiString aiFilename;
+        material->GetTexture(type, 0, &aiFilename);
+        String filename = MakeString(aiFilename.C_Str());
+        filepath = MakePath(directory, filename).str;
+    }
 }
 
 void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial, String directory)
@@ -110,63 +181,37 @@ void ProcessAssimpMaterial(App* app, aiMaterial *material, Material& myMaterial,
     myMaterial.emissive = vec3(emissiveColor.r, emissiveColor.g, emissiveColor.b);
     myMaterial.smoothness = shininess / 256.0f;
 
-    aiString aiFilename;
-    if (material->GetTextureCount(aiTextureType_DIFFUSE) > 0)
-    {
-        material->GetTexture(aiTextureType_DIFFUSE, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.albedoTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_EMISSIVE) > 0)
-    {
-        material->GetTexture(aiTextureType_EMISSIVE, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.emissiveTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_SPECULAR) > 0)
-    {
-        material->GetTexture(aiTextureType_SPECULAR, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.specularTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_NORMALS) > 0)
-    {
-        material->GetTexture(aiTextureType_NORMALS, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.normalsTextureIdx = LoadTexture2D(app, filepath.str);
-    }
-    if (material->GetTextureCount(aiTextureType_HEIGHT) > 0)
-    {
-        material->GetTexture(aiTextureType_HEIGHT, 0, &aiFilename);
-        String filename = MakeString(aiFilename.C_Str());
-        String filepath = MakePath(directory, filename);
-        myMaterial.bumpTextureIdx = LoadTexture2D(app, filepath.str);
-    }
+    myMaterial.specular = (specularColor.r + specularColor.g + specularColor.b) / 3.0f;
+
+    MaterialTextureSources sources;
+    GetAssimpTexturePath(material, aiTextureType_DIFFUSE, directory, sources.albedo);
+    GetAssimpTexturePath(material, aiTextureType_EMISSIVE, directory, sources.emissive);
+    GetAssimpTexturePath(material, aiTextureType_SPECULAR, directory, sources.specular);
+    GetAssimpTexturePath(material, aiTextureType_SHININESS, directory, sources.smoothness);
+    GetAssimpTexturePath(material, aiTextureType_NORMALS, directory, sources.normals);
+    GetAssimpTexturePath(material, aiTextureType_HEIGHT, directory, sources.bump);
+    GetAssimpTexturePath(material, aiTextureType_AMBIENT, directory, sources.occlusion);
 
-    //myMaterial.createNormalFromBump();
+    // Maps are cooked when a program sampling them first draws the material
+    InitMaterialTextures(myMaterial, sources);
 }
 
-void ProcessAssimpNode(const aiScene* scene, aiNode *node, Mesh *myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices)
+void CollectAssimpMeshes(const aiScene* scene, const aiNode* node, std::vector<const aiMesh*>& meshes)
 {
-    // process all the node's meshes (if any)
+    // the node's meshes (if any)
     for(unsigned int i = 0; i < node->mNumMeshes; i++)
     {
-        aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-        ProcessAssimpMesh(scene, mesh, myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+        meshes.push_back(scene->mMeshes[node->mMeshes[i]]);
     }
 
     // then do the same for each of its children
     for(unsigned int i = 0; i < node->mNumChildren; i++)
     {
-        ProcessAssimpNode(scene, node->mChildren[i], myMesh, baseMeshMaterialIndex, submeshMaterialIndices);
+        CollectAssimpMeshes(scene, node->mChildren[i], meshes);
     }
 }
 
-u32 LoadModel(App* app, const char* filename)
+const aiScene* ImportAssimpScene(const char* filename)
 {
     const aiScene* scene = aiImportFile(filename,
                                         aiProcess_Triangulate           |
@@ -181,70 +226,117 @@ u32 LoadModel(App* app, const char* filename)
     if (!scene)
     {
         ELOG("Error loading mesh %s: %s", filename, aiGetErrorString());
-        return UINT32_MAX;
     }
+    return scene;
+}
+
+u32 FindModel(App* app, const char* filename)
+{
+    for (u32 slot = 0; slot < app->models.SlotCount(); ++slot)
+    {
+        if (!app->models.IsSlotAlive(slot))
+            continue;
+        u32 modelIdx = app->models.HandleAt(slot);
+        if (app->models[modelIdx].filepath == filename)
+            return modelIdx;
+    }
+    return UINT32_MAX;
+}
+
+u32 LoadModel(App* app, const char* filename)
+{
+    u32 modelIdx = FindModel(app, filename);
+    if (modelIdx != UINT32_MAX)
+        return RetainModel(app, modelIdx);
+
+    const aiScene* scene = ImportAssimpScene(filename);
+    if (!scene)
+        return UINT32_MAX;
+
+    return LoadModelFromScene(app, scene, filename);
+}
+
+std::vector<const aiMesh*> CollectSubmeshAssimpMeshes(const aiScene* scene, u32 minCloudPoints)
+{
+    std::vector<const aiMesh*> meshes;
+    CollectAssimpMeshes(scene, scene->mRootNode, meshes);
+    meshes.erase(std::remove_if(meshes.begin(), meshes.end(),
+                                [minCloudPoints](const aiMesh* mesh) { return IsPointCloudMesh(mesh, minCloudPoints); }),
+                 meshes.end());
+    return meshes;
+}
 
-    app->meshes.push_back(Mesh{});
-    Mesh& mesh = app->meshes.back();
-    u32 meshIdx = (u32)app->meshes.size() - 1u;
+void GetAssimpGeometryBytes(const std::vector<const aiMesh*>& meshes, u64* vertexBytes, u64* indexBytes)
+{
+    *vertexBytes = 0;
+    *indexBytes = 0;
+    for (const aiMesh* mesh : meshes)
+    {
+        *vertexBytes += (u64)mesh->mNumVertices * GetAssimpVertexStride(mesh);
+        *indexBytes += GetAssimpIndexCount(mesh) * sizeof(u32);
+    }
+}
 
-    app->models.push_back(Model{});
-    Model& model = app->models.back();
+u32 AddModelFromScene(App* app, const aiScene* scene, const char* filename, u32 meshIdx)
+{
+    u32 modelIdx = app->models.Add(Model{});
+    Model& model = app->models[modelIdx];
+    model.filepath = filename;
+    model.lastWriteTimestamp = GetFileLastWriteTimestamp(filename);
+    model.lastUsedFrame = app->assetCache.frame;
     model.meshIdx = meshIdx;
-    u32 modelIdx = (u32)app->models.size() - 1u;
+    app->assetCache.misses++;
 
     String directory = GetDirectoryPart(MakeString(filename));
 
     // Create a list of materials
-    u32 baseMeshMaterialIndex = (u32)app->materials.size();
     for (unsigned int i = 0; i < scene->mNumMaterials; ++i)
     {
-        app->materials.push_back(Material{});
-        Material& material = app->materials.back();
-        ProcessAssimpMaterial(app, scene->mMaterials[i], material, directory);
+        u32 materialIdx = app->materials.Add(Material{});
+        ProcessAssimpMaterial(app, scene->mMaterials[i], app->materials[materialIdx], directory);
+        model.ownedMaterialIdx.push_back(materialIdx);
     }
 
-    ProcessAssimpNode(scene, scene->mRootNode, &mesh, baseMeshMaterialIndex, model.materialIdx);
-
-    aiReleaseImport(scene);
-
-    u32 vertexBufferSize = 0;
-    u32 indexBufferSize = 0;
+    std::vector<const aiMesh*> assimpMeshes;
+    CollectAssimpMeshes(scene, scene->mRootNode, assimpMeshes);
 
-    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    // Big point meshes become octrees streamed from disk instead of submeshes
+    const u32 minCloudPoints = app->pointCloudStreaming.minPoints;
+    for (u32 i = 0; i < assimpMeshes.size(); ++i)
     {
-        vertexBufferSize += mesh.submeshes[i].vertices.size() * sizeof(float);
-        indexBufferSize  += mesh.submeshes[i].indices.size()  * sizeof(u32);
+        if (IsPointCloudMesh(assimpMeshes[i], minCloudPoints))
+            model.pointCloudIdx.push_back(AddPointCloud(app, filename, i, assimpMeshes[i]));
+        else
+            model.materialIdx.push_back(model.ownedMaterialIdx[assimpMeshes[i]->mMaterialIndex]);
     }
 
-    glGenBuffers(1, &mesh.vertexBufferHandle);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-    glBufferData(GL_ARRAY_BUFFER, vertexBufferSize, NULL, GL_STATIC_DRAW);
+    aiReleaseImport(scene);
 
-    glGenBuffers(1, &mesh.indexBufferHandle);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBufferSize, NULL, GL_STATIC_DRAW);
+    // Before the first frame that draws it
+    WarmUpModelPipelines(app, modelIdx);
 
-    u32 indicesOffset = 0;
-    u32 verticesOffset = 0;
+    return modelIdx;
+}
+
+u32 LoadModelFromScene(App* app, const aiScene* scene, const char* filename)
+{
+    std::vector<const aiMesh*> assimpMeshes = CollectSubmeshAssimpMeshes(scene, app->pointCloudStreaming.minPoints);
 
-    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    u64 remainingVertexBytes, remainingIndexBytes;
+    GetAssimpGeometryBytes(assimpMeshes, &remainingVertexBytes, &remainingIndexBytes);
+
+    // One submesh at a time: converted, uploaded (or shared with an identical
+    // one already uploaded) and freed, so only the assimp scene and a single
+    // submesh are in memory at once
+    u32 meshIdx = app->meshes.Add(Mesh{});
+    for (const aiMesh* assimpMesh : assimpMeshes)
     {
-        const void* verticesData = mesh.submeshes[i].vertices.data();
-        const u32   verticesSize = mesh.submeshes[i].vertices.size() * sizeof(float);
-        glBufferSubData(GL_ARRAY_BUFFER, verticesOffset, verticesSize, verticesData);
-        mesh.submeshes[i].vertexOffset = verticesOffset;
-        verticesOffset += verticesSize;
-
-        const void* indicesData = mesh.submeshes[i].indices.data();
-        const u32   indicesSize = mesh.submeshes[i].indices.size() * sizeof(u32);
-        glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, indicesOffset, indicesSize, indicesData);
-        mesh.submeshes[i].indexOffset = indicesOffset;
-        indicesOffset += indicesSize;
-    }
+        SubmeshData data = ProcessAssimpMesh(assimpMesh);
+        AddSubmesh(app, meshIdx, data, remainingVertexBytes, remainingIndexBytes);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+        remainingVertexBytes -= data.vertices.size() * sizeof(float);
+        remainingIndexBytes -= data.indices.size() * sizeof(u32);
+    }
 
-    return modelIdx;
+    return AddModelFromScene(app, scene, filename, meshIdx);
 }
\ No newline at end of file
@@ -0,0 +1,262 @@
+//
+// async_assets.cpp: Main thread continuation queues and the asset coroutines.
+//
+
+#include "async_assets.h"
+#include "../assimp_model_loading.h"
+#include "point_cloud.h"
+#include "mesh_storage.h"
+#include "shader_preprocessor.h"
+#include <chrono>
+#include <deque>
+#include <unordered_map>
+
+struct MainThreadQueue
+{
+    std::mutex                          mutex;
+    std::deque<std::coroutine_handle<>> queues[JobPriority_Count];
+    std::atomic<u32>                    inFlight{ 0 };
+};
+
+static MainThreadQueue GlobalMainThreadQueue;
+
+struct AssetFrameRegistry
+{
+    std::mutex                                                  mutex;
+    std::unordered_map<void*, std::shared_ptr<AsyncAssetState>> frames; // By frame address
+};
+
+static AssetFrameRegistry GlobalAssetFrames;
+
+void RegisterAssetFrame(std::coroutine_handle<> frame, std::shared_ptr<AsyncAssetState> state)
+{
+    std::lock_guard<std::mutex> lock(GlobalAssetFrames.mutex);
+    GlobalAssetFrames.frames[frame.address()] = std::move(state);
+}
+
+void UnregisterAssetFrame(std::coroutine_handle<> frame)
+{
+    std::lock_guard<std::mutex> lock(GlobalAssetFrames.mutex);
+    GlobalAssetFrames.frames.erase(frame.address());
+}
+
+void ResumeOnMainThread::await_suspend(std::coroutine_handle<> coroutine)
+{
+    std::lock_guard<std::mutex> lock(GlobalMainThreadQueue.mutex);
+    GlobalMainThreadQueue.queues[priority].push_back(coroutine);
+}
+
+void PumpAsyncAssets()
+{
+    // Only what was queued before this call runs now: a coroutine that queues
+    // itself again waits for the next frame
+    std::deque<std::coroutine_handle<>> ready;
+    {
+        std::lock_guard<std::mutex> lock(GlobalMainThreadQueue.mutex);
+        for (std::deque<std::coroutine_handle<>>& queue : GlobalMainThreadQueue.queues)
+        {
+            ready.insert(ready.end(), queue.begin(), queue.end());
+            queue.clear();
+        }
+    }
+
+    for (std::coroutine_handle<> coroutine : ready)
+    {
+        // The frame may finish and be gone after the resume, the state is
+        // kept alive here. Coroutines resumed from within, the ones awaiting
+        // a load that finishes, are counted in the load's time.
+        std::shared_ptr<AsyncAssetState> state;
+        {
+            std::lock_guard<std::mutex> lock(GlobalAssetFrames.mutex);
+            auto it = GlobalAssetFrames.frames.find(coroutine.address());
+            if (it != GlobalAssetFrames.frames.end())
+                state = it->second;
+        }
+
+        const auto begin = std::chrono::steady_clock::now();
+        coroutine.resume();
+        if (state)
+            state->mainThreadMs += std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    }
+}
+
+u32 GetPendingAsyncAssets()
+{
+    return GlobalMainThreadQueue.inFlight;
+}
+
+void CancelAsyncAssets()
+{
+    std::lock_guard<std::mutex> lock(GlobalAssetFrames.mutex);
+    for (const auto& [address, state] : GlobalAssetFrames.frames)
+        state->cancelled = true;
+}
+
+void DestroyAsyncAssets()
+{
+    // With the workers gone, every frame left is suspended: in the main
+    // thread queue or awaiting another load. None of them resumes again.
+    {
+        std::lock_guard<std::mutex> lock(GlobalMainThreadQueue.mutex);
+        for (std::deque<std::coroutine_handle<>>& queue : GlobalMainThreadQueue.queues)
+            queue.clear();
+    }
+
+    std::vector<void*> addresses;
+    {
+        std::lock_guard<std::mutex> lock(GlobalAssetFrames.mutex);
+        for (const auto& [address, state] : GlobalAssetFrames.frames)
+            addresses.push_back(address);
+    }
+
+    // Destroying a frame unregisters it
+    for (void* address : addresses)
+        std::coroutine_handle<>::from_address(address).destroy();
+}
+
+// Keeps the count of loads in flight for the GUI
+struct AsyncAssetScope
+{
+    AsyncAssetScope()  { GlobalMainThreadQueue.inFlight++; }
+    ~AsyncAssetScope() { GlobalMainThreadQueue.inFlight--; }
+};
+
+// Every coroutine below starts and ends on the main thread, which is where
+// the App is touched and where awaiting coroutines get resumed
+
+AssetTask LoadTextureAsync(App* app, std::string filepath, JobPriority priority)
+{
+    AsyncAssetScope scope;
+    std::shared_ptr<AsyncAssetState> state = co_await CurrentAssetState{};
+    state->priority = priority;
+
+    u32 texIdx = FindTexture2D(app, filepath.c_str());
+    if (texIdx != UINT32_MAX)
+        co_return RetainTexture(app, texIdx);
+
+    co_await ResumeOnWorker{ state->priority };
+
+    TextureUpload upload = {};
+    if (!state->cancelled)
+    {
+        Image image = LoadImage(filepath.c_str());
+        if (image.pixels)
+            upload = PrepareTextureUpload(image);
+    }
+
+    co_await ResumeOnMainThread{ state->priority };
+
+    if (!upload.image.pixels)
+        co_return UINT32_MAX;
+    if (state->cancelled)
+    {
+        FreeTextureUpload(upload);
+        co_return UINT32_MAX;
+    }
+
+    // Another load may have finished the same file meanwhile
+    texIdx = FindTexture2D(app, filepath.c_str());
+    if (texIdx != UINT32_MAX)
+    {
+        FreeTextureUpload(upload);
+        co_return RetainTexture(app, texIdx);
+    }
+
+    co_return AddTexture2D(app, filepath.c_str(), std::move(upload));
+}
+
+AssetTask LoadProgramAsync(App* app, std::string filepath, std::string programName, JobPriority priority, u32 variantMask, GLenum stage)
+{
+    AsyncAssetScope scope;
+    std::shared_ptr<AsyncAssetState> state = co_await CurrentAssetState{};
+    state->priority = priority;
+
+    u32 programIdx = FindProgram(app, filepath.c_str(), programName.c_str(), variantMask, stage);
+    if (programIdx != UINT32_MAX)
+    {
+        app->programs.AddRef(programIdx);
+        co_return programIdx;
+    }
+
+    co_await ResumeOnWorker{ state->priority };
+
+    // The preprocessor reads the files itself, without the frame arena
+    PreprocessedProgram source;
+    bool read = !state->cancelled && PreprocessProgram(filepath.c_str(), programName.c_str(), variantMask, source, stage);
+
+    co_await ResumeOnMainThread{ state->priority };
+
+    if (!read || state->cancelled)
+        co_return UINT32_MAX;
+
+    // Another load may have finished the same permutation meanwhile
+    programIdx = FindProgram(app, filepath.c_str(), programName.c_str(), variantMask, stage);
+    if (programIdx != UINT32_MAX)
+    {
+        app->programs.AddRef(programIdx);
+        co_return programIdx;
+    }
+
+    co_return AddProgram(app, source, programName.c_str(), variantMask);
+}
+
+AssetTask LoadModelAsync(App* app, std::string filepath, JobPriority priority)
+{
+    AsyncAssetScope scope;
+    std::shared_ptr<AsyncAssetState> state = co_await CurrentAssetState{};
+    state->priority = priority;
+
+    u32 modelIdx = FindModel(app, filepath.c_str());
+    if (modelIdx != UINT32_MAX)
+        co_return RetainModel(app, modelIdx);
+
+    const u32 minCloudPoints = app->pointCloudStreaming.minPoints;
+
+    co_await ResumeOnWorker{ state->priority };
+
+    // Point cloud octrees are cooked here too, AddModelFromScene() then
+    // finds their node files up to date
+    const aiScene* scene = nullptr;
+    std::vector<const aiMesh*> assimpMeshes;
+    if (!state->cancelled)
+        scene = ImportAssimpScene(filepath.c_str());
+    if (scene && !state->cancelled)
+    {
+        CookScenePointClouds(scene, filepath.c_str(), minCloudPoints);
+        assimpMeshes = CollectSubmeshAssimpMeshes(scene, minCloudPoints);
+    }
+
+    co_await ResumeOnMainThread{ state->priority };
+
+    if (!scene)
+        co_return UINT32_MAX;
+
+    u64 remainingVertexBytes, remainingIndexBytes;
+    GetAssimpGeometryBytes(assimpMeshes, &remainingVertexBytes, &remainingIndexBytes);
+
+    // One submesh at a time: converted on a worker, uploaded (or shared with
+    // an identical one) here and freed. The mesh belongs to no model until
+    // the end, so nothing draws it half built.
+    const u32 meshIdx = app->meshes.Add(Mesh{});
+    for (u32 i = 0; i < assimpMeshes.size() && !state->cancelled; ++i)
+    {
+        co_await ResumeOnWorker{ state->priority };
+        SubmeshData data = ProcessAssimpMesh(assimpMeshes[i]);
+        co_await ResumeOnMainThread{ state->priority };
+
+        AddSubmesh(app, meshIdx, data, remainingVertexBytes, remainingIndexBytes);
+        remainingVertexBytes -= data.vertices.size() * sizeof(float);
+        remainingIndexBytes -= data.indices.size() * sizeof(u32);
+    }
+
+    // Another load may have finished the same file meanwhile
+    modelIdx = FindModel(app, filepath.c_str());
+    if (state->cancelled || modelIdx != UINT32_MAX)
+    {
+        ReleaseMesh(app, meshIdx);
+        aiReleaseImport(scene);
+        co_return state->cancelled ? UINT32_MAX : RetainModel(app, modelIdx);
+    }
+
+    co_return AddModelFromScene(app, scene, filepath.c_str(), meshIdx);
+}
@@ -0,0 +1,158 @@
+//
+// async_assets.h: co_await-able asset loading (C++20 coroutines). Loads hop
+// to the job system for file I/O and decoding and back to the main thread
+// for anything touching the App or OpenGL, so the frame never blocks.
+//
+//     AssetTask LoadLevel(App* app)
+//     {
+//         u32 program = co_await LoadProgramAsync(app, "shaders.glsl", "SHOW_TEXTURED_MESH");
+//         u32 model = co_await LoadModelAsync(app, "Patrick/Patrick.obj");
+//         co_return model;
+//     }
+//
+
+#pragma once
+
+#include "engine.h"
+#include "job_system.h"
+#include <coroutine>
+#include <memory>
+#include <mutex>
+
+// State shared between a running load and the handles referring to it
+struct AsyncAssetState
+{
+    std::atomic<bool>       cancelled{ false };
+    std::atomic<bool>       done{ false };
+    u32                     result = UINT32_MAX;
+    JobPriority             priority = JobPriority_Normal;
+    f64                     mainThreadMs = 0.0; // Spent in the resumes PumpAsyncAssets() made of it
+    std::mutex              mutex;
+    std::coroutine_handle<> continuation; // Coroutine awaiting this one
+};
+
+// Every live coroutine frame is registered, so the ones still suspended at
+// shutdown can be destroyed
+void RegisterAssetFrame(std::coroutine_handle<> frame, std::shared_ptr<AsyncAssetState> state);
+void UnregisterAssetFrame(std::coroutine_handle<> frame);
+
+// Handle to an asset load. The coroutine starts running right away and owns
+// itself, so the handle can be dropped without cancelling it.
+struct AssetTask
+{
+    struct promise_type
+    {
+        std::shared_ptr<AsyncAssetState> state = std::make_shared<AsyncAssetState>();
+
+        promise_type()  { RegisterAssetFrame(std::coroutine_handle<promise_type>::from_promise(*this), state); }
+        ~promise_type() { UnregisterAssetFrame(std::coroutine_handle<promise_type>::from_promise(*this)); }
+
+        AssetTask get_return_object();
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        auto final_suspend() noexcept;
+        void return_value(u32 value) { state->result = value; }
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    std::shared_ptr<AsyncAssetState> state;
+
+    bool IsDone() const  { return state->done; }
+    u32  Result() const  { return state->result; } // UINT32_MAX if it failed or was cancelled
+    void Cancel()        { state->cancelled = true; }
+    void SetPriority(JobPriority priority) { state->priority = priority; }
+
+    // co_await on a task resumes once it has finished, on the main thread
+    bool await_ready() const { return state->done; }
+    bool await_suspend(std::coroutine_handle<> awaiting)
+    {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        if (state->done)
+            return false;
+        state->continuation = awaiting;
+        return true;
+    }
+    u32 await_resume() const { return state->result; }
+};
+
+inline auto AssetTask::promise_type::final_suspend() noexcept
+{
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+        void await_suspend(std::coroutine_handle<promise_type> finished) noexcept
+        {
+            std::shared_ptr<AsyncAssetState> state = finished.promise().state;
+            finished.destroy();
+
+            std::coroutine_handle<> continuation;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->done = true;
+                continuation = state->continuation;
+            }
+            if (continuation)
+                continuation.resume();
+        }
+        void await_resume() noexcept {}
+    };
+    return FinalAwaiter{};
+}
+
+inline AssetTask AssetTask::promise_type::get_return_object()
+{
+    return AssetTask{ state };
+}
+
+// co_await CurrentAssetState{} gives a coroutine access to its own state
+struct CurrentAssetState
+{
+    std::shared_ptr<AsyncAssetState> state;
+
+    bool await_ready() { return false; }
+    bool await_suspend(std::coroutine_handle<AssetTask::promise_type> self)
+    {
+        state = self.promise().state;
+        return false;
+    }
+    std::shared_ptr<AsyncAssetState> await_resume() { return state; }
+};
+
+// Continues the coroutine on a worker thread
+struct ResumeOnWorker
+{
+    JobPriority priority;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> coroutine)
+    {
+        RunJob([coroutine]() { coroutine.resume(); }, nullptr, priority);
+    }
+    void await_resume() {}
+};
+
+// Continues the coroutine on the main thread, during the next PumpAsyncAssets()
+struct ResumeOnMainThread
+{
+    JobPriority priority;
+
+    bool await_ready() { return false; }
+    void await_suspend(std::coroutine_handle<> coroutine);
+    void await_resume() {}
+};
+
+// Resumes the coroutines waiting for the main thread. Call once per frame.
+void PumpAsyncAssets();
+
+// Shutdown, in this order: CancelAsyncAssets() so the loads in flight skip
+// their remaining work, ShutdownJobSystem() to run the jobs already queued,
+// then DestroyAsyncAssets() to free the frames of the loads still suspended.
+void CancelAsyncAssets();
+void DestroyAsyncAssets();
+
+u32 GetPendingAsyncAssets();
+
+AssetTask LoadTextureAsync(App* app, std::string filepath, JobPriority priority = JobPriority_Normal);
+
+AssetTask LoadProgramAsync(App* app, std::string filepath, std::string programName, JobPriority priority = JobPriority_Normal, u32 variantMask = 0, GLenum stage = 0);
+
+AssetTask LoadModelAsync(App* app, std::string filepath, JobPriority priority = JobPriority_Normal);
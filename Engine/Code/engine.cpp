@@ -10,68 +10,55 @@
 #include <stb_image.h>
 #include <stb_image_write.h>
 #include "../assimp_model_loading.h"
-
-GLuint CreateProgramFromSource(String programSource, const char* shaderName)
+#include "texture_processing.h"
+#include "texture_streaming.h"
+#include "asset_cache.h"
+#include "hot_reload.h"
+#include "startup.h"
+#include "mesh_storage.h"
+#include "virtual_texture.h"
+#include "point_cloud.h"
+#include "program_cache.h"
+#include "shader_preprocessor.h"
+#include "program_reflection.h"
+#include "uniform_ring.h"
+#include "gl_state.h"
+#include "pipeline_warmup.h"
+#include "async_assets.h"
+
+static GLuint CompileShader(GLenum type, const char* source, const char* shaderName)
 {
     GLchar  infoLogBuffer[1024] = {};
     GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
     GLsizei infoLogSize;
     GLint   success;
 
-    char versionString[] = "#version 430\n";
-    char shaderNameDefine[128];
-    sprintf(shaderNameDefine, "#define %s\n", shaderName);
-    char vertexShaderDefine[] = "#define VERTEX\n";
-    char fragmentShaderDefine[] = "#define FRAGMENT\n";
-
-    const GLchar* vertexShaderSource[] = {
-        versionString,
-        shaderNameDefine,
-        vertexShaderDefine,
-        programSource.str
-    };
-    const GLint vertexShaderLengths[] = {
-        (GLint) strlen(versionString),
-        (GLint) strlen(shaderNameDefine),
-        (GLint) strlen(vertexShaderDefine),
-        (GLint) programSource.len
-    };
-    const GLchar* fragmentShaderSource[] = {
-        versionString,
-        shaderNameDefine,
-        fragmentShaderDefine,
-        programSource.str
-    };
-    const GLint fragmentShaderLengths[] = {
-        (GLint) strlen(versionString),
-        (GLint) strlen(shaderNameDefine),
-        (GLint) strlen(fragmentShaderDefine),
-        (GLint) programSource.len
-    };
-
-    GLuint vshader = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vshader, ARRAY_COUNT(vertexShaderSource), vertexShaderSource, vertexShaderLengths);
-    glCompileShader(vshader);
-    glGetShaderiv(vshader, GL_COMPILE_STATUS, &success);
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
     if (!success)
     {
-        glGetShaderInfoLog(vshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glCompileShader() failed with vertex shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
+        glGetShaderInfoLog(shader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
+        ELOG("glCompileShader() failed with %s shader %s\nReported message:\n%s\n",
+             type == GL_VERTEX_SHADER ? "vertex" : "fragment", shaderName, infoLogBuffer);
     }
+    return shader;
+}
 
-    GLuint fshader = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fshader, ARRAY_COUNT(fragmentShaderSource), fragmentShaderSource, fragmentShaderLengths);
-    glCompileShader(fshader);
-    glGetShaderiv(fshader, GL_COMPILE_STATUS, &success);
-    if (!success)
-    {
-        glGetShaderInfoLog(fshader, infoLogBufferSize, &infoLogSize, infoLogBuffer);
-        ELOG("glCompileShader() failed with fragment shader %s\nReported message:\n%s\n", shaderName, infoLogBuffer);
-    }
+static GLuint LinkProgram(const GLuint* shaders, u32 shaderCount, bool separable, const char* shaderName)
+{
+    GLchar  infoLogBuffer[1024] = {};
+    GLsizei infoLogBufferSize = sizeof(infoLogBuffer);
+    GLsizei infoLogSize;
+    GLint   success;
 
     GLuint programHandle = glCreateProgram();
-    glAttachShader(programHandle, vshader);
-    glAttachShader(programHandle, fshader);
+    for (u32 i = 0; i < shaderCount; ++i)
+        glAttachShader(programHandle, shaders[i]);
+    glProgramParameteri(programHandle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE); // For the program cache
+    if (separable)
+        glProgramParameteri(programHandle, GL_PROGRAM_SEPARABLE, GL_TRUE);
     glLinkProgram(programHandle);
     glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
     if (!success)
@@ -82,58 +69,162 @@ GLuint CreateProgramFromSource(String programSource, const char* shaderName)
 
     glUseProgram(0);
 
-    glDetachShader(programHandle, vshader);
-    glDetachShader(programHandle, fshader);
-    glDeleteShader(vshader);
-    glDeleteShader(fshader);
+    for (u32 i = 0; i < shaderCount; ++i)
+    {
+        glDetachShader(programHandle, shaders[i]);
+        glDeleteShader(shaders[i]);
+    }
 
     return programHandle;
 }
 
-u32 LoadProgram(App* app, const char* filepath, const char* programName)
+GLuint CreateProgramFromSource(const char* vertexSource, const char* fragmentSource, const char* shaderName)
 {
-    String programSource = ReadTextFile(filepath);
+    const GLuint shaders[] = { CompileShader(GL_VERTEX_SHADER, vertexSource, shaderName),
+                               CompileShader(GL_FRAGMENT_SHADER, fragmentSource, shaderName) };
+    return LinkProgram(shaders, ARRAY_COUNT(shaders), false, shaderName);
+}
+
+GLuint CreateSeparableProgramFromSource(GLenum stage, const char* source, const char* shaderName)
+{
+    // Not glCreateShaderProgramv(), the binary hint has to be set before the link
+    const GLuint shader = CompileShader(stage, source, shaderName);
+    return LinkProgram(&shader, 1, true, shaderName);
+}
 
+u32 FindProgram(App* app, const char* filepath, const char* programName, u32 variantMask, GLenum stage)
+{
+    for (u32 slot = 0; slot < app->programs.SlotCount(); ++slot)
+    {
+        if (!app->programs.IsSlotAlive(slot))
+            continue;
+        const Program& program = app->programs.slots[slot].value;
+        if (program.variantMask == variantMask && program.stage == stage && program.programName == programName && program.filepath == filepath)
+            return app->programs.HandleAt(slot);
+    }
+    return UINT32_MAX;
+}
+
+u32 LoadProgram(App* app, const char* filepath, const char* programName, u32 variantMask, GLenum stage)
+{
+    // Every permutation is compiled once and shared
+    u32 programIdx = FindProgram(app, filepath, programName, variantMask, stage);
+    if (programIdx != UINT32_MAX)
+    {
+        app->programs.AddRef(programIdx);
+        return programIdx;
+    }
+
+    PreprocessedProgram source;
+    if (!PreprocessProgram(filepath, programName, variantMask, source, stage))
+        return UINT32_MAX;
+    return AddProgram(app, source, programName, variantMask);
+}
+
+// Sampler name of each material slot in the shaders
+static const u32 MaterialSlotSamplerIds[MaterialSlot_Count] = { ShaderId("uTexture"), ShaderId("uEmissiveMap"), ShaderId("uNormalMap"), ShaderId("uPackedMap") };
+
+// Units 1 and 2 are taken by virtual texturing
+const u32 MaterialSlotTextureUnits[MaterialSlot_Count] = { 0, 3, 4, 5 };
+
+// Finds the material slots a program samples and points their samplers to
+// the units of the slots
+static void ReflectMaterialSamplers(Program& program)
+{
+    program.materialSlotMask = 0;
+    for (u32 slot = 0; slot < MaterialSlot_Count; ++slot)
+    {
+        const ProgramUniform* sampler = FindUniform(program, MaterialSlotSamplerIds[slot]);
+        if (sampler && sampler->type == GL_SAMPLER_2D)
+        {
+            program.materialSlotMask |= 1u << slot;
+            glProgramUniform1i(program.handle, sampler->location, MaterialSlotTextureUnits[slot]);
+        }
+    }
+}
+
+// Blocks written from C++ structs, see uniform_layout.h
+static const UniformBlockInfo MirroredUniformBlocks[] = { GetUniformBlockInfo<LocalParams>() };
+
+static void ValidateUniformBlocks(const Program& program)
+{
+    for (const UniformBlockInfo& info : MirroredUniformBlocks)
+        ValidateUniformBlock(program, info);
+}
+
+u32 AddProgram(App* app, const PreprocessedProgram& source, const char* programName, u32 variantMask)
+{
     Program program = {};
-    program.handle = CreateProgramFromSource(programSource, programName);
-    program.filepath = filepath;
+    program.handle = CreateCachedProgram(app, source, programName);
+    program.filepath = source.files[0];
     program.programName = programName;
-    program.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
-    
+    program.variantMask = variantMask;
+    program.stage = source.stage;
+    program.sourceFiles = source.files;
+    program.lastWriteTimestamp = GetProgramSourceTimestamp(source.files);
+    program.sourceHash = HashPreprocessedProgram(source);
 
-    GLint attributeCount;
-    glGetProgramiv(program.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
+    ReflectProgram(program);
+    ReflectMaterialSamplers(program);
+    ValidateUniformBlocks(program);
 
-    GLchar attributeName[128];
-    GLsizei attributeNameLength;
-    GLint attributeSize;
-    GLenum attributeType;
+    return app->programs.Add(program);
+}
 
-    for (int i = 0; i < attributeCount; ++i)
-    {
-        glGetActiveAttrib(program.handle, i, 128,
-            &attributeNameLength,
-            &attributeSize,
-            &attributeType,
-            attributeName);
+void SwapProgramHandle(App* app, u32 programIdx, GLuint handle)
+{
+    Program& program = app->programs[programIdx];
+
+    Program swapped = {};
+    swapped.handle = handle;
+    swapped.programName = program.programName;
+    ReflectProgram(swapped);
 
-        u8 attribute= glGetAttribLocation(program.handle, attributeName);
+    // Sampler units set after the load (not by reflection) live in the old program
+    for (const ProgramUniform& sampler : swapped.reflection.uniforms)
+    {
+        const ProgramUniform* oldSampler = FindUniform(program, sampler.nameHash);
+        if (sampler.type != GL_SAMPLER_2D || !oldSampler || oldSampler->type != GL_SAMPLER_2D)
+            continue;
 
-        program.vertexInputLayout.attributes.push_back({ attribute, u8(attributeSize) });
+        GLint unit = 0;
+        glGetUniformiv(program.handle, oldSampler->location, &unit);
+        glProgramUniform1i(handle, sampler.location, unit);
     }
 
-    app->programs.push_back(program);
-    return app->programs.size() - 1;
+    glDeleteProgram(program.handle);
+    ForgetWarmedProgram(app, programIdx);
+    program.handle = handle;
+    program.vertexInputLayout = std::move(swapped.vertexInputLayout);
+    program.reflection = std::move(swapped.reflection);
+    ReflectMaterialSamplers(program);
+    ValidateUniformBlocks(program);
 }
 
 Image LoadImage(const char* filename)
 {
     Image img = {};
-    stbi_set_flip_vertically_on_load(true);
-    img.pixels = stbi_load(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
+
+    // Keep the source precision: HDR stays float and 16-bit stays 16-bit
+    if (stbi_is_hdr(filename))
+    {
+        img.pixelType = PixelType_F32;
+        img.pixels = stbi_loadf(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
+    }
+    else if (stbi_is_16_bit(filename))
+    {
+        img.pixelType = PixelType_U16;
+        img.pixels = stbi_load_16(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
+    }
+    else
+    {
+        img.pixelType = PixelType_U8;
+        img.pixels = stbi_load(filename, &img.size.x, &img.size.y, &img.nchannels, 0);
+    }
+
     if (img.pixels)
     {
-        img.stride = img.size.x * img.nchannels;
+        img.stride = img.size.x * GetPixelSize(img);
     }
     else
     {
@@ -142,58 +233,300 @@ Image LoadImage(const char* filename)
     return img;
 }
 
+u32 GetPixelSize(const Image& image)
+{
+    switch (image.pixelType)
+    {
+        case PixelType_U16: return image.nchannels * sizeof(u16);
+        case PixelType_F32: return image.nchannels * sizeof(f32);
+        default:            return image.nchannels;
+    }
+}
+
 void FreeImage(Image image)
 {
     stbi_image_free(image.pixels);
 }
 
-GLuint CreateTexture2DFromImage(Image image)
+// Picks the smallest GL format able to hold the image without losing precision
+TextureFormat GetTextureFormat(const Image& image)
 {
-    GLenum internalFormat = GL_RGB8;
-    GLenum dataFormat     = GL_RGB;
-    GLenum dataType       = GL_UNSIGNED_BYTE;
+    static const GLenum dataFormats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    static const GLenum formats8[]    = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+    static const GLenum formats16[]   = { GL_R16, GL_RG16, GL_RGB16, GL_RGBA16 };
+    static const GLenum formatsF16[]  = { GL_R16F, GL_RG16F, GL_RGB9_E5, GL_RGBA16F };
 
-    switch (image.nchannels)
+    TextureFormat format = { GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA } };
+
+    if (image.nchannels < 1 || image.nchannels > 4)
+    {
+        ELOG("LoadTexture2D() - Unsupported number of channels (%d)", image.nchannels);
+        return format;
+    }
+
+    const u32 c = image.nchannels - 1;
+    format.dataFormat = dataFormats[c];
+    switch (image.pixelType)
+    {
+        case PixelType_U8:  format.internalFormat = formats8[c];   format.dataType = GL_UNSIGNED_BYTE;  break;
+        case PixelType_U16: format.internalFormat = formats16[c];  format.dataType = GL_UNSIGNED_SHORT; break;
+        case PixelType_F32: format.internalFormat = formatsF16[c]; format.dataType = GL_FLOAT;          break;
+    }
+
+    // Grayscale (and grayscale + alpha) images are stored in one or two
+    // channels and expanded back by the sampler
+    if (image.nchannels == 1)
+    {
+        format.swizzle[0] = GL_RED; format.swizzle[1] = GL_RED; format.swizzle[2] = GL_RED; format.swizzle[3] = GL_ONE;
+    }
+    else if (image.nchannels == 2)
+    {
+        format.swizzle[0] = GL_RED; format.swizzle[1] = GL_RED; format.swizzle[2] = GL_RED; format.swizzle[3] = GL_GREEN;
+    }
+
+    return format;
+}
+
+u32 GetGpuTexelSize(GLenum internalFormat)
+{
+    switch (internalFormat)
     {
-        case 3: dataFormat = GL_RGB; internalFormat = GL_RGB8; break;
-        case 4: dataFormat = GL_RGBA; internalFormat = GL_RGBA8; break;
-        default: ELOG("LoadTexture2D() - Unsupported number of channels");
+        case GL_R8:                                                  return 1;
+        case GL_RG8:  case GL_R16:  case GL_R16F:                    return 2;
+        case GL_RGB8:                                                return 3;
+        case GL_RGBA8: case GL_RG16: case GL_RG16F: case GL_RGB9_E5: return 4;
+        case GL_RGB16:                                               return 6;
+        default:                                                     return 8;
     }
+}
+
+ivec2 GetMipSize(ivec2 size, u32 level)
+{
+    return glm::max(ivec2(size.x >> level, size.y >> level), ivec2(1, 1));
+}
+
+u64 GetMipRangeBytes(const Texture& texture, u32 firstMip)
+{
+    u64 bytes = 0;
+    for (u32 level = firstMip; level < texture.mipCount; ++level)
+    {
+        ivec2 mipSize = GetMipSize(texture.size, level);
+        bytes += (u64)mipSize.x * mipSize.y * texture.texelSize;
+    }
+    return bytes;
+}
+
+// Creates an immutable texture holding mips [firstMip, mipCount) of a texture
+// of the given base size. Level 0 of the GL texture is mip firstMip.
+GLuint AllocateTexture2D(const TextureFormat& format, ivec2 size, u32 mipCount, u32 firstMip)
+{
+    ivec2 firstSize = GetMipSize(size, firstMip);
 
     GLuint texHandle;
     glGenTextures(1, &texHandle);
     glBindTexture(GL_TEXTURE_2D, texHandle);
-    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, image.size.x, image.size.y, 0, dataFormat, dataType, image.pixels);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexStorage2D(GL_TEXTURE_2D, mipCount - firstMip, format.internalFormat, firstSize.x, firstSize.y);
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, format.swizzle);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glGenerateMipmap(GL_TEXTURE_2D);
+    return texHandle;
+}
+
+// Uploads mip level (of the full chain) into a texture bound to GL_TEXTURE_2D
+// whose level 0 is firstMip
+void UploadTextureMip(const TextureFormat& format, u32 level, u32 firstMip, const Image& mip)
+{
+    // Rows of 1/2-channel and RGB images aren't necessarily 4-byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, level - firstMip, 0, 0, mip.size.x, mip.size.y, format.dataFormat, format.dataType, mip.pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// Uploads mips [firstMip, mipCount) of a prepared image
+GLuint CreateTexture2DFromUpload(const TextureUpload& upload, u32 firstMip)
+{
+    const Image& image = upload.image;
+    TextureFormat format = GetTextureFormat(image);
+    const u32 mipCount = 1 + (u32)upload.mips.size();
+
+    GLuint texHandle = AllocateTexture2D(format, image.size, mipCount, firstMip);
+
+    if (firstMip == 0)
+        UploadTextureMip(format, 0, firstMip, image);
+    for (u32 level = glm::max(firstMip, 1u); level < mipCount; ++level)
+        UploadTextureMip(format, level, firstMip, upload.mips[level - 1]);
+
     glBindTexture(GL_TEXTURE_2D, 0);
 
     return texHandle;
 }
 
-u32 LoadTexture2D(App* app, const char* filepath)
+u64 HashImage(const Image& image)
+{
+    // Dimensions go into the seed so equal bytes with a different shape don't match
+    u64 seed = ((u64)image.size.x << 40) ^ ((u64)image.size.y << 16) ^ ((u64)image.pixelType << 8) ^ (u64)image.nchannels;
+    return HashBytes(image.pixels, (u64)image.stride * image.size.y, seed);
+}
+
+// Hashes can collide, so a match is confirmed against the pixels of the
+// texture: read back while mip 0 is resident in a format that keeps them
+// exactly, decoded again from its file otherwise. Only happens on hash matches.
+static bool TextureMatchesImage(const Texture& tex, const Image& image)
+{
+    const TextureFormat format = GetTextureFormat(image);
+    const u64 byteSize = (u64)image.stride * image.size.y;
+    if (tex.size != image.size || tex.byteSize != byteSize ||
+        tex.format.internalFormat != format.internalFormat || tex.format.dataFormat != format.dataFormat)
+        return false;
+
+    if (tex.residentMip == 0 && image.pixelType != PixelType_F32)
+    {
+        std::vector<u8> gpuPixels(byteSize);
+        glBindTexture(GL_TEXTURE_2D, tex.handle);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glGetTexImage(GL_TEXTURE_2D, 0, format.dataFormat, format.dataType, gpuPixels.data());
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return memcmp(gpuPixels.data(), image.pixels, byteSize) == 0;
+    }
+
+    if (tex.flags & TextureFlag_Generated)
+        return false;
+
+    Image source = LoadImage(tex.filepath.c_str());
+    const bool matches = source.pixels && source.size == image.size && source.nchannels == image.nchannels &&
+                         source.pixelType == image.pixelType && memcmp(source.pixels, image.pixels, byteSize) == 0;
+    if (source.pixels)
+        FreeImage(source);
+    return matches;
+}
+
+// The flags have to match as well: the same pixels as sRGB color and as
+// linear data get their mips filtered in different spaces, and only files
+// can be streamed from
+static u32 FindTextureByContent(App* app, const Image& image, u32 flags, u64 contentHash)
+{
+    auto range = app->texturesByContent.equal_range(contentHash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        const Texture* tex = app->textures.Get(it->second);
+        if (tex && tex->flags == flags && TextureMatchesImage(*tex, image))
+            return it->second;
+    }
+    return UINT32_MAX;
+}
+
+void UnregisterTextureContent(App* app, u32 texIdx)
 {
-    for (u32 texIdx = 0; texIdx < app->textures.size(); ++texIdx)
-        if (app->textures[texIdx].filepath == filepath)
+    auto range = app->texturesByContent.equal_range(app->textures[texIdx].contentHash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        if (it->second == texIdx)
+        {
+            app->texturesByContent.erase(it);
+            return;
+        }
+    }
+}
+
+u32 FindTexture2D(App* app, const char* filepath)
+{
+    for (u32 slot = 0; slot < app->textures.SlotCount(); ++slot)
+    {
+        if (!app->textures.IsSlotAlive(slot))
+            continue;
+        u32 texIdx = app->textures.HandleAt(slot);
+        Texture& tex = app->textures[texIdx];
+        if (tex.filepath == filepath)
             return texIdx;
+        for (const std::string& alias : tex.aliasPaths)
+            if (alias == filepath)
+                return texIdx;
+    }
+    return UINT32_MAX;
+}
 
-    Image image = LoadImage(filepath);
+TextureUpload PrepareTextureUpload(Image image, u32 flags)
+{
+    TextureUpload upload = {};
+    upload.image = image;
+    upload.contentHash = HashImage(image);
 
-    if (image.pixels)
+    // Mips are filtered on the job system instead of glGenerateMipmap
+    upload.mips = GenerateMipChain(image, !(flags & TextureFlag_LinearData));
+    return upload;
+}
+
+void FreeTextureUpload(TextureUpload& upload)
+{
+    FreeImage(upload.image);
+    for (Image& mip : upload.mips)
+        FreeImage(mip);
+    upload = {};
+}
+
+u32 AddTexture2D(App* app, const char* filepath, TextureUpload upload, u32 flags)
+{
+    const Image& image = upload.image;
+    u64 contentHash = upload.contentHash;
+    u64 byteSize = (u64)image.stride * image.size.y;
+
+    // Same pixels under a different name: share the GPU texture
+    u32 sharedIdx = FindTextureByContent(app, image, flags, contentHash);
+    if (sharedIdx != UINT32_MAX)
     {
-        Texture tex = {};
-        tex.handle = CreateTexture2DFromImage(image);
-        tex.filepath = filepath;
+        app->textures[sharedIdx].aliasPaths.push_back(filepath);
+        app->textures.AddRef(sharedIdx);
+        app->dedupStats.texturesShared++;
+        app->dedupStats.textureBytesSaved += byteSize;
+        FreeTextureUpload(upload);
+        return sharedIdx;
+    }
 
-        u32 texIdx = app->textures.size();
-        app->textures.push_back(tex);
+    app->assetCache.misses++;
+
+    Texture tex = {};
+    tex.filepath = filepath;
+    tex.flags = flags;
+    tex.lastUsedFrame = app->assetCache.frame;
+    tex.size = image.size;
+    tex.mipCount = GetMipCount(image.size);
+    tex.format = GetTextureFormat(image);
+    tex.texelSize = GetGpuTexelSize(tex.format.internalFormat);
+
+    // Textures that can be decoded again start with their low mips only
+    tex.residentMip = 0;
+    if (!(flags & TextureFlag_Generated) && app->streaming.enabled)
+        tex.residentMip = GetInitialStreamingMip(app->streaming, tex.size);
+    tex.wantedMip = tex.residentMip;
+
+    tex.handle = CreateTexture2DFromUpload(upload, tex.residentMip);
+    app->streaming.residentBytes += GetMipRangeBytes(tex, tex.residentMip);
+    tex.contentHash = contentHash;
+    tex.byteSize = byteSize;
+    if (!(flags & TextureFlag_Generated))
+        tex.lastWriteTimestamp = GetFileLastWriteTimestamp(filepath);
+
+    u32 texIdx = app->textures.Add(tex);
+    app->texturesByContent.emplace(contentHash, texIdx);
+
+    FreeTextureUpload(upload);
+    return texIdx;
+}
 
-        FreeImage(image);
-        return texIdx;
+u32 LoadTexture2D(App* app, const char* filepath)
+{
+    u32 texIdx = FindTexture2D(app, filepath);
+    if (texIdx != UINT32_MAX)
+        return RetainTexture(app, texIdx);
+
+    Image image = LoadImage(filepath);
+
+    if (image.pixels)
+    {
+        return AddTexture2D(app, filepath, PrepareTextureUpload(image));
     }
     else
     {
@@ -201,6 +534,140 @@ u32 LoadTexture2D(App* app, const char* filepath)
     }
 }
 
+u32 RetainTexture(App* app, u32 texIdx)
+{
+    if (texIdx != UINT32_MAX)
+    {
+        app->textures.AddRef(texIdx);
+        app->textures[texIdx].lastUsedFrame = app->assetCache.frame;
+        app->assetCache.hits++;
+    }
+    return texIdx;
+}
+
+void ReleaseTexture(App* app, u32 texIdx)
+{
+    if (texIdx == UINT32_MAX || !app->textures.Release(texIdx))
+        return;
+
+    app->textures[texIdx].lastUsedFrame = app->assetCache.frame;
+    if (!app->assetCache.enabled)
+        UnloadTexture(app, texIdx);
+}
+
+void UnloadTexture(App* app, u32 texIdx)
+{
+    ASSERT(app->textures.GetRefCount(texIdx) == 0, "Unloading a texture still in use");
+
+    // A streaming job still decoding it will find the handle stale and drop its mips
+    Texture& tex = app->textures[texIdx];
+    app->streaming.residentBytes -= GetMipRangeBytes(tex, tex.residentMip);
+    glDeleteTextures(1, &tex.handle);
+    UnregisterTextureContent(app, texIdx);
+    app->textures.Remove(texIdx);
+}
+
+void ReleaseProgram(App* app, u32 programIdx)
+{
+    if (programIdx == UINT32_MAX || !app->programs.Release(programIdx))
+        return;
+
+    Program& program = app->programs[programIdx];
+    glDeleteProgram(program.handle);
+    app->programs.Remove(programIdx);
+}
+
+void ReleaseMaterial(App* app, u32 materialIdx)
+{
+    if (materialIdx == UINT32_MAX || !app->materials.Release(materialIdx))
+        return;
+
+    Material& material = app->materials[materialIdx];
+    ReleaseTexture(app, material.albedoTextureIdx);
+    ReleaseVirtualTexture(app, material.albedoVirtualTextureIdx);
+    ReleaseTexture(app, material.emissiveTextureIdx);
+    ReleaseTexture(app, material.normalsTextureIdx);
+    ReleaseTexture(app, material.packedTextureIdx);
+    app->materials.Remove(materialIdx);
+}
+
+// A deleted buffer stays alive while a VAO other than the bound one still
+// has it attached. Shared VAOs outlive the meshes, so they let go of theirs.
+static void DetachSharedVaoBuffers(App* app)
+{
+    for (const auto& [key, vaoHandle] : app->vertexArrays)
+    {
+        BindVertexArray(app, vaoHandle);
+        BindVertexBuffer(app, 0, 0, 0);
+        BindElementBuffer(app, 0);
+    }
+    BindVertexArray(app, 0);
+}
+
+void ReleaseMesh(App* app, u32 meshIdx)
+{
+    if (meshIdx == UINT32_MAX || !app->meshes.Release(meshIdx))
+        return;
+
+    Mesh& mesh = app->meshes[meshIdx];
+    DetachSharedVaoBuffers(app);
+    DestroyMeshStorage(mesh);
+
+    UnregisterSharedSubmeshes(app, meshIdx);
+
+    std::vector<u32> sharedMeshIdx;
+    sharedMeshIdx.swap(mesh.sharedMeshIdx);
+    app->meshes.Remove(meshIdx);
+
+    for (u32 sharedIdx : sharedMeshIdx)
+        ReleaseMesh(app, sharedIdx);
+}
+
+u32 RetainModel(App* app, u32 modelIdx)
+{
+    if (modelIdx != UINT32_MAX)
+    {
+        app->models.AddRef(modelIdx);
+        app->models[modelIdx].lastUsedFrame = app->assetCache.frame;
+        app->assetCache.hits++;
+    }
+    return modelIdx;
+}
+
+void UnregisterSharedSubmeshes(App* app, u32 meshIdx)
+{
+    for (auto it = app->sharedSubmeshes.begin(); it != app->sharedSubmeshes.end();)
+    {
+        if (it->second.meshIdx == meshIdx)
+            it = app->sharedSubmeshes.erase(it);
+        else
+            ++it;
+    }
+}
+
+void ReleaseModel(App* app, u32 modelIdx)
+{
+    if (modelIdx == UINT32_MAX || !app->models.Release(modelIdx))
+        return;
+
+    app->models[modelIdx].lastUsedFrame = app->assetCache.frame;
+    if (!app->assetCache.enabled)
+        UnloadModel(app, modelIdx);
+}
+
+void UnloadModel(App* app, u32 modelIdx)
+{
+    ASSERT(app->models.GetRefCount(modelIdx) == 0, "Unloading a model still in use");
+
+    Model& model = app->models[modelIdx];
+    ReleaseMesh(app, model.meshIdx);
+    for (u32 materialIdx : model.ownedMaterialIdx)
+        ReleaseMaterial(app, materialIdx);
+    for (u32 pointCloudIdx : model.pointCloudIdx)
+        ReleasePointCloud(app, pointCloudIdx);
+    app->models.Remove(modelIdx);
+}
+
 //Get the OPENGL hardware info
 OpenGLInfo GetOpenGlInfo()
 {
@@ -216,24 +683,25 @@ OpenGLInfo GetOpenGlInfo()
     return ret;
 }
 
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
+GLuint FindVAO(App* app, const Submesh& submesh, const Program& program)
 {
-    Submesh& submesh = mesh.submeshes[submeshIndex];
+    // The VAO only holds the vertex format, so it is shared by every submesh
+    // with the same layout, drawn by programs reading the same inputs
+    u32 inputMask = 0;
+    for (const VertexShaderAttribute& input : program.vertexInputLayout.attributes)
+        inputMask |= 1u << input.location;
+    const u64 key = HashBytes(&inputMask, sizeof(inputMask), GetVertexLayoutKey(submesh.vertexBufferLayout));
 
-    //Try finding a vao for this submesh/program
-    for (u32 i = 0; i < (u32)submesh.vaos.size(); ++i)
-        if (submesh.vaos[i].programHandle == program.handle)
-            return submesh.vaos[i].handle;
+    auto it = app->vertexArrays.find(key);
+    if (it != app->vertexArrays.end())
+        return it->second;
 
     GLuint vaoHandle = 0;
 
-    //Create a new vao for this submesh/program
+    //Create a new vao for this layout/program inputs
     {
         glGenVertexArrays(1, &vaoHandle);
-        glBindVertexArray(vaoHandle);
-
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBufferHandle);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.indexBufferHandle);
+        BindVertexArray(app, vaoHandle);
 
         //WE have to link all vertex inputs attributes to attributes in the vertex buffer
         for (u32 i = 0; i < program.vertexInputLayout.attributes.size(); ++i)
@@ -246,9 +714,9 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
                 {
                     const u32 index = submesh.vertexBufferLayout.attributes[j].location;
                     const u32 ncomp = submesh.vertexBufferLayout.attributes[j].componentCount;
-                    const u32 offset = submesh.vertexBufferLayout.attributes[j].offset + submesh.vertexOffset; //atribute offset + vertex offset
-                    const u32 stride = submesh.vertexBufferLayout.stride;
-                    glVertexAttribPointer(index, ncomp, GL_FLOAT, GL_FALSE, stride, (void*)(u64)offset);
+                    const u32 offset = submesh.vertexBufferLayout.attributes[j].offset; // Relative to the vertex, the buffer comes with BindSubmeshBuffers()
+                    glVertexAttribFormat(index, ncomp, GL_FLOAT, GL_FALSE, offset);
+                    glVertexAttribBinding(index, 0);
                     glEnableVertexAttribArray(index);
 
                     attributeWasLinked = true;
@@ -258,17 +726,60 @@ GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program)
 
             assert(attributeWasLinked); // the submesh should provide an attribute for each vertex inputs
         }
-
-        glBindVertexArray(0);
-        
     }
-    //Store it in the list of vaos for this submesh
-    Vao vao = { vaoHandle, program.handle };
-    submesh.vaos.push_back(vao);
+    app->vertexArrays[key] = vaoHandle;
 
     return vaoHandle;
 }
 
+void BindSubmeshBuffers(App* app, const Submesh& submesh)
+{
+    // Whole vertices of the offset go to the base vertex of the draw, so
+    // submeshes packed in the same chunk keep the same binding
+    const u32 stride = submesh.vertexBufferLayout.stride;
+    BindVertexBuffer(app, submesh.vertexBufferHandle, submesh.vertexOffset % stride, stride);
+    if (submesh.primitiveType != GL_POINTS)
+        BindElementBuffer(app, submesh.indexBufferHandle);
+}
+
+u64 GetVertexLayoutKey(const VertexBufferLayout& layout)
+{
+    u64 key = HashBytes(&layout.stride, sizeof(layout.stride));
+    return HashBytes(layout.attributes.data(), layout.attributes.size() * sizeof(VertexBufferAttribute), key);
+}
+
+u32 GetTexturedMeshPipeline(App* app, const Material& material)
+{
+    // Virtual textured materials use their own permutation, which samples
+    // the page cache instead of the albedo map
+    return material.albedoVirtualTextureIdx != UINT32_MAX ? app->texturedMeshVirtualPipelineIdx : app->texturedMeshPipelineIdx;
+}
+
+void DrawSubmesh(const Submesh& submesh, u32 maxCount)
+{
+    const GLint baseVertex = (GLint)(submesh.vertexOffset / submesh.vertexBufferLayout.stride);
+
+    // Counts are GLsizei, submeshes with more elements take several draws of
+    // whole primitives each
+    const u32 primitiveSize = submesh.primitiveType == GL_POINTS ? 1 : submesh.primitiveType == GL_LINES ? 2 : 3;
+    const u64 batchSize = INT32_MAX - INT32_MAX % primitiveSize;
+
+    // Points have no index buffer, they are drawn straight from the vertices
+    if (submesh.primitiveType == GL_POINTS)
+    {
+        const u64 count = glm::min<u64>(submesh.vertexCount, maxCount);
+        for (u64 first = 0; first < count; first += batchSize)
+            glDrawArrays(GL_POINTS, (GLint)(baseVertex + first), (GLsizei)glm::min(count - first, batchSize));
+    }
+    else
+    {
+        const u64 count = glm::min<u64>(submesh.indexCount, maxCount);
+        for (u64 first = 0; first < count; first += batchSize)
+            glDrawElementsBaseVertex(submesh.primitiveType, (GLsizei)glm::min(count - first, batchSize), GL_UNSIGNED_INT,
+                                     (void*)(submesh.indexOffset + first * sizeof(u32)), baseVertex);
+    }
+}
+
 void Init(App* app)
 {
     OpenGLErrorGuard guard("Init: ");
@@ -280,17 +791,18 @@ void Init(App* app)
 
     //Get the OpenGL info
      app->oGlI =  GetOpenGlInfo();
+     InitProgramCache(app);
+
+     // stb keeps the flag in a global that the workers decoding images read,
+     // so it is set once before any load starts
+     stbi_set_flip_vertically_on_load(true);
 
      glEnable(GL_DEPTH_TEST);
      // We only need to do this once
      glGetIntegerv(GL_MAX_UNIFORM_BLOCK_SIZE, &app->maxUniformBufferSize);
      glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT,&app->uniformBlockAlignment);
 
-     GLuint bufferHandle;
-     glGenBuffers(1, &bufferHandle);
-     glBindBuffer(GL_UNIFORM_BUFFER, bufferHandle);
-     glBufferData(GL_UNIFORM_BUFFER, app->maxUniformBufferSize, NULL, GL_STREAM_DRAW);
-     glBindBuffer(GL_UNIFORM_BUFFER, 0);
+     InitUniformRing(app, MB(1));
 
     // TODO: Initialize your resources here!
     // - vertex buffers
@@ -316,21 +828,117 @@ void Init(App* app)
      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, app->embeddedElements);
      glBindVertexArray(0);
 
-    // - programs (and retrieve uniform indices)
-     app->texturedGeometryProgramIdx = LoadProgram(app, "shaders.glsl", "TEXTURED_GEOMETRY");
-     Program& texturedGeometryProgram = app->programs[app->texturedGeometryProgramIdx];
-     app->programUniformTexture = glGetUniformLocation(texturedGeometryProgram.handle, "uTexture");
-
-     // - textures
-     app->diceTexIdx = LoadTexture2D(app, "dice.png");
-     app->whiteTexIdx = LoadTexture2D(app, "color_white.png");
-     app->blackTexIdx = LoadTexture2D(app, "color_black.png");
-     app->normalTexIdx = LoadTexture2D(app, "color_normal.png");
-     app->magentaTexIdx = LoadTexture2D(app, "color_magenta.png");
-
-     //Meshes
-     app->texturedMeshProgramIdx = LoadProgram(app, "shaders.glsl", "SHOW_TEXTURED_MESH");
-     app->model = LoadModel(app, "Patrick/Patrick.obj");
+    // - programs, textures and meshes: a graph of load tasks, see startup.h.
+    //   Loads overlap on the job system, the GL work runs here as they finish.
+     enum InitTask
+     {
+         InitTask_Systems,
+         InitTask_TexturedGeometryProgram,
+         InitTask_TexturedMeshVertexProgram,
+         InitTask_TexturedMeshProgram,
+         InitTask_TexturedMeshVirtualProgram,
+         InitTask_TexturedMeshVirtualUniforms,
+         InitTask_Pipelines,
+         InitTask_DiceTexture,
+         InitTask_WhiteTexture,
+         InitTask_BlackTexture,
+         InitTask_NormalTexture,
+         InitTask_MagentaTexture,
+         InitTask_Model,
+         InitTask_Count
+     };
+
+     std::vector<StartupTask> tasks(InitTask_Count);
+
+     tasks[InitTask_Systems] = { .name = "Streaming systems", .run = [app]()
+     {
+         InitTextureStreaming(app->streaming);
+         InitAssetCache(app->assetCache);
+         app->hotReload.pollInterval = 0.5f;
+         app->bumpToNormalStrength = 2.0f;
+         InitVirtualTexturing(app);
+         InitPointClouds(app);
+     } };
+
+     tasks[InitTask_TexturedGeometryProgram] = { .name = "Program TEXTURED_GEOMETRY",
+         .runAsync = [app]() { return LoadProgramAsync(app, "shaders.glsl", "TEXTURED_GEOMETRY", JobPriority_High); },
+         .result = &app->texturedGeometryProgramIdx };
+
+     // The textured mesh variants only differ in their fragment stage. As
+     // separable programs the vertex stage is compiled once for both; linked,
+     // the vertex task just shares the base program.
+     const GLenum vertexStage = app->separablePrograms ? GL_VERTEX_SHADER : 0;
+     const GLenum fragmentStage = app->separablePrograms ? GL_FRAGMENT_SHADER : 0;
+
+     tasks[InitTask_TexturedMeshVertexProgram] = { .name = "Program SHOW_TEXTURED_MESH (vertex)",
+         .runAsync = [app, vertexStage]() { return LoadProgramAsync(app, "shaders.glsl", "SHOW_TEXTURED_MESH", JobPriority_High, 0, vertexStage); },
+         .result = &app->texturedMeshVertexProgramIdx };
+
+     tasks[InitTask_TexturedMeshProgram] = { .name = "Program SHOW_TEXTURED_MESH",
+         .runAsync = [app, fragmentStage]() { return LoadProgramAsync(app, "shaders.glsl", "SHOW_TEXTURED_MESH", JobPriority_High, 0, fragmentStage); },
+         .result = &app->texturedMeshProgramIdx };
+
+     tasks[InitTask_TexturedMeshVirtualProgram] = { .name = "Program SHOW_TEXTURED_MESH (virtual texture)",
+         .runAsync = [app, fragmentStage]() { return LoadProgramAsync(app, "shaders.glsl", "SHOW_TEXTURED_MESH", JobPriority_High, ShaderFeature_VirtualTexture, fragmentStage); },
+         .result = &app->texturedMeshVirtualProgramIdx };
+     tasks[InitTask_TexturedMeshVirtualUniforms] = { .name = "Uniforms SHOW_TEXTURED_MESH (virtual texture)", .dependencies = { InitTask_TexturedMeshVirtualProgram }, .run = [app]()
+     {
+         Program& texturedMeshVirtualProgram = app->programs[app->texturedMeshVirtualProgramIdx];
+         SetUniform(texturedMeshVirtualProgram, ShaderId("uIndirection"), 1);
+         SetUniform(texturedMeshVirtualProgram, ShaderId("uPageCache"), 2);
+     } };
+
+     tasks[InitTask_Pipelines] = { .name = "Pipelines", .dependencies = { InitTask_TexturedGeometryProgram, InitTask_TexturedMeshVertexProgram, InitTask_TexturedMeshProgram, InitTask_TexturedMeshVirtualProgram }, .run = [app]()
+     {
+         PipelineDesc texturedQuad = {};
+         texturedQuad.programIdx = app->texturedGeometryProgramIdx;
+         texturedQuad.blend = BlendMode_Alpha;
+         texturedQuad.depthTest = true;
+         texturedQuad.depthWrite = true;
+         app->texturedQuadPipelineIdx = GetPipeline(app, texturedQuad);
+
+         PipelineDesc texturedMesh = {};
+         texturedMesh.depthTest = true;
+         texturedMesh.depthWrite = true;
+         if (app->separablePrograms)
+         {
+             texturedMesh.programIdx = app->texturedMeshVertexProgramIdx;
+             texturedMesh.fragmentProgramIdx = app->texturedMeshProgramIdx;
+             app->texturedMeshPipelineIdx = GetPipeline(app, texturedMesh);
+             texturedMesh.fragmentProgramIdx = app->texturedMeshVirtualProgramIdx;
+             app->texturedMeshVirtualPipelineIdx = GetPipeline(app, texturedMesh);
+         }
+         else
+         {
+             texturedMesh.programIdx = app->texturedMeshProgramIdx;
+             app->texturedMeshPipelineIdx = GetPipeline(app, texturedMesh);
+             texturedMesh.programIdx = app->texturedMeshVirtualProgramIdx;
+             app->texturedMeshVirtualPipelineIdx = GetPipeline(app, texturedMesh);
+         }
+     } };
+
+     // Texture creation depends on the streaming settings
+     tasks[InitTask_DiceTexture] = { .name = "Texture dice.png", .dependencies = { InitTask_Systems },
+         .runAsync = [app]() { return LoadTextureAsync(app, "dice.png"); }, .result = &app->diceTexIdx };
+     tasks[InitTask_WhiteTexture] = { .name = "Texture color_white.png", .dependencies = { InitTask_Systems },
+         .runAsync = [app]() { return LoadTextureAsync(app, "color_white.png"); }, .result = &app->whiteTexIdx };
+     tasks[InitTask_BlackTexture] = { .name = "Texture color_black.png", .dependencies = { InitTask_Systems },
+         .runAsync = [app]() { return LoadTextureAsync(app, "color_black.png"); }, .result = &app->blackTexIdx };
+     tasks[InitTask_NormalTexture] = { .name = "Texture color_normal.png", .dependencies = { InitTask_Systems },
+         .runAsync = [app]() { return LoadTextureAsync(app, "color_normal.png"); }, .result = &app->normalTexIdx };
+     tasks[InitTask_MagentaTexture] = { .name = "Texture color_magenta.png", .dependencies = { InitTask_Systems },
+         .runAsync = [app]() { return LoadTextureAsync(app, "color_magenta.png"); }, .result = &app->magentaTexIdx };
+
+     // Import and conversion run on the workers, but the uploads and the
+     // materials still land on the main thread: the report has that part
+     tasks[InitTask_Model] = { .name = "Model Patrick.obj", .dependencies = { InitTask_Systems },
+         .runAsync = [app]() { return LoadModelAsync(app, "Patrick/Patrick.obj"); }, .result = &app->model };
+
+     RunStartupTasks(app, tasks);
+
+     // The first frame shouldn't be the one paying for driver compiles
+     InitPipelineWarmUp(app);
+     WarmUpModelPipelines(app, app->model, true);
      
     app->mode = Mode_TexturedModel;
 }
@@ -348,6 +956,42 @@ void Gui(App* app)
     ImGui::Text("OpenGL GLSL version: %s", app->oGlI.glslVer);
     ImGui::End();
 
+    ImGui::Begin("Resources");
+    ImGui::Text("Async loads in flight: %u", GetPendingAsyncAssets());
+    ImGui::Text("Textures: %u (%u shared by content, %u slots)", app->textures.Count(), app->dedupStats.texturesShared, app->textures.SlotCount());
+    ImGui::Text("Materials: %u  Meshes: %u  Models: %u  Programs: %u",
+                app->materials.Count(), app->meshes.Count(), app->models.Count(), app->programs.Count());
+    ImGui::Text("Texture bytes saved: %.2f MB", app->dedupStats.textureBytesSaved / (f64)MB(1));
+    ImGui::Text("Submeshes shared by content: %u", app->dedupStats.submeshesShared);
+    ImGui::Text("Geometry bytes saved: %.2f MB", app->dedupStats.geometryBytesSaved / (f64)MB(1));
+    ImGui::Separator();
+    ImGui::Text("Maps folded into constants: %u", app->cookStats.texturesFolded);
+    ImGui::Text("Maps channel-packed: %u", app->cookStats.texturesPacked);
+    ImGui::Text("Normal maps generated from bump: %u", app->cookStats.normalMapsFromBump);
+    ImGui::Text("Cooking bytes saved: %.2f MB", app->cookStats.bytesSaved / (f64)MB(1));
+    ImGui::Separator();
+    ImGui::Text("Hot reloaded textures: %u in place, %u reallocated", app->hotReload.texturesPatched, app->hotReload.texturesReallocated);
+    ImGui::Text("Hot reloaded meshes: %u in place, %u rebuilt", app->hotReload.meshesPatched, app->hotReload.meshesRebuilt);
+    ImGui::Text("Hot reloaded programs: %u relinked, %u unchanged, %u failed", app->hotReload.programsRelinked, app->hotReload.programsUnchanged, app->hotReload.programsFailed);
+    ImGui::Text("Program binaries: %u from cache, %u compiled, %u rejected", app->programCache.hits, app->programCache.compiled, app->programCache.rejected);
+    ImGui::Text("GL state calls: %u issued, %u filtered", app->glState.lastFrame.issued, app->glState.lastFrame.filtered);
+    ImGui::Text("Shared VAOs: %u", (u32)app->vertexArrays.size());
+    ImGui::Text("Pipelines: %u, textured mesh %s", (u32)app->pipelines.size(), app->separablePrograms ? "from separable stages" : "linked");
+    ImGui::Text("Uniform ring: %u / %u bytes per frame, %u stalls, %u overflows", app->uniformRing.usedBytes, app->uniformRing.frameSize, app->uniformRing.stalls, app->uniformRing.overflows);
+    if (ImGui::Button("Reload model"))
+    {
+        ReleaseModel(app, app->model);
+        app->model = LoadModel(app, "Patrick/Patrick.obj");
+    }
+    ImGui::End();
+
+    StartupGui(app);
+    AssetCacheGui(app);
+    TextureStreamingGui(app);
+    VirtualTexturingGui(app);
+    PointCloudGui(app);
+    PipelineWarmUpGui(app);
+
     //Print OpenGl info
 }
 
@@ -355,39 +999,30 @@ void Update(App* app)
 {
     // You can handle app->input keyboard/mouse here
 
-    //Hot Reload
-    for (u64 i = 0; i < app->programs.size(); ++i)
-    {
-        Program& program = app->programs[i];
-        u64 currentTimestamp = GetFileLastWriteTimestamp(program.filepath.c_str());
-        if (currentTimestamp > program.lastWriteTimestamp)
-        {
-            glDeleteProgram(program.handle);
-            String programSource = ReadTextFile(program.filepath.c_str());
-            const char* programName = program.programName.c_str();
-            program.handle = CreateProgramFromSource(programSource, programName);
-            program.lastWriteTimestamp = currentTimestamp;
-        }
-    }
-
-    /*glBindBuffer(GL_UNIFORM_BUFFER, bufferHandle);
-    u8* bufferData = (u8*)glMapBuffer(GL_UNIFORM_BUFFER, GL_WRITE_ONLY);
-    u32 bufferHead = 0;
-
-    memcpy( bufferData + bufferHead, glm::value_ptr( worldMatrix), sizeof(glm::mat4));
-    bufferHead += sizeof(glm::mat4);
+    // Async asset loads continue their main thread part here
+    PumpAsyncAssets();
 
-    memcpy(bufferData + bufferHead, glm::value_ptr(worldViewProjectionMatrix), sizeof(glm::mat4));
-    bufferHead += sizeof(glm::mat4);
+    UpdateAssetCache(app);
+    UpdateHotReload(app);
+    UpdateTextureStreaming(app);
+    UpdateVirtualTexturing(app);
+    UpdatePointClouds(app);
 
-    glUnmapBuffer(GL_UNIFORM_BUFFER);
-    glBindBuffer(GL_UNIFORM_BUFFER,0);*/
+}
 
+// Same transform as ProjectPosition() in common.glsl until there is a
+// camera: a clipping scale of 5 and z flipped so Patrick faces us
+static glm::mat4 GetViewProjectionMatrix()
+{
+    return glm::scale(vec3(1.0f, 1.0f, -1.0f) / 5.0f);
 }
 
 void Render(App* app)
 {
     OpenGLErrorGuard guard("blur()");
+    BeginGlStateFrame(app);
+    BeginUniformFrame(app);
+
     switch (app->mode)
     {
         case Mode_TexturedQuad:
@@ -398,61 +1033,94 @@ void Render(App* app)
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
                 // - set the viewport
             glViewport(0, 0, app->displaySize.x, app->displaySize.y);
-            // - bind the program 
-            Program& programTexturedGeometry = app->programs[app->texturedGeometryProgramIdx];
-            glUseProgram(programTexturedGeometry.handle);
+            // - bind the program and the blending state
+            BindPipeline(app, app->texturedQuadPipelineIdx);
             // - bind the vao
-            glBindVertexArray(app->vao);
-                // - set the blending state
-            glEnable(GL_BLEND);
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-                // - bind the texture into unit 0
-            glUniform1i(app->programUniformTexture, 0);
-            glActiveTexture(GL_TEXTURE0);
-            GLuint textureHandle = app->textures[app->diceTexIdx].handle;
-            glBindTexture(GL_TEXTURE_2D, textureHandle);
+            BindVertexArray(app, app->vao);
+                // - bind the texture into unit 0 (uTexture points there since the load)
+            BindTexture(app, 0, app->textures[app->diceTexIdx].handle);
 
                 // - glDrawElements() !!!
             glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0);
-
-            glBindVertexArray(0);
-            glUseProgram(0);
             }
             break;
 
         case Mode::Mode_TexturedModel:
             {
+                // Constants go first, the ring is unmapped before any draw
+                u32 localParamsOffset = UINT32_MAX;
+                if (app->models.IsValid(app->model))
+                {
+                    LocalParams localParams = {};
+                    localParams.uWorldMatrix = glm::mat4(1.0f);
+                    localParams.uWorldViewProjectionMatrix = GetViewProjectionMatrix() * localParams.uWorldMatrix;
+                    localParamsOffset = PushUniformBlock(app, localParams);
+                }
+                FlushUniformFrame(app);
+
+                RenderVirtualTextureFeedback(app);
+
                 glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
                 glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
                 glViewport(0, 0, app->displaySize.x, app->displaySize.y);
 
-                Program& texturedMeshProgram = app->programs[app->texturedMeshProgramIdx];
-                glUseProgram(texturedMeshProgram.handle);
+                if (localParamsOffset == UINT32_MAX)
+                    break;
 
                 Model& model = app->models[app->model];
                 Mesh& mesh = app->meshes[model.meshIdx];
+                BindUniformRange(app, LOCAL_PARAMS_BINDING, localParamsOffset, sizeof(LocalParams));
 
                 for (u32 i = 0; i < mesh.submeshes.size(); ++i)
                 {
-                    GLuint vao = FindVAO(mesh, i, texturedMeshProgram);
-                    glBindVertexArray(vao);
-
                     u32 submeshMaterialIdx = model.materialIdx[i];
                     Material& submeshMaterial = app->materials[submeshMaterialIdx];
 
-                    glActiveTexture(GL_TEXTURE0);
-                    glBindTexture(GL_TEXTURE_2D, app->textures[submeshMaterial.albedoTextureIdx].handle);
-                    glUniform1i(app->texturedMeshProgram_uTexture, 0);
-
-                    Submesh& submesh = mesh.submeshes[i];
-                    glDrawElements(GL_TRIANGLES, submesh.indices.size(), GL_UNSIGNED_INT, (void*)(u64)submesh.indexOffset);
+                    const bool useVirtualTexture = submeshMaterial.albedoVirtualTextureIdx != UINT32_MAX;
+                    const u32 pipelineIdx = GetTexturedMeshPipeline(app, submeshMaterial);
+                    Program& texturedMeshProgram = GetPipelineFragmentProgram(app, pipelineIdx);
+                    BindPipeline(app, pipelineIdx);
+                    BindVertexArray(app, FindVAO(app, mesh.submeshes[i], GetPipelineVertexProgram(app, pipelineIdx)));
+                    BindSubmeshBuffers(app, mesh.submeshes[i]);
+
+                    // Only the slots the program samples get loaded. Maps folded
+                    // into a constant don't need a texture.
+                    u32 slotTextures[MaterialSlot_Count];
+                    for (u32 slot = 0; slot < MaterialSlot_Count; ++slot)
+                    {
+                        slotTextures[slot] = UINT32_MAX;
+                        if (!(texturedMeshProgram.materialSlotMask & (1u << slot)))
+                            continue;
+
+                        slotTextures[slot] = RequestMaterialTexture(app, submeshMaterialIdx, (MaterialSlot)slot);
+                        if (slotTextures[slot] != UINT32_MAX)
+                            BindTexture(app, MaterialSlotTextureUnits[slot], app->textures[slotTextures[slot]].handle);
+                    }
+
+                    if (useVirtualTexture)
+                    {
+                        BindVirtualTexture(app, submeshMaterial.albedoVirtualTextureIdx, texturedMeshProgram);
+                    }
+                    else
+                    {
+                        SetUniform(texturedMeshProgram, ShaderId("uHasAlbedoMap"), (i32)(slotTextures[MaterialSlot_Albedo] != UINT32_MAX));
+                    }
+                    SetUniform(texturedMeshProgram, ShaderId("uAlbedoColor"), submeshMaterial.albedo);
+
+                    DrawSubmesh(mesh.submeshes[i]);
                 }
+
+                RenderPointClouds(app, model);
             }
             break;
 
         default:;
     }
+
+    EndUniformFrame(app);
+    EndGlStateFrame(app);
+    MarkFirstFrame(app);
 }
 
 void OpenGLErrorGuard::checkGLError(const char* around, const char* message)
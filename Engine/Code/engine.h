@@ -5,7 +5,12 @@
 #pragma once
 
 #include "platform.h"
+#include "resource_pool.h"
+#include "uniform_layout.h"
 #include <glad/glad.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <memory>
 
 typedef glm::vec2  vec2;
 typedef glm::vec3  vec3;
@@ -14,18 +19,69 @@ typedef glm::ivec2 ivec2;
 typedef glm::ivec3 ivec3;
 typedef glm::ivec4 ivec4;
 
+enum PixelType
+{
+    PixelType_U8,
+    PixelType_U16,
+    PixelType_F32, // HDR images
+};
+
 struct Image
 {
-    void* pixels;
-    ivec2 size;
-    i32   nchannels;
-    i32   stride;
+    void*     pixels;
+    ivec2     size;
+    i32       nchannels;
+    i32       stride;
+    PixelType pixelType;
+};
+
+// A decoded image with everything AddTexture2D() needs besides GL calls,
+// built on a worker by PrepareTextureUpload()
+struct TextureUpload
+{
+    Image              image;
+    std::vector<Image> mips;        // Levels 1 onwards
+    u64                contentHash;
+};
+
+struct TextureFormat
+{
+    GLenum internalFormat;
+    GLenum dataFormat;
+    GLenum dataType;
+    GLint  swizzle[4];
+};
+
+enum TextureFlags
+{
+    TextureFlag_LinearData = 1 << 0, // Not gamma encoded color (normals, masks...)
+    TextureFlag_Generated  = 1 << 1, // Built at load time, there's no file to stream it from
 };
 
 struct Texture
 {
-    GLuint      handle;
-    std::string filepath;
+    GLuint        handle;
+    std::string   filepath;
+    u32           flags;
+    ivec2         size;        // Size of mip 0, even if it is not resident
+    u32           mipCount;
+    TextureFormat format;
+    u32           texelSize;
+
+    // Streaming: the GL texture only holds mips [residentMip, mipCount)
+    u32           residentMip;
+    u32           wantedMip;
+    f32           streamingPriority;
+    bool          streamPending;
+
+    std::vector<std::string> aliasPaths; // Other files that decoded to the same pixels
+    u64         contentHash;
+    u64         byteSize;
+
+    u64         lastUsedFrame; // Asset cache: frame it was last acquired or released
+
+    u64         lastWriteTimestamp; // Hot reload, 0 for generated textures
+    bool        reloadPending;
 };
 
 enum Mode
@@ -85,59 +141,519 @@ struct VertexShaderLayout
     std::vector<VertexShaderAttribute> attributes;
 };
 
+// Active uniform outside of blocks. Names are hashed with HashShaderName().
+struct ProgramUniform
+{
+    u32    nameHash;
+    GLint  location;
+    GLenum type;      // GL_FLOAT_VEC3, GL_SAMPLER_2D...
+    u32    arraySize;
+};
+
+// Member of a uniform or storage block, named without the "Block." prefix
+struct ProgramBlockMember
+{
+    u32    nameHash;
+    u32    offset;
+    GLenum type;
+    u32    arraySize;
+    u32    arrayStride; // 0 if it isn't an array
+};
+
+// Active uniform or shader storage block
+struct ProgramBlock
+{
+    u32    nameHash;
+    GLuint index;
+    GLint  binding;
+    u32    dataSize;
+    bool   storage;
+    u32    firstMember; // In ProgramReflection::blockMembers, in offset order
+    u32    memberCount;
+};
+
+// Built by ReflectProgram() at load and after every hot reload
+struct ProgramReflection
+{
+    std::vector<ProgramUniform>     uniforms; // Sorted by nameHash
+    std::vector<ProgramBlock>       blocks;   // Sorted by nameHash
+    std::vector<ProgramBlockMember> blockMembers;
+};
+
 struct Program
 {
     GLuint             handle;
     std::string        filepath;
     std::string        programName;
-    u64                lastWriteTimestamp; 
+    u32                variantMask;        // ShaderFeature bits defined in this permutation
+    GLenum             stage;              // 0 if linked, else the only stage of a separable program
+    std::vector<std::string> sourceFiles;  // filepath and the files it includes
+    u64                lastWriteTimestamp; // Newest of the source files
+    u64                sourceHash;         // Of the preprocessed stages, see HashPreprocessedProgram()
+    bool               reloadPending;
     VertexShaderLayout vertexInputLayout;
+    ProgramReflection  reflection;
+    u32                materialSlotMask; // Bit per MaterialSlot sampled by the program
 };
 
 
 
-struct Vao
+// Vertices and indices of a submesh on the CPU. They only live while the
+// submesh is being uploaded.
+struct SubmeshData
 {
-    GLuint handle;
-    GLuint programHandle;
+    GLenum             primitiveType;
+    VertexBufferLayout vertexBufferLayout;
+    std::vector<float> vertices;
+    std::vector<u32>   indices; // Empty for points, drawn straight from the vertices
+    f32                surfaceArea;
+    f32                uvDensity;
 };
 
 struct Submesh
 {
+    GLenum primitiveType; // GL_TRIANGLES, GL_LINES or GL_POINTS
     VertexBufferLayout vertexBufferLayout;
-    std::vector<float> vertices;
-    std::vector <u32 > indices;
-    u32 vertexOffset;
-    u32 indexOffset;
+    u64 vertexCount;
+    u64 indexCount;
+    u64 vertexOffset; // In bytes, inside the chunk buffers
+    u64 indexOffset;
 
-    std::vector<Vao> vaos;
+    // Chunk buffers where this submesh data lives. They are the ones of the
+    // owning mesh unless an identical submesh was already uploaded by another mesh.
+    GLuint vertexBufferHandle;
+    GLuint indexBufferHandle;
+    u64    contentHash;
+
+    // Used to estimate the texture resolution it needs on screen
+    f32 surfaceArea; // In world units
+    f32 uvDensity;   // UV units per world unit
 };
 
-struct Mesh
+// Pair of GL buffers holding whole submeshes. Big meshes are split across
+// several chunks so no single buffer or offset has to hold the whole model.
+struct MeshChunk
 {
-    std::vector<Submesh> submeshes;
     GLuint vertexBufferHandle;
     GLuint indexBufferHandle;
+    u64    vertexCapacity;
+    u64    indexCapacity;
+    u64    vertexBytesUsed;
+    u64    indexBytesUsed;
+};
+
+struct Mesh
+{
+    std::vector<Submesh> submeshes;
+    std::vector<MeshChunk> chunks;
+
+    // Meshes whose buffers hold some of our submeshes, referenced so they
+    // outlive this one
+    std::vector<u32> sharedMeshIdx;
+
+    u64 cpuBytes; // Submesh descriptions, the vertex data only lives on the GPU
+    u64 gpuBytes; // Chunk buffers owned by this mesh
+};
+
+// Source files of the material maps before they are cooked into textures
+struct MaterialTextureSources
+{
+    std::string albedo;
+    std::string emissive;
+    std::string specular;
+    std::string smoothness;
+    std::string normals;
+    std::string bump;       // Only used to generate normals, never sampled
+    std::string occlusion;
+};
+
+// Mirror of the LocalParams uniform block of shaders.glsl
+struct LocalParams
+{
+    glm::mat4 uWorldMatrix;
+    glm::mat4 uWorldViewProjectionMatrix;
+};
+UNIFORM_BLOCK_LAYOUT(LocalParams, UniformLayout_Std140,
+    UNIFORM_BLOCK_MEMBER(LocalParams, uWorldMatrix),
+    UNIFORM_BLOCK_MEMBER(LocalParams, uWorldViewProjectionMatrix));
+
+// Texture slots of a material. They are cooked the first time a program with
+// a sampler for the slot draws the material.
+enum MaterialSlot
+{
+    MaterialSlot_Albedo,
+    MaterialSlot_Emissive,
+    MaterialSlot_Normals,
+    MaterialSlot_Packed,
+    MaterialSlot_Count
+};
+
+enum MaterialSlotState : u8
+{
+    MaterialSlotState_Unloaded,
+    MaterialSlotState_Loading,
+    MaterialSlotState_Ready,    // Its texture index is final, UINT32_MAX if there's no map
 };
 
+// Texture unit each material slot is bound to
+extern const u32 MaterialSlotTextureUnits[MaterialSlot_Count];
+
 struct Material
 {
     std::string name;
     vec3 albedo;
     vec3 emissive;
+    f32 specular;
     f32 smoothness;
-    u32 albedoTextureIdx;
-    u32 emissiveTextureIdx;
-    u32 specularTextureIdx;
-    u32 normalsTextureIdx;
-    u32 bumpTextureIdx;
+    u32 albedoTextureIdx;   // UINT32_MAX when the map was folded into albedo
+    u32 emissiveTextureIdx; // UINT32_MAX when the map was folded into emissive
+    u32 normalsTextureIdx;  // Generated from the bump map when there is no normal map
+    u32 albedoVirtualTextureIdx; // Set instead of albedoTextureIdx for huge albedo maps
+
+    // Grayscale maps packed in a single RGBA texture:
+    // R: specular, G: smoothness, B: ambient occlusion, A: unused.
+    // Channels without a source map take their value from packedConstants.
+    u32  packedTextureIdx;
+    vec4 packedConstants;
+
+    // Texture indices above are UINT32_MAX until their slot is Ready
+    MaterialTextureSources sources;
+    MaterialSlotState      slotStates[MaterialSlot_Count];
 };
 
 struct Model
 {
+    std::string filepath;
+    u64 lastUsedFrame; // Asset cache: frame it was last acquired or released
+    u64 lastWriteTimestamp;
+    bool reloadPending;
     u32 meshIdx;
-    std::vector<u32> materialIdx;
+    std::vector<u32> materialIdx;      // One per submesh
+    std::vector<u32> ownedMaterialIdx; // One per scene material, released with the model
+    std::vector<u32> pointCloudIdx;    // Point meshes too big to be submeshes
+};
+
+// Entry of the registry used to share the GPU data of identical submeshes
+struct SharedSubmesh
+{
+    u32 meshIdx;
+    u32 submeshIdx;
+};
+
+struct DedupStats
+{
+    u32 texturesShared;
+    u32 submeshesShared;
+    u64 textureBytesSaved;
+    u64 geometryBytesSaved;
+};
+
+struct TextureStreaming
+{
+    bool enabled;
+    u64  budgetBytes;
+    u64  residentBytes;
+    u32  tailSize;        // Mips up to this size are always resident
+    u32  maxPendingLoads;
+    u32  pendingLoads;
+    f32  pixelsPerWorldUnit;
+    u32  streamedIn;
+    u32  evicted;
+};
+
+// Open page file of a virtual texture, defined in virtual_texture.cpp
+struct VirtualPageFile;
+
+struct VirtualTexture
+{
+    std::string sourcePath;
+    std::string pageFilePath;   // Pages of every mip, cooked from sourcePath
+    std::shared_ptr<VirtualPageFile> pageFile; // Shared with the page reads in flight
+    ivec2       size;
+    u32         mipCount;       // Down to the mip that fits in a single page
+    std::vector<ivec2> pagesPerMip;
+    std::vector<u32>   firstPageOfMip; // Index of the first page of each mip in the page file
+
+    // Indirection: one RGBA8 texel per page and mip, pointing to the cache
+    // slot of the page or of its closest resident ancestor
+    GLuint             indirectionHandle;
+    std::vector<std::vector<u32>> indirection;
+    bool               indirectionDirty;
 };
+
+struct VirtualPageSlot
+{
+    u32  virtualTextureIdx; // UINT32_MAX when the slot is free
+    u32  mip;
+    u32  x, y;
+    u64  lastUsedFrame;
+    bool locked;            // Coarsest pages never leave the cache
+};
+
+struct VirtualTexturing
+{
+    bool   enabled;
+    u32    minSourceSize;  // Images at least this big become virtual textures
+    u32    pageSize;
+    u32    cacheSlotsPerSide;
+    GLuint pageCacheHandle;
+    std::vector<VirtualPageSlot> slots;
+    std::unordered_map<u64, u32> residentPages; // Page key -> slot
+
+    // Feedback pass: page IDs rendered at low resolution and read back asynchronously
+    u32    feedbackProgramIdx;
+    u32    feedbackPipelineIdx;
+    u32    feedbackDivisor;
+    ivec2  feedbackSize;
+    GLuint feedbackFramebuffer;
+    GLuint feedbackColor;
+    GLuint feedbackDepth;
+    GLuint readbackBuffers[2];
+    GLsync readbackFences[2];
+    u64    frame;
+
+    std::vector<u64> pendingPages;
+    u32    maxLoadsPerFrame;
+
+    // Albedo sources being cooked. Other materials with the same source wait
+    // for the cook instead of writing the same page file.
+    std::unordered_set<std::string> cookingSources;
+    u32    pagesLoaded;
+    u32    pagesEvicted;
+};
+
+// Octree node of a point cloud. A node holds a subsample of the points inside
+// its bounds, about `spacing` apart; its children hold the points in between.
+struct PointCloudNode
+{
+    vec3   boundsMin;
+    vec3   boundsMax;
+    f32    spacing;
+    u32    children[8]; // UINT32_MAX where there's no child
+    u32    pointCount;
+    u64    fileOffset;  // Of its points, in the node file
+
+    GLuint vertexBufferHandle; // 0 while not resident
+    GLuint vao;
+    u64    lastUsedFrame;
+    bool   loadPending;
+};
+
+struct PointCloud
+{
+    std::string sourcePath;
+    std::string nodeFilePath;  // Points of every node, cooked from sourcePath
+    u64         pointCount;
+    std::vector<PointCloudNode> nodes; // Root first, empty once released
+
+    // Selected by the last update: node and point size in pixels
+    std::vector<u32> visibleNodes;
+    std::vector<f32> visiblePointSizes;
+};
+
+struct PointCloudStreaming
+{
+    bool  enabled;
+    u32   minPoints;      // Point meshes at least this big become point clouds
+    f32   targetSpacing;  // Pixels between points on screen before refining a node
+    u64   pointBudget;    // Points drawn per frame
+    u64   budgetBytes;    // Resident node data
+    u64   residentBytes;
+    u32   maxPendingLoads;
+    u32   pendingLoads;
+    u64   frame;
+
+    u32   programIdx;
+    u32   pipelineIdx;
+
+    u32   visibleNodes;
+    u64   pointsDrawn;
+    u32   nodesLoaded;
+    u32   nodesEvicted;
+};
+
+// Unreferenced textures and models are kept loaded until the memory budgets
+// require evicting them, least recently used first
+struct AssetCache
+{
+    bool enabled;
+    u64  cpuBudgetBytes;
+    u64  gpuBudgetBytes;
+    u64  cpuBytes;
+    u64  gpuBytes;
+    u64  frame;
+    u32  cachedTextures; // Loaded but unreferenced
+    u32  cachedModels;
+    u32  hits;
+    u32  misses;
+    u32  evictions;
+};
+
+struct HotReload
+{
+    f32  pollInterval; // Seconds between checks of the file timestamps
+    f32  timeSincePoll;
+    bool pollPending;
+    u32  texturesPatched;     // Same size and format: uploaded into the existing storage
+    u32  texturesReallocated;
+    u32  meshesPatched;       // Same layout: buffers updated in place
+    u32  meshesRebuilt;
+    u32  programsRelinked;
+    u32  programsUnchanged;   // Files touched but the preprocessed source is the same
+    u32  programsFailed;      // The previous version stays in use
+};
+
+struct ProgramCache
+{
+    bool enabled;
+    u64  driverHash; // Vendor, renderer and version: binaries don't survive driver changes
+    u32  hits;
+    u32  compiled;
+    u32  rejected;   // Binaries found but refused by the driver
+};
+
+enum BlendMode : u8
+{
+    BlendMode_Opaque,
+    BlendMode_Alpha,
+    BlendMode_Additive,
+};
+
+enum CullMode : u8
+{
+    CullMode_None,
+    CullMode_Back,
+    CullMode_Front,
+};
+
+// Program and fixed function state of a draw. Pipelines are built once
+// through GetPipeline() and never change.
+//
+// programIdx is either a linked program, or with fragmentProgramIdx set, a
+// separable vertex stage combined with a separable fragment stage in a
+// program pipeline object. Stages are then compiled once however many
+// pipelines combine them, and VAOs are shared between pipelines with the
+// same vertex stage.
+struct PipelineDesc
+{
+    u32       programIdx;  // Handles survive hot reload, the GL program is looked up on bind
+    u32       fragmentProgramIdx; // Separable fragment stage, 0 (never a valid handle) if programIdx is linked
+    BlendMode blend;
+    bool      depthTest;
+    bool      depthWrite;
+    CullMode  cull;
+    bool      wireframe;
+    bool      programPointSize;
+};
+
+struct Pipeline
+{
+    PipelineDesc desc;
+    u64          key;
+
+    // Program pipeline object of separable pipelines, with the program
+    // handles it has attached. Hot reloaded stages get attached on bind.
+    GLuint       programPipeline;
+    GLuint       vertexStage;
+    GLuint       fragmentStage;
+};
+
+#define GL_STATE_TEXTURE_UNITS    8
+#define GL_STATE_UNIFORM_BINDINGS 4
+#define GL_STATE_UNKNOWN          0xFF // Shadowed flags not known since the last invalidation
+
+struct GlStateCounters
+{
+    u32 issued;
+    u32 filtered; // Calls skipped because the context already had the state
+};
+
+// What the context has bound, as far as the engine knows. Render code goes
+// through gl_state.h so binds matching the shadow are skipped; the shadow is
+// invalidated every frame, since ImGui and the loaders bind behind its back.
+struct GlState
+{
+    GLuint program;
+    GLuint programPipeline; // Only used while program is 0
+    GLuint vertexArray;
+    GLuint elementBuffer;  // Of the bound VAO, unknown after switching VAO
+    struct { GLuint buffer; u64 offset; u32 stride; } vertexBuffer; // Binding 0 of the bound VAO, same
+    u32    activeTextureUnit;
+    GLuint textures[GL_STATE_TEXTURE_UNITS];
+    struct { GLuint buffer; u32 offset; u32 size; } uniformBuffers[GL_STATE_UNIFORM_BINDINGS];
+    u8     blend;              // BlendMode
+    u8     depthTest;
+    u8     depthWrite;
+    u8     cull;               // CullMode
+    u8     wireframe;
+    u8     programPointSize;
+
+    GlStateCounters frame;     // Being counted
+    GlStateCounters lastFrame;
+};
+
+#define UNIFORM_RING_FRAMES 3
+
+// Binding of the LocalParams block in shaders.glsl
+#define LOCAL_PARAMS_BINDING 1
+
+// Per-frame constants, see uniform_ring.h
+struct UniformRing
+{
+    GLuint handle;
+    u32    frameSize;  // Bytes of each frame region
+    u32    frame;      // Region written this frame
+    u8*    mapped;     // The region while it is being written
+    u32    head;
+    GLsync fences[UNIFORM_RING_FRAMES];
+    u32    usedBytes;  // Last frame
+    u32    stalls;     // Frames that waited for the GPU to release their region
+    u32    overflows;
+};
+
+// A draw done once offscreen, see pipeline_warmup.h
+struct WarmedDraw
+{
+    u32    pipelineIdx;
+    u64    layoutKey;     // GetVertexLayoutKey() of the vertices drawn
+    GLenum primitiveType;
+    f32    milliseconds;  // Of the draw and the wait for it
+};
+
+struct PipelineWarmUp
+{
+    GLuint framebuffer;
+    GLuint colorTarget;
+    GLuint depthTarget;
+    GLuint uniformBuffer; // Zeros, bound to every block binding
+    std::unordered_map<u64, WarmedDraw> warmed; // By combination key
+    f32    totalMilliseconds;
+};
+
+struct StartupTiming
+{
+    std::string name;
+    f64         startMs; // Since the beginning of Init()
+    f64         endMs;
+    bool        async;
+    f64         mainThreadMs; // Of an async task, the part it still ran on the main thread
+};
+
+struct StartupReport
+{
+    std::vector<StartupTiming> tasks;
+    f64 initMs;
+    f64 firstFrameMs;
+};
+
+struct CookStats
+{
+    u32 texturesFolded;  // Uniform-color maps replaced by material constants
+    u32 texturesPacked;  // Grayscale maps merged into packed textures
+    u32 normalMapsFromBump;
+    u64 bytesSaved;
+};
+
 struct App
 {
     // Loop
@@ -153,19 +669,46 @@ struct App
     ivec2 displaySize;
 
     //Models & materials
-    std::vector<Texture> textures;
-    std::vector<Material> materials;
-    std::vector<Mesh> meshes;
-    std::vector<Model> models;
-    std::vector<Program> programs;
+    // The *Idx fields all over the engine are generational handles into these pools
+    ResourcePool<Texture> textures;
+    ResourcePool<Material> materials;
+    ResourcePool<Mesh> meshes;
+    ResourcePool<Model> models;
+    ResourcePool<Program> programs;
+
+    //Content-hash deduplication, hashes can collide so a key may hold several entries
+    std::unordered_multimap<u64, SharedSubmesh> sharedSubmeshes;
+    std::unordered_multimap<u64, u32> texturesByContent;
+    DedupStats dedupStats;
+    CookStats cookStats;
+    f32 bumpToNormalStrength;
+
+    TextureStreaming streaming;
+    AssetCache assetCache;
+    HotReload hotReload;
+
+    StartupReport startup;
+    ProgramCache programCache;
+
+    ResourcePool<VirtualTexture> virtualTextures;
+    VirtualTexturing virtualTexturing;
+
+    ResourcePool<PointCloud> pointClouds;
+    PointCloudStreaming pointCloudStreaming;
 
     //Aux
     u32 model;
-    u32 texturedMeshProgram_uTexture;
 
     // program indices
     u32 texturedGeometryProgramIdx;
     u32 texturedMeshProgramIdx;
+    u32 texturedMeshVirtualProgramIdx; // USE_VIRTUAL_TEXTURE variant
+
+    // With separablePrograms the two above are fragment stages sharing this
+    // vertex stage. Otherwise it is texturedMeshProgramIdx again.
+    // Set before Init(), on by default, --linked-programs turns it off.
+    bool separablePrograms;
+    u32 texturedMeshVertexProgramIdx;
     
     // texture indices
     u32 diceTexIdx;
@@ -182,12 +725,20 @@ struct App
     GLuint embeddedVertices;
     GLuint embeddedElements;
 
-    // Location of the texture uniform in the textured quad shader
-    GLuint programUniformTexture;
     GLint maxUniformBufferSize;
     GLint uniformBlockAlignment;
-    GLint uniformBufferHandle;
-    
+    UniformRing uniformRing;
+
+    std::unordered_map<u64, GLuint> vertexArrays; // Shared VAOs by vertex format, see FindVAO()
+
+    std::vector<Pipeline> pipelines;
+    std::unordered_multimap<u64, u32> pipelineLookup; // Pipeline key to index
+    GlState glState;
+    u32 texturedQuadPipelineIdx;
+    u32 texturedMeshPipelineIdx;
+    u32 texturedMeshVirtualPipelineIdx;
+    PipelineWarmUp pipelineWarmUp;
+
 
     // VAO object to link our screen filling quad with our textured quad shader
     GLuint vao;
@@ -211,10 +762,119 @@ public:
 
 OpenGLInfo GetOpenGlInfo();
 
-GLuint FindVAO(Mesh& mesh, u32 submeshIndex, const Program& program);
+// Returns the VAO with the vertex format of the submesh for the inputs of the
+// program. It holds no buffers: bind those with BindSubmeshBuffers().
+GLuint FindVAO(App* app, const Submesh& submesh, const Program& program);
+
+// Binds the submesh buffers to the bound VAO
+void BindSubmeshBuffers(App* app, const Submesh& submesh);
+
+// Hash of the attributes and stride. Submeshes with the same key can be drawn
+// through the same vertex format.
+u64 GetVertexLayoutKey(const VertexBufferLayout& layout);
+
+// Pipeline the textured model pass draws submeshes of this material with
+u32 GetTexturedMeshPipeline(App* app, const Material& material);
+
+// Draws the submesh with its primitive type, its VAO and buffers must be
+// bound. maxCount limits the indices, or points, drawn.
+void DrawSubmesh(const Submesh& submesh, u32 maxCount = UINT32_MAX);
+
+struct PreprocessedProgram;
+
+// Compiles and links a program from complete stage sources
+GLuint CreateProgramFromSource(const char* vertexSource, const char* fragmentSource, const char* shaderName);
+
+// Compiles a single stage into a separable program, to be combined with
+// others in a program pipeline (see PipelineDesc)
+GLuint CreateSeparableProgramFromSource(GLenum stage, const char* source, const char* shaderName);
+
+// Returns the permutation already loaded, if any
+u32 FindProgram(App* app, const char* filepath, const char* programName, u32 variantMask, GLenum stage = 0);
+
+// Loads the programName block of the file, with the ShaderFeature bits of
+// variantMask defined. Permutations already loaded are shared. A stage
+// (GL_VERTEX_SHADER or GL_FRAGMENT_SHADER) loads only that stage as a
+// separable program.
+u32 LoadProgram(App* app, const char* filepath, const char* programName, u32 variantMask = 0, GLenum stage = 0);
+
+// Compiles a program already run through PreprocessProgram()
+u32 AddProgram(App* app, const PreprocessedProgram& source, const char* programName, u32 variantMask);
+
+// Replaces the GL program behind a handle with a linked one. Sampler units
+// carry over and the program is reflected again.
+void SwapProgramHandle(App* app, u32 programIdx, GLuint handle);
+
+Image LoadImage(const char* filename);
+
+u32 GetPixelSize(const Image& image);
+
+void FreeImage(Image image);
+
+u32 FindTexture2D(App* app, const char* filepath);
+
+// Hashes the image and filters its mip chain, taking ownership of its pixels.
+// Meant for workers, so the main thread only allocates and uploads.
+// flags is a combination of TextureFlags, as later given to AddTexture2D().
+TextureUpload PrepareTextureUpload(Image image, u32 flags = 0);
+
+void FreeTextureUpload(TextureUpload& upload);
+
+// Creates the texture of a prepared image, taking ownership of its levels
+u32 AddTexture2D(App* app, const char* filepath, TextureUpload upload, u32 flags = 0);
+
+TextureFormat GetTextureFormat(const Image& image);
+
+// Bytes per texel once on the GPU, used for residency accounting
+u32 GetGpuTexelSize(GLenum internalFormat);
+
+u64 HashImage(const Image& image);
+
+// Removes a texture from the registry used to share identical ones, call
+// before its contentHash changes or it is removed
+void UnregisterTextureContent(App* app, u32 texIdx);
+
+ivec2 GetMipSize(ivec2 size, u32 level);
+
+// GPU bytes taken by mips [firstMip, mipCount) of the texture
+u64 GetMipRangeBytes(const Texture& texture, u32 firstMip);
+
+GLuint AllocateTexture2D(const TextureFormat& format, ivec2 size, u32 mipCount, u32 firstMip);
+
+void UploadTextureMip(const TextureFormat& format, u32 level, u32 firstMip, const Image& mip);
 
 u32 LoadTexture2D(App* app, const char* filepath);
 
+// Resources are reference counted. Every function returning a handle gives
+// the caller one reference; the Release functions drop it and unload the
+// resource (GL objects and CPU data) when it was the last one.
+// Releasing UINT32_MAX does nothing.
+// Texture loads that find the texture already in memory retain it, which
+// counts as an asset cache hit
+u32 RetainTexture(App* app, u32 texIdx);
+
+// Unreferenced textures and models stay in the asset cache unless it is disabled
+void ReleaseTexture(App* app, u32 texIdx);
+
+// Frees an unreferenced texture right away
+void UnloadTexture(App* app, u32 texIdx);
+
+void ReleaseProgram(App* app, u32 programIdx);
+
+void ReleaseMaterial(App* app, u32 materialIdx);
+
+void ReleaseMesh(App* app, u32 meshIdx);
+
+// Removes the submeshes of a mesh from the registry used to share identical ones
+void UnregisterSharedSubmeshes(App* app, u32 meshIdx);
+
+u32 RetainModel(App* app, u32 modelIdx);
+
+void ReleaseModel(App* app, u32 modelIdx);
+
+// Frees an unreferenced model, releasing its mesh and materials
+void UnloadModel(App* app, u32 modelIdx);
+
 void Init(App* app);
 
 void Gui(App* app);
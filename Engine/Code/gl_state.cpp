@@ -0,0 +1,274 @@
+//
+// gl_state.cpp: Shadowed binds. Texture binds switch the active unit only
+// when the texture of the unit actually changes.
+//
+
+#include "gl_state.h"
+
+static u64 GetPipelineKey(const PipelineDesc& desc)
+{
+    u64 key = desc.programIdx;
+    key |= (u64)desc.blend << 32;
+    key |= (u64)desc.depthTest << 34;
+    key |= (u64)desc.depthWrite << 35;
+    key |= (u64)desc.cull << 36;
+    key |= (u64)desc.wireframe << 38;
+    key |= (u64)desc.programPointSize << 39;
+    return desc.fragmentProgramIdx ? HashBytes(&desc.fragmentProgramIdx, sizeof(desc.fragmentProgramIdx), key) : key;
+}
+
+static bool SamePipelineDesc(const PipelineDesc& a, const PipelineDesc& b)
+{
+    return a.programIdx == b.programIdx && a.fragmentProgramIdx == b.fragmentProgramIdx &&
+           a.blend == b.blend && a.depthTest == b.depthTest && a.depthWrite == b.depthWrite &&
+           a.cull == b.cull && a.wireframe == b.wireframe && a.programPointSize == b.programPointSize;
+}
+
+u32 GetPipeline(App* app, const PipelineDesc& desc)
+{
+    // Keys of separable pipelines are hashes and may collide
+    const u64 key = GetPipelineKey(desc);
+    auto [first, last] = app->pipelineLookup.equal_range(key);
+    for (auto it = first; it != last; ++it)
+    {
+        if (SamePipelineDesc(app->pipelines[it->second].desc, desc))
+            return it->second;
+    }
+
+    Pipeline pipeline = {};
+    pipeline.desc = desc;
+    pipeline.key = key;
+    if (desc.fragmentProgramIdx)
+        glGenProgramPipelines(1, &pipeline.programPipeline);
+
+    const u32 pipelineIdx = (u32)app->pipelines.size();
+    app->pipelines.push_back(pipeline);
+    app->pipelineLookup.emplace(key, pipelineIdx);
+    return pipelineIdx;
+}
+
+const Program& GetPipelineVertexProgram(App* app, u32 pipelineIdx)
+{
+    return app->programs[app->pipelines[pipelineIdx].desc.programIdx];
+}
+
+Program& GetPipelineFragmentProgram(App* app, u32 pipelineIdx)
+{
+    const PipelineDesc& desc = app->pipelines[pipelineIdx].desc;
+    return app->programs[desc.fragmentProgramIdx ? desc.fragmentProgramIdx : desc.programIdx];
+}
+
+// Sets a shadowed value, returns whether GL has to be called
+template <typename T>
+static bool ChangeState(GlState& state, T& shadow, T value)
+{
+    if (shadow == value)
+    {
+        state.frame.filtered++;
+        return false;
+    }
+    shadow = value;
+    state.frame.issued++;
+    return true;
+}
+
+static void SetCapability(GlState& state, u8& shadow, bool enabled, GLenum capability)
+{
+    if (ChangeState(state, shadow, (u8)enabled))
+    {
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+    }
+}
+
+// Attaches the current handles of the stages, which change on hot reload
+static void UpdateProgramStages(App* app, Pipeline& pipeline)
+{
+    const GLuint vertexStage = app->programs[pipeline.desc.programIdx].handle;
+    const GLuint fragmentStage = app->programs[pipeline.desc.fragmentProgramIdx].handle;
+    if (pipeline.vertexStage == vertexStage && pipeline.fragmentStage == fragmentStage)
+        return;
+
+    pipeline.vertexStage = vertexStage;
+    pipeline.fragmentStage = fragmentStage;
+    glUseProgramStages(pipeline.programPipeline, GL_VERTEX_SHADER_BIT, vertexStage);
+    glUseProgramStages(pipeline.programPipeline, GL_FRAGMENT_SHADER_BIT, fragmentStage);
+    app->glState.frame.issued += 2;
+
+    // The stage interfaces are only matched here, not when each stage links
+    GLint valid = GL_FALSE;
+    glValidateProgramPipeline(pipeline.programPipeline);
+    glGetProgramPipelineiv(pipeline.programPipeline, GL_VALIDATE_STATUS, &valid);
+    if (!valid)
+    {
+        GLchar infoLog[1024] = {};
+        glGetProgramPipelineInfoLog(pipeline.programPipeline, sizeof(infoLog), NULL, infoLog);
+        ELOG("Program pipeline %s + %s doesn't validate\nReported message:\n%s\n",
+             app->programs[pipeline.desc.programIdx].programName.c_str(), app->programs[pipeline.desc.fragmentProgramIdx].programName.c_str(), infoLog);
+    }
+}
+
+void BindPipeline(App* app, u32 pipelineIdx)
+{
+    GlState& state = app->glState;
+    Pipeline& pipeline = app->pipelines[pipelineIdx];
+    const PipelineDesc& desc = pipeline.desc;
+
+    if (desc.fragmentProgramIdx)
+    {
+        UpdateProgramStages(app, pipeline);
+
+        // A current program takes precedence over the bound pipeline
+        if (ChangeState(state, state.program, (GLuint)0))
+            glUseProgram(0);
+        if (ChangeState(state, state.programPipeline, pipeline.programPipeline))
+            glBindProgramPipeline(state.programPipeline);
+    }
+    else if (ChangeState(state, state.program, app->programs[desc.programIdx].handle))
+    {
+        glUseProgram(state.program);
+    }
+
+    if (ChangeState(state, state.blend, (u8)desc.blend))
+    {
+        if (desc.blend == BlendMode_Opaque)
+        {
+            glDisable(GL_BLEND);
+        }
+        else
+        {
+            glEnable(GL_BLEND);
+            if (desc.blend == BlendMode_Alpha)
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            else
+                glBlendFunc(GL_ONE, GL_ONE);
+        }
+    }
+
+    SetCapability(state, state.depthTest, desc.depthTest, GL_DEPTH_TEST);
+    if (ChangeState(state, state.depthWrite, (u8)desc.depthWrite))
+        glDepthMask(desc.depthWrite ? GL_TRUE : GL_FALSE);
+
+    if (ChangeState(state, state.cull, (u8)desc.cull))
+    {
+        if (desc.cull == CullMode_None)
+        {
+            glDisable(GL_CULL_FACE);
+        }
+        else
+        {
+            glEnable(GL_CULL_FACE);
+            glCullFace(desc.cull == CullMode_Back ? GL_BACK : GL_FRONT);
+        }
+    }
+
+    if (ChangeState(state, state.wireframe, (u8)desc.wireframe))
+        glPolygonMode(GL_FRONT_AND_BACK, desc.wireframe ? GL_LINE : GL_FILL);
+
+    SetCapability(state, state.programPointSize, desc.programPointSize, GL_PROGRAM_POINT_SIZE);
+}
+
+void BindVertexArray(App* app, GLuint vertexArray)
+{
+    GlState& state = app->glState;
+    if (ChangeState(state, state.vertexArray, vertexArray))
+    {
+        glBindVertexArray(vertexArray);
+
+        // Buffer bindings are part of the VAO
+        state.elementBuffer = UINT32_MAX;
+        state.vertexBuffer.buffer = UINT32_MAX;
+    }
+}
+
+void BindVertexBuffer(App* app, GLuint buffer, u64 offset, u32 stride)
+{
+    GlState& state = app->glState;
+    auto& binding = state.vertexBuffer;
+    if (binding.buffer == buffer && binding.offset == offset && binding.stride == stride)
+    {
+        state.frame.filtered++;
+        return;
+    }
+    binding.buffer = buffer;
+    binding.offset = offset;
+    binding.stride = stride;
+    state.frame.issued++;
+    glBindVertexBuffer(0, buffer, (GLintptr)offset, stride);
+}
+
+void BindElementBuffer(App* app, GLuint buffer)
+{
+    GlState& state = app->glState;
+    if (ChangeState(state, state.elementBuffer, buffer))
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+}
+
+void BindTexture(App* app, u32 unit, GLuint texture)
+{
+    GlState& state = app->glState;
+    ASSERT(unit < GL_STATE_TEXTURE_UNITS, "Texture unit not shadowed, raise GL_STATE_TEXTURE_UNITS");
+
+    if (!ChangeState(state, state.textures[unit], texture))
+        return;
+
+    if (state.activeTextureUnit != unit)
+    {
+        state.activeTextureUnit = unit;
+        state.frame.issued++;
+        glActiveTexture(GL_TEXTURE0 + unit);
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+void BindUniformBuffer(App* app, GLuint binding, GLuint buffer, u32 offset, u32 size)
+{
+    GlState& state = app->glState;
+    ASSERT(binding < GL_STATE_UNIFORM_BINDINGS, "Uniform binding not shadowed, raise GL_STATE_UNIFORM_BINDINGS");
+
+    auto& range = state.uniformBuffers[binding];
+    if (range.buffer == buffer && range.offset == offset && range.size == size)
+    {
+        state.frame.filtered++;
+        return;
+    }
+    range.buffer = buffer;
+    range.offset = offset;
+    range.size = size;
+    state.frame.issued++;
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, offset, size);
+}
+
+void InvalidateGlState(App* app)
+{
+    GlState& state = app->glState;
+    state.program = UINT32_MAX;
+    state.programPipeline = UINT32_MAX;
+    state.vertexArray = UINT32_MAX;
+    state.elementBuffer = UINT32_MAX;
+    state.vertexBuffer.buffer = UINT32_MAX;
+    state.activeTextureUnit = UINT32_MAX;
+    for (GLuint& texture : state.textures)
+        texture = UINT32_MAX;
+    for (auto& range : state.uniformBuffers)
+        range.buffer = UINT32_MAX;
+    state.blend = GL_STATE_UNKNOWN;
+    state.depthTest = GL_STATE_UNKNOWN;
+    state.depthWrite = GL_STATE_UNKNOWN;
+    state.cull = GL_STATE_UNKNOWN;
+    state.wireframe = GL_STATE_UNKNOWN;
+    state.programPointSize = GL_STATE_UNKNOWN;
+}
+
+void BeginGlStateFrame(App* app)
+{
+    InvalidateGlState(app);
+    app->glState.frame = {};
+}
+
+void EndGlStateFrame(App* app)
+{
+    app->glState.lastFrame = app->glState.frame;
+}
@@ -0,0 +1,43 @@
+//
+// gl_state.h: Pipeline state objects and the shadowed GL state they are bound
+// through. Each bind compares with what the context already has and only
+// calls GL for the differences, which matters when the draw loop is bound by
+// driver call overhead. Counts of issued and filtered calls are kept per frame.
+//
+
+#pragma once
+
+#include "engine.h"
+
+// Returns the pipeline with this state, creating it the first time
+u32 GetPipeline(App* app, const PipelineDesc& desc);
+
+// Program the VAOs of the pipeline are built for: its vertex stage
+const Program& GetPipelineVertexProgram(App* app, u32 pipelineIdx);
+
+// Program holding the fragment stage samplers and uniforms
+Program& GetPipelineFragmentProgram(App* app, u32 pipelineIdx);
+
+// Binds the program, or program pipeline, and sets the fixed function state
+// of the pipeline
+void BindPipeline(App* app, u32 pipelineIdx);
+
+void BindVertexArray(App* app, GLuint vertexArray);
+
+// Vertex buffer binding 0 and element buffer of the bound VAO
+void BindVertexBuffer(App* app, GLuint buffer, u64 offset, u32 stride);
+
+void BindElementBuffer(App* app, GLuint buffer);
+
+void BindTexture(App* app, u32 unit, GLuint texture);
+
+void BindUniformBuffer(App* app, GLuint binding, GLuint buffer, u32 offset, u32 size);
+
+// Forgets the shadowed state, the next bind of everything goes to GL. Call
+// after code that changes GL state without going through here.
+void InvalidateGlState(App* app);
+
+// Invalidates the state and starts counting the frame calls
+void BeginGlStateFrame(App* app);
+
+void EndGlStateFrame(App* app);
@@ -0,0 +1,456 @@
+//
+// hot_reload.cpp: Texture, model and program hot reload. Textures keep their
+// storage when the size and format don't change, meshes keep their chunk buffers
+// when the layout of every submesh is the same. Otherwise new GPU objects are
+// created behind the same handle. Programs are only relinked when their
+// preprocessed source changed, on the shared GL context, and swapped in once
+// linked.
+//
+
+#include "hot_reload.h"
+#include "async_assets.h"
+#include "texture_processing.h"
+#include "texture_streaming.h"
+#include "mesh_storage.h"
+#include "point_cloud.h"
+#include "program_cache.h"
+#include "shader_preprocessor.h"
+#include "pipeline_warmup.h"
+#include "../assimp_model_loading.h"
+
+enum WatchedAsset
+{
+    WatchedAsset_Texture,
+    WatchedAsset_Model,
+    WatchedAsset_Program,
+};
+
+struct WatchedFile
+{
+    u32          handle;
+    WatchedAsset asset;
+    std::vector<std::string> filepaths; // Programs depend on their includes too
+    u64          lastWriteTimestamp;
+    u64          currentTimestamp;
+};
+
+static AssetTask ReloadTextureAsync(App* app, u32 texIdx, u64 timestamp)
+{
+    Texture& tex = app->textures[texIdx];
+    tex.reloadPending = true;
+    const std::string filepath = tex.filepath;
+    const bool srgb = !(tex.flags & TextureFlag_LinearData);
+
+    co_await ResumeOnWorker{ JobPriority_Low };
+
+    Image image = LoadImage(filepath.c_str());
+    std::vector<Image> mips;
+    if (image.pixels)
+        mips = GenerateMipChain(image, srgb);
+
+    co_await ResumeOnMainThread{ JobPriority_Low };
+
+    // The texture may have been unloaded meanwhile
+    Texture* texture = app->textures.Get(texIdx);
+    if (texture)
+    {
+        texture->reloadPending = false;
+
+        // A stream-in in flight expects the old mip sizes, so wait for it and
+        // try again on the next poll
+        if (!texture->streamPending)
+            texture->lastWriteTimestamp = timestamp;
+    }
+
+    if (!texture || !image.pixels || texture->streamPending)
+    {
+        for (Image& mip : mips)
+            FreeImage(mip);
+        if (image.pixels)
+            FreeImage(image);
+        co_return UINT32_MAX;
+    }
+
+    const TextureFormat format = GetTextureFormat(image);
+    const u32 mipCount = 1 + (u32)mips.size();
+
+    if (image.size == texture->size && format.internalFormat == texture->format.internalFormat)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture->handle);
+        app->hotReload.texturesPatched++;
+    }
+    else
+    {
+        app->streaming.residentBytes -= GetMipRangeBytes(*texture, texture->residentMip);
+        glDeleteTextures(1, &texture->handle);
+
+        texture->size = image.size;
+        texture->mipCount = mipCount;
+        texture->format = format;
+        texture->texelSize = GetGpuTexelSize(format.internalFormat);
+        texture->residentMip = app->streaming.enabled ? GetInitialStreamingMip(app->streaming, image.size) : 0;
+        texture->wantedMip = texture->residentMip;
+        texture->handle = AllocateTexture2D(format, image.size, mipCount, texture->residentMip);
+        app->streaming.residentBytes += GetMipRangeBytes(*texture, texture->residentMip);
+        app->hotReload.texturesReallocated++;
+    }
+
+    for (u32 level = texture->residentMip; level < mipCount; ++level)
+        UploadTextureMip(format, level, texture->residentMip, level == 0 ? image : mips[level - 1]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    UnregisterTextureContent(app, texIdx);
+    texture->contentHash = HashImage(image);
+    texture->byteSize = (u64)image.stride * image.size.y;
+    app->texturesByContent.emplace(texture->contentHash, texIdx);
+
+    for (Image& mip : mips)
+        FreeImage(mip);
+    FreeImage(image);
+
+    co_return texIdx;
+}
+
+// Buffers can be patched if nobody else reads them and every submesh keeps its
+// size. Sizes come from the assimp meshes, before any of them is converted.
+static bool CanPatchMeshInPlace(const App* app, u32 meshIdx, const std::vector<const aiMesh*>& assimpMeshes)
+{
+    const Mesh& mesh = app->meshes[meshIdx];
+    if (app->meshes.GetRefCount(meshIdx) != 1 || mesh.submeshes.size() != assimpMeshes.size())
+        return false;
+
+    u64 bytes = 0;
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        const Submesh& current = mesh.submeshes[i];
+        const aiMesh* next = assimpMeshes[i];
+        const u64 stride = GetAssimpVertexStride(next);
+        const u64 indexCount = GetAssimpIndexCount(next);
+        if (!IsMeshChunkBuffer(mesh, current.vertexBufferHandle) ||
+            current.primitiveType != GetAssimpPrimitiveType(next) ||
+            current.vertexBufferLayout.stride != stride ||
+            current.vertexCount != next->mNumVertices ||
+            current.indexCount != indexCount)
+            return false;
+        bytes += next->mNumVertices * stride + indexCount * sizeof(u32);
+    }
+
+    // Less bytes than chunk space in use means some submeshes share a region
+    u64 usedBytes = 0;
+    for (const MeshChunk& chunk : mesh.chunks)
+        usedBytes += chunk.vertexBytesUsed + chunk.indexBytesUsed;
+    return bytes == usedBytes;
+}
+
+// Offsets, buffers and VAOs stay the same. The submesh is registered for
+// sharing again as soon as it holds its final data.
+static void PatchSubmesh(App* app, u32 meshIdx, u32 submeshIdx, const SubmeshData& next)
+{
+    Submesh& submesh = app->meshes[meshIdx].submeshes[submeshIdx];
+
+    glBindBuffer(GL_ARRAY_BUFFER, submesh.vertexBufferHandle);
+    glBufferSubData(GL_ARRAY_BUFFER, submesh.vertexOffset, next.vertices.size() * sizeof(float), next.vertices.data());
+    glBindBuffer(GL_ARRAY_BUFFER, submesh.indexBufferHandle);
+    glBufferSubData(GL_ARRAY_BUFFER, submesh.indexOffset, next.indices.size() * sizeof(u32), next.indices.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    submesh.vertexBufferLayout = next.vertexBufferLayout;
+    submesh.contentHash = HashSubmeshData(next);
+    submesh.surfaceArea = next.surfaceArea;
+    submesh.uvDensity = next.uvDensity;
+    app->sharedSubmeshes.emplace(submesh.contentHash, SharedSubmesh{ meshIdx, submeshIdx });
+}
+
+// Like a full load, one submesh at a time is converted on a worker and
+// uploaded on the main thread, so only the assimp scene and a single
+// submesh are in memory at once. Patched meshes show a mix of old and new
+// submeshes until the last one is in, rebuilt ones are swapped in at the end.
+static AssetTask ReloadModelAsync(App* app, u32 modelIdx, u64 timestamp)
+{
+    Model& model = app->models[modelIdx];
+    model.reloadPending = true;
+    const std::string filepath = model.filepath;
+    const u32 minCloudPoints = app->pointCloudStreaming.minPoints;
+
+    co_await ResumeOnWorker{ JobPriority_Low };
+
+    // Materials are not touched by the import, submeshes keep the index of
+    // their scene material. Point clouds keep their octree until a full load.
+    std::vector<const aiMesh*> assimpMeshes;
+    const aiScene* scene = ImportAssimpScene(filepath.c_str());
+    if (scene)
+        assimpMeshes = CollectSubmeshAssimpMeshes(scene, minCloudPoints);
+
+    co_await ResumeOnMainThread{ JobPriority_Low };
+
+    Model* target = app->models.Get(modelIdx);
+    if (target)
+        target->lastWriteTimestamp = timestamp;
+
+    // Material edits need a full load, the existing materials are reused
+    if (!target || !scene || target->ownedMaterialIdx.empty())
+    {
+        if (target)
+            target->reloadPending = false;
+        if (scene)
+            aiReleaseImport(scene);
+        co_return UINT32_MAX;
+    }
+
+    std::vector<u32> materialIdx;
+    for (const aiMesh* assimpMesh : assimpMeshes)
+        materialIdx.push_back(target->ownedMaterialIdx[glm::min(assimpMesh->mMaterialIndex, (u32)target->ownedMaterialIdx.size() - 1)]);
+
+    // Stays pending until the last submesh is in, so no other reload starts meanwhile
+    const bool patch = CanPatchMeshInPlace(app, target->meshIdx, assimpMeshes);
+    const u32 meshIdx = patch ? target->meshIdx : app->meshes.Add(Mesh{});
+    if (patch)
+        UnregisterSharedSubmeshes(app, meshIdx);
+
+    u64 remainingVertexBytes, remainingIndexBytes;
+    GetAssimpGeometryBytes(assimpMeshes, &remainingVertexBytes, &remainingIndexBytes);
+
+    for (u32 i = 0; i < assimpMeshes.size() && target; ++i)
+    {
+        co_await ResumeOnWorker{ JobPriority_Low };
+        SubmeshData data = ProcessAssimpMesh(assimpMeshes[i]);
+        co_await ResumeOnMainThread{ JobPriority_Low };
+
+        // The model may have been unloaded meanwhile, along with a patched mesh
+        target = app->models.Get(modelIdx);
+        if (!target)
+            break;
+
+        if (patch)
+            PatchSubmesh(app, meshIdx, i, data);
+        else
+            AddSubmesh(app, meshIdx, data, remainingVertexBytes, remainingIndexBytes);
+        remainingVertexBytes -= data.vertices.size() * sizeof(float);
+        remainingIndexBytes -= data.indices.size() * sizeof(u32);
+    }
+
+    co_await ResumeOnWorker{ JobPriority_Low };
+    aiReleaseImport(scene);
+    co_await ResumeOnMainThread{ JobPriority_Low };
+
+    target = app->models.Get(modelIdx);
+    if (!target)
+    {
+        if (!patch)
+            ReleaseMesh(app, meshIdx);
+        co_return UINT32_MAX;
+    }
+    target->reloadPending = false;
+
+    if (patch)
+    {
+        app->hotReload.meshesPatched++;
+    }
+    else
+    {
+        // Meshes still borrowing the old buffers keep the old mesh alive
+        const u32 oldMeshIdx = target->meshIdx;
+        target->meshIdx = meshIdx;
+        ReleaseMesh(app, oldMeshIdx);
+        app->hotReload.meshesRebuilt++;
+    }
+    target->materialIdx.swap(materialIdx);
+    WarmUpModelPipelines(app, modelIdx);
+
+    co_return modelIdx;
+}
+
+// Compiles and links on the shared context, or on the main thread if the
+// platform has none. Returns 0 if the program doesn't link.
+static AssetTask ReloadProgramAsync(App* app, u32 programIdx, u64 timestamp)
+{
+    Program& program = app->programs[programIdx];
+    program.reloadPending = true;
+    const std::string filepath = program.filepath;
+    const std::string programName = program.programName;
+    const u32 variantMask = program.variantMask;
+    const GLenum stage = program.stage;
+    const u64 sourceHash = program.sourceHash;
+    const ProgramCache cache = app->programCache;
+
+    co_await ResumeOnWorker{ JobPriority_Low };
+
+    PreprocessedProgram source;
+    const bool preprocessed = PreprocessProgram(filepath.c_str(), programName.c_str(), variantMask, source, stage);
+    const bool changed = preprocessed && HashPreprocessedProgram(source) != sourceHash;
+
+    GLuint handle = 0;
+    GLsync linked = 0;
+    bool compiledHere = false;
+    ProgramCacheCounters counters = {};
+    if (changed && AcquireSharedGlContext())
+    {
+        handle = CreateCachedProgram(cache, source, programName.c_str(), counters);
+        GLint success = GL_FALSE;
+        glGetProgramiv(handle, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glDeleteProgram(handle);
+            handle = 0;
+        }
+        else
+        {
+            // The main context can't use the program before the link is done
+            linked = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+        }
+        ReleaseSharedGlContext();
+        compiledHere = true;
+    }
+
+    co_await ResumeOnMainThread{ JobPriority_Low };
+
+    if (changed && !compiledHere)
+    {
+        handle = CreateCachedProgram(cache, source, programName.c_str(), counters);
+        GLint success = GL_FALSE;
+        glGetProgramiv(handle, GL_LINK_STATUS, &success);
+        if (!success)
+        {
+            glDeleteProgram(handle);
+            handle = 0;
+        }
+    }
+    AddProgramCacheCounters(app, counters);
+
+    if (linked)
+    {
+        while (glClientWaitSync(linked, 0, 0) == GL_TIMEOUT_EXPIRED)
+            co_await ResumeOnMainThread{ JobPriority_Low };
+        glDeleteSync(linked);
+    }
+
+    // The program may have been released meanwhile
+    Program* target = app->programs.Get(programIdx);
+    if (!target)
+    {
+        if (handle)
+            glDeleteProgram(handle);
+        co_return UINT32_MAX;
+    }
+    target->reloadPending = false;
+    target->lastWriteTimestamp = timestamp;
+
+    if (!preprocessed)
+    {
+        app->hotReload.programsFailed++;
+        co_return UINT32_MAX;
+    }
+
+    // A new include is watched from now on, even if the output is the same
+    target->sourceFiles = source.files;
+
+    if (!changed)
+    {
+        app->hotReload.programsUnchanged++;
+        co_return programIdx;
+    }
+
+    if (!handle)
+    {
+        ELOG("Program %s failed to build, keeping the previous version", programName.c_str());
+        app->hotReload.programsFailed++;
+        co_return UINT32_MAX;
+    }
+
+    SwapProgramHandle(app, programIdx, handle);
+    WarmUpModelPipelines(app, app->model);
+    target->sourceHash = HashPreprocessedProgram(source);
+    app->hotReload.programsRelinked++;
+
+    co_return programIdx;
+}
+
+static AssetTask PollWatchedFilesAsync(App* app)
+{
+    std::vector<WatchedFile> files;
+    for (u32 slot = 0; slot < app->textures.SlotCount(); ++slot)
+    {
+        if (!app->textures.IsSlotAlive(slot))
+            continue;
+        u32 texIdx = app->textures.HandleAt(slot);
+        const Texture& tex = app->textures[texIdx];
+        if (!(tex.flags & TextureFlag_Generated) && !tex.reloadPending)
+            files.push_back(WatchedFile{ texIdx, WatchedAsset_Texture, { tex.filepath }, tex.lastWriteTimestamp, 0 });
+    }
+    for (u32 slot = 0; slot < app->models.SlotCount(); ++slot)
+    {
+        if (!app->models.IsSlotAlive(slot))
+            continue;
+        u32 modelIdx = app->models.HandleAt(slot);
+        const Model& model = app->models[modelIdx];
+        if (!model.reloadPending)
+            files.push_back(WatchedFile{ modelIdx, WatchedAsset_Model, { model.filepath }, model.lastWriteTimestamp, 0 });
+    }
+    for (u32 slot = 0; slot < app->programs.SlotCount(); ++slot)
+    {
+        if (!app->programs.IsSlotAlive(slot))
+            continue;
+        u32 programIdx = app->programs.HandleAt(slot);
+        const Program& program = app->programs[programIdx];
+        if (!program.reloadPending)
+            files.push_back(WatchedFile{ programIdx, WatchedAsset_Program, program.sourceFiles, program.lastWriteTimestamp, 0 });
+    }
+
+    app->hotReload.pollPending = true;
+    co_await ResumeOnWorker{ JobPriority_Low };
+
+    for (WatchedFile& file : files)
+        file.currentTimestamp = GetProgramSourceTimestamp(file.filepaths);
+
+    co_await ResumeOnMainThread{ JobPriority_Low };
+    app->hotReload.pollPending = false;
+
+    u32 changed = 0;
+    for (const WatchedFile& file : files)
+    {
+        if (file.currentTimestamp <= file.lastWriteTimestamp)
+            continue;
+
+        if (file.asset == WatchedAsset_Model)
+        {
+            if (app->models.IsValid(file.handle) && !app->models[file.handle].reloadPending)
+            {
+                ILOG("Reloading model %s", file.filepaths[0].c_str());
+                ReloadModelAsync(app, file.handle, file.currentTimestamp);
+                changed++;
+            }
+        }
+        else if (file.asset == WatchedAsset_Texture)
+        {
+            if (app->textures.IsValid(file.handle) && !app->textures[file.handle].reloadPending)
+            {
+                ILOG("Reloading texture %s", file.filepaths[0].c_str());
+                ReloadTextureAsync(app, file.handle, file.currentTimestamp);
+                changed++;
+            }
+        }
+        else
+        {
+            if (app->programs.IsValid(file.handle) && !app->programs[file.handle].reloadPending)
+            {
+                ILOG("Reloading program %s", app->programs[file.handle].programName.c_str());
+                ReloadProgramAsync(app, file.handle, file.currentTimestamp);
+                changed++;
+            }
+        }
+    }
+
+    co_return changed;
+}
+
+void UpdateHotReload(App* app)
+{
+    HotReload& hotReload = app->hotReload;
+    hotReload.timeSincePoll += app->deltaTime;
+    if (hotReload.pollPending || hotReload.timeSincePoll < hotReload.pollInterval)
+        return;
+
+    hotReload.timeSincePoll = 0.0f;
+    PollWatchedFilesAsync(app);
+}
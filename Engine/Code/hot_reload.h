@@ -0,0 +1,14 @@
+//
+// hot_reload.h: Watches the files of the loaded textures, models and programs
+// and updates them in place when they change on disk. Checking timestamps,
+// decoding, importing and shader compiles run on the job system; only the GPU
+// updates happen on the main thread. Handles stay valid across reloads.
+//
+
+#pragma once
+
+#include "engine.h"
+
+// Starts a check of the watched files every pollInterval seconds. Call once
+// per frame from the main thread.
+void UpdateHotReload(App* app);
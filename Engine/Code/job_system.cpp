@@ -0,0 +1,174 @@
+//
+// job_system.cpp: Worker threads pulling jobs from a shared queue.
+//
+
+#include "job_system.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+
+struct JobEntry
+{
+    JobFunction job;
+    JobCounter* counter;
+};
+
+struct JobSystem
+{
+    std::vector<std::thread> workers;
+    std::deque<JobEntry>     queues[JobPriority_Count];
+    std::mutex               mutex;
+    std::condition_variable  wakeUp;
+    bool                     quit;
+};
+
+static JobSystem GlobalJobSystem;
+
+// Must be called with the mutex locked
+static bool PopJobLocked(JobEntry& entry)
+{
+    for (std::deque<JobEntry>& queue : GlobalJobSystem.queues)
+    {
+        if (!queue.empty())
+        {
+            entry = std::move(queue.front());
+            queue.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+// Pops the highest priority job tracked by the counter, leaving the others
+static bool PopCounterJob(JobEntry& entry, const JobCounter* counter)
+{
+    std::lock_guard<std::mutex> lock(GlobalJobSystem.mutex);
+    for (std::deque<JobEntry>& queue : GlobalJobSystem.queues)
+    {
+        for (auto it = queue.begin(); it != queue.end(); ++it)
+        {
+            if (it->counter == counter)
+            {
+                entry = std::move(*it);
+                queue.erase(it);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static bool HasJobsLocked()
+{
+    for (const std::deque<JobEntry>& queue : GlobalJobSystem.queues)
+        if (!queue.empty())
+            return true;
+    return false;
+}
+
+static void ExecuteJob(JobEntry& entry)
+{
+    entry.job();
+    if (entry.counter)
+        entry.counter->pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+static void WorkerLoop()
+{
+    for (;;)
+    {
+        JobEntry entry;
+        {
+            std::unique_lock<std::mutex> lock(GlobalJobSystem.mutex);
+            GlobalJobSystem.wakeUp.wait(lock, [] { return GlobalJobSystem.quit || HasJobsLocked(); });
+            if (!PopJobLocked(entry))
+                return; // quitting with nothing left to do
+        }
+        ExecuteJob(entry);
+    }
+}
+
+void InitJobSystem(u32 workerCount)
+{
+    if (workerCount == 0)
+    {
+        u32 hardwareThreads = std::thread::hardware_concurrency();
+        workerCount = hardwareThreads > 1 ? hardwareThreads - 1 : 1;
+    }
+
+    GlobalJobSystem.quit = false;
+    for (u32 i = 0; i < workerCount; ++i)
+        GlobalJobSystem.workers.emplace_back(WorkerLoop);
+}
+
+void ShutdownJobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(GlobalJobSystem.mutex);
+        GlobalJobSystem.quit = true;
+    }
+    GlobalJobSystem.wakeUp.notify_all();
+
+    for (std::thread& worker : GlobalJobSystem.workers)
+        worker.join();
+    GlobalJobSystem.workers.clear();
+}
+
+u32 GetJobWorkerCount()
+{
+    return (u32)GlobalJobSystem.workers.size();
+}
+
+void RunJob(JobFunction job, JobCounter* counter, JobPriority priority)
+{
+    if (counter)
+        counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+    // Without workers (not initialized) jobs simply run inline
+    if (GlobalJobSystem.workers.empty())
+    {
+        JobEntry entry = { std::move(job), counter };
+        ExecuteJob(entry);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(GlobalJobSystem.mutex);
+        GlobalJobSystem.queues[priority].push_back(JobEntry{ std::move(job), counter });
+    }
+    GlobalJobSystem.wakeUp.notify_one();
+}
+
+void WaitForCounter(JobCounter* counter)
+{
+    while (counter->pending.load(std::memory_order_acquire) > 0)
+    {
+        // Only jobs of this batch: any other could expect a worker thread, and
+        // the caller may be the main thread, holding the GL context
+        JobEntry entry;
+        if (PopCounterJob(entry, counter))
+            ExecuteJob(entry);
+        else
+            std::this_thread::yield();
+    }
+}
+
+void ParallelFor(u32 count, u32 batchSize, const std::function<void(u32 begin, u32 end)>& body)
+{
+    if (count == 0)
+        return;
+    if (batchSize == 0)
+        batchSize = 1;
+
+    JobCounter counter;
+    counter.pending = 0;
+
+    for (u32 begin = 0; begin < count; begin += batchSize)
+    {
+        u32 end = begin + batchSize < count ? begin + batchSize : count;
+        RunJob([&body, begin, end]() { body(begin, end); }, &counter);
+    }
+
+    WaitForCounter(&counter);
+}
@@ -0,0 +1,44 @@
+//
+// job_system.h: A small pool of worker threads to run CPU work (image cooking,
+// decoding...) off the main thread. OpenGL calls must stay on the main thread.
+//
+
+#pragma once
+
+#include "platform.h"
+#include <atomic>
+#include <functional>
+
+// Counts the jobs of a batch that haven't finished yet
+struct JobCounter
+{
+    std::atomic<u32> pending;
+};
+
+typedef std::function<void()> JobFunction;
+
+enum JobPriority
+{
+    JobPriority_High,
+    JobPriority_Normal,
+    JobPriority_Low,
+    JobPriority_Count
+};
+
+void InitJobSystem(u32 workerCount = 0); // 0 means one worker per hardware thread but one
+
+void ShutdownJobSystem();
+
+u32 GetJobWorkerCount();
+
+// Queues a job. If counter is given, it is incremented now and decremented
+// once the job has finished. Workers always take the highest priority job first.
+void RunJob(JobFunction job, JobCounter* counter = nullptr, JobPriority priority = JobPriority_Normal);
+
+// Blocks until every job tracked by the counter has finished. The calling
+// thread helps running the queued jobs of that counter meanwhile.
+void WaitForCounter(JobCounter* counter);
+
+// Splits [0, count) in batches of batchSize and runs body(begin, end) for each
+// of them on the workers, returning once all of them are done
+void ParallelFor(u32 count, u32 batchSize, const std::function<void(u32 begin, u32 end)>& body);
@@ -0,0 +1,182 @@
+//
+// mesh_storage.cpp: Chunk allocation, upload and content sharing of submeshes.
+//
+
+#include "mesh_storage.h"
+#include <algorithm>
+
+// Chunks are sized for the rest of the mesh up to this. A bigger submesh gets
+// a chunk of its own.
+#define MESH_CHUNK_MAX_BYTES MB(256)
+
+u64 HashSubmeshData(const SubmeshData& data)
+{
+    const u64 seed = ((u64)data.primitiveType << 8) | data.vertexBufferLayout.stride;
+    u64 hash = HashBytes(data.vertices.data(), data.vertices.size() * sizeof(float), seed);
+    return HashBytes(data.indices.data(), data.indices.size() * sizeof(u32), hash);
+}
+
+static bool SameVertexLayout(const VertexBufferLayout& a, const VertexBufferLayout& b)
+{
+    if (a.stride != b.stride || a.attributes.size() != b.attributes.size())
+        return false;
+    for (u32 i = 0; i < a.attributes.size(); ++i)
+    {
+        if (a.attributes[i].location != b.attributes[i].location ||
+            a.attributes[i].componentCount != b.attributes[i].componentCount ||
+            a.attributes[i].offset != b.attributes[i].offset)
+            return false;
+    }
+    return true;
+}
+
+// Hashes can collide, so a match is confirmed against the data already on
+// the GPU. Reading back stalls, but only happens on hash matches.
+static bool SubmeshDataMatches(const Submesh& submesh, const SubmeshData& data)
+{
+    const u64 vertexBytes = data.vertices.size() * sizeof(float);
+    const u64 indexBytes = data.indices.size() * sizeof(u32);
+    if (submesh.primitiveType != data.primitiveType ||
+        !SameVertexLayout(submesh.vertexBufferLayout, data.vertexBufferLayout) ||
+        submesh.vertexCount * submesh.vertexBufferLayout.stride != vertexBytes ||
+        submesh.indexCount * sizeof(u32) != indexBytes)
+        return false;
+
+    std::vector<u8> gpuData(glm::max(vertexBytes, indexBytes));
+
+    glBindBuffer(GL_COPY_READ_BUFFER, submesh.vertexBufferHandle);
+    glGetBufferSubData(GL_COPY_READ_BUFFER, submesh.vertexOffset, vertexBytes, gpuData.data());
+    bool matches = memcmp(gpuData.data(), data.vertices.data(), vertexBytes) == 0;
+
+    if (matches)
+    {
+        glBindBuffer(GL_COPY_READ_BUFFER, submesh.indexBufferHandle);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, submesh.indexOffset, indexBytes, gpuData.data());
+        matches = memcmp(gpuData.data(), data.indices.data(), indexBytes) == 0;
+    }
+
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    return matches;
+}
+
+static const SharedSubmesh* FindSharedSubmesh(App* app, const SubmeshData& data, u64 contentHash)
+{
+    auto range = app->sharedSubmeshes.equal_range(contentHash);
+    for (auto it = range.first; it != range.second; ++it)
+    {
+        const SharedSubmesh& shared = it->second;
+        const Submesh& other = app->meshes[shared.meshIdx].submeshes[shared.submeshIdx];
+        if (SubmeshDataMatches(other, data))
+            return &shared;
+    }
+    return nullptr;
+}
+
+// Returns the chunk with room for the given bytes, creating it if needed
+static MeshChunk& AllocateMeshChunk(Mesh& mesh, u64 vertexBytes, u64 indexBytes, u64 remainingVertexBytes, u64 remainingIndexBytes)
+{
+    if (!mesh.chunks.empty())
+    {
+        MeshChunk& last = mesh.chunks.back();
+        if (last.vertexBytesUsed + vertexBytes <= last.vertexCapacity &&
+            last.indexBytesUsed + indexBytes <= last.indexCapacity)
+            return last;
+    }
+
+    MeshChunk chunk = {};
+    chunk.vertexCapacity = glm::max(vertexBytes, glm::min(remainingVertexBytes, (u64)MESH_CHUNK_MAX_BYTES));
+    chunk.indexCapacity = glm::max(indexBytes, glm::min(remainingIndexBytes, (u64)MESH_CHUNK_MAX_BYTES));
+
+    glGenBuffers(1, &chunk.vertexBufferHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, chunk.vertexBufferHandle);
+    glBufferData(GL_ARRAY_BUFFER, chunk.vertexCapacity, NULL, GL_STATIC_DRAW);
+
+    glGenBuffers(1, &chunk.indexBufferHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, chunk.indexBufferHandle);
+    glBufferData(GL_ARRAY_BUFFER, chunk.indexCapacity, NULL, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    mesh.gpuBytes += chunk.vertexCapacity + chunk.indexCapacity;
+    mesh.chunks.push_back(chunk);
+    return mesh.chunks.back();
+}
+
+void AddSubmesh(App* app, u32 meshIdx, const SubmeshData& data, u64 remainingVertexBytes, u64 remainingIndexBytes)
+{
+    Submesh submesh = {};
+    submesh.primitiveType = data.primitiveType;
+    submesh.vertexBufferLayout = data.vertexBufferLayout;
+    submesh.vertexCount = data.vertexBufferLayout.stride ? data.vertices.size() * sizeof(float) / data.vertexBufferLayout.stride : 0;
+    submesh.indexCount = data.indices.size();
+    submesh.surfaceArea = data.surfaceArea;
+    submesh.uvDensity = data.uvDensity;
+    submesh.contentHash = HashSubmeshData(data);
+
+    const u64 vertexBytes = data.vertices.size() * sizeof(float);
+    const u64 indexBytes = data.indices.size() * sizeof(u32);
+
+    const SharedSubmesh* shared = FindSharedSubmesh(app, data, submesh.contentHash);
+    if (shared)
+    {
+        const u32 sourceMeshIdx = shared->meshIdx;
+        const Submesh& source = app->meshes[sourceMeshIdx].submeshes[shared->submeshIdx];
+        submesh.vertexBufferHandle = source.vertexBufferHandle;
+        submesh.indexBufferHandle = source.indexBufferHandle;
+        submesh.vertexOffset = source.vertexOffset;
+        submesh.indexOffset = source.indexOffset;
+
+        app->dedupStats.submeshesShared++;
+        app->dedupStats.geometryBytesSaved += vertexBytes + indexBytes;
+
+        // Keep the mesh owning those buffers alive as long as we are
+        Mesh& mesh = app->meshes[meshIdx];
+        if (sourceMeshIdx != meshIdx &&
+            std::find(mesh.sharedMeshIdx.begin(), mesh.sharedMeshIdx.end(), sourceMeshIdx) == mesh.sharedMeshIdx.end())
+        {
+            app->meshes.AddRef(sourceMeshIdx);
+            mesh.sharedMeshIdx.push_back(sourceMeshIdx);
+        }
+        mesh.submeshes.push_back(submesh);
+        mesh.cpuBytes += sizeof(Submesh);
+        return;
+    }
+
+    Mesh& mesh = app->meshes[meshIdx];
+    MeshChunk& chunk = AllocateMeshChunk(mesh, vertexBytes, indexBytes, remainingVertexBytes, remainingIndexBytes);
+
+    submesh.vertexBufferHandle = chunk.vertexBufferHandle;
+    submesh.indexBufferHandle = chunk.indexBufferHandle;
+    submesh.vertexOffset = chunk.vertexBytesUsed;
+    submesh.indexOffset = chunk.indexBytesUsed;
+    chunk.vertexBytesUsed += vertexBytes;
+    chunk.indexBytesUsed += indexBytes;
+
+    glBindBuffer(GL_ARRAY_BUFFER, submesh.vertexBufferHandle);
+    glBufferSubData(GL_ARRAY_BUFFER, submesh.vertexOffset, vertexBytes, data.vertices.data());
+    glBindBuffer(GL_ARRAY_BUFFER, submesh.indexBufferHandle);
+    glBufferSubData(GL_ARRAY_BUFFER, submesh.indexOffset, indexBytes, data.indices.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    app->sharedSubmeshes.emplace(submesh.contentHash, SharedSubmesh{ meshIdx, (u32)mesh.submeshes.size() });
+    mesh.submeshes.push_back(submesh);
+    mesh.cpuBytes += sizeof(Submesh);
+}
+
+void DestroyMeshStorage(Mesh& mesh)
+{
+    for (MeshChunk& chunk : mesh.chunks)
+    {
+        glDeleteBuffers(1, &chunk.vertexBufferHandle);
+        glDeleteBuffers(1, &chunk.indexBufferHandle);
+    }
+    mesh.chunks.clear();
+    mesh.gpuBytes = 0;
+}
+
+bool IsMeshChunkBuffer(const Mesh& mesh, GLuint vertexBufferHandle)
+{
+    for (const MeshChunk& chunk : mesh.chunks)
+        if (chunk.vertexBufferHandle == vertexBufferHandle)
+            return true;
+    return false;
+}
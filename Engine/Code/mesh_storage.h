@@ -0,0 +1,24 @@
+//
+// mesh_storage.h: GPU storage of mesh geometry. Submeshes are uploaded one at
+// a time into chunk buffers with 64-bit offsets, so the size of a model isn't
+// bounded by a single buffer. The source data isn't streamed: the whole assimp
+// scene stays in RAM while loading, next to the one submesh being converted.
+//
+
+#pragma once
+
+#include "engine.h"
+
+u64 HashSubmeshData(const SubmeshData& data);
+
+// Uploads a submesh at the end of the mesh, or shares the GPU data of an
+// identical submesh already uploaded (by this or another mesh). The remaining
+// byte counts, this submesh included, size new chunks so small meshes don't
+// take a whole chunk. The data can be freed right after.
+void AddSubmesh(App* app, u32 meshIdx, const SubmeshData& data, u64 remainingVertexBytes, u64 remainingIndexBytes);
+
+// Deletes the chunk buffers and VAOs of the mesh
+void DestroyMeshStorage(Mesh& mesh);
+
+// True if the buffer is one of the chunks of the mesh
+bool IsMeshChunkBuffer(const Mesh& mesh, GLuint vertexBufferHandle);
@@ -0,0 +1,196 @@
+//
+// pipeline_warmup.cpp: One draw of a few vertices per combination, into a 1x1
+// target. Drivers specialize programs when the draw is submitted, so that is
+// enough to take the hitch out of later frames. During Init, glFinish() after
+// each draw also makes the driver finish its deferred work right there, so the
+// time measured is the whole hitch the draw would have caused.
+//
+
+#include "pipeline_warmup.h"
+#include "gl_state.h"
+#include <imgui.h>
+#include <chrono>
+
+#define WARM_UP_UNIFORM_BUFFER_SIZE KB(4)
+
+void InitPipelineWarmUp(App* app)
+{
+    PipelineWarmUp& warmUp = app->pipelineWarmUp;
+
+    // Same formats as the default framebuffer
+    glGenTextures(1, &warmUp.colorTarget);
+    glBindTexture(GL_TEXTURE_2D, warmUp.colorTarget);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, 1, 1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenRenderbuffers(1, &warmUp.depthTarget);
+    glBindRenderbuffer(GL_RENDERBUFFER, warmUp.depthTarget);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, 1, 1);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &warmUp.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, warmUp.framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, warmUp.colorTarget, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, warmUp.depthTarget);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        ELOG("Pipeline warm-up framebuffer is incomplete");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // Blocks left unbacked give undefined results, some drivers fault
+    std::vector<u8> zeros(WARM_UP_UNIFORM_BUFFER_SIZE, 0);
+    glGenBuffers(1, &warmUp.uniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, warmUp.uniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, zeros.size(), zeros.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+static u64 GetWarmUpKey(u32 pipelineIdx, u64 layoutKey, GLenum primitiveType)
+{
+    u64 key = HashBytes(&primitiveType, sizeof(primitiveType), layoutKey);
+    return HashBytes(&pipelineIdx, sizeof(pipelineIdx), key);
+}
+
+struct WarmUpPass
+{
+    App* app;
+    bool timed;
+    bool targetBound;
+};
+
+static bool IsWarm(const WarmUpPass& pass, u32 pipelineIdx, u64 layoutKey, GLenum primitiveType)
+{
+    return pass.app->pipelineWarmUp.warmed.count(GetWarmUpKey(pipelineIdx, layoutKey, primitiveType)) > 0;
+}
+
+// A primitive of the submesh, or without one, of the embedded quad or the
+// point cloud node whose VAO is given
+static void WarmUp(WarmUpPass& pass, u32 pipelineIdx, u64 layoutKey, GLuint vao, GLenum primitiveType, const Submesh* submesh)
+{
+    App* app = pass.app;
+    PipelineWarmUp& warmUp = app->pipelineWarmUp;
+
+    if (!pass.targetBound)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, warmUp.framebuffer);
+        glViewport(0, 0, 1, 1);
+        for (u32 binding = 0; binding < GL_STATE_UNIFORM_BINDINGS; ++binding)
+            BindUniformBuffer(app, binding, warmUp.uniformBuffer, 0, WARM_UP_UNIFORM_BUFFER_SIZE);
+        pass.targetBound = true;
+    }
+
+    const auto begin = std::chrono::steady_clock::now();
+
+    BindPipeline(app, pipelineIdx);
+    BindVertexArray(app, vao);
+    if (submesh)
+    {
+        BindSubmeshBuffers(app, *submesh);
+        DrawSubmesh(*submesh, primitiveType == GL_POINTS ? 1 : primitiveType == GL_LINES ? 2 : 3);
+    }
+    else if (primitiveType == GL_POINTS)
+    {
+        glDrawArrays(GL_POINTS, 0, 1);
+    }
+    else
+    {
+        glDrawElements(GL_TRIANGLES, 3, GL_UNSIGNED_SHORT, 0);
+    }
+    if (pass.timed)
+        glFinish();
+
+    const f32 milliseconds = std::chrono::duration<f32, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    warmUp.warmed[GetWarmUpKey(pipelineIdx, layoutKey, primitiveType)] = { pipelineIdx, layoutKey, primitiveType, milliseconds };
+    warmUp.totalMilliseconds += milliseconds;
+
+    const PipelineDesc& desc = app->pipelines[pipelineIdx].desc;
+    ILOG("Warmed up pipeline %u (%s%s%s), layout %016llx: %.2f ms", pipelineIdx,
+         app->programs[desc.programIdx].programName.c_str(), desc.fragmentProgramIdx ? " + " : "",
+         desc.fragmentProgramIdx ? app->programs[desc.fragmentProgramIdx].programName.c_str() : "", layoutKey, milliseconds);
+}
+
+static void WarmUpSubmesh(WarmUpPass& pass, u32 pipelineIdx, const Submesh& submesh)
+{
+    const u64 layoutKey = GetVertexLayoutKey(submesh.vertexBufferLayout);
+    if (IsWarm(pass, pipelineIdx, layoutKey, submesh.primitiveType))
+        return;
+
+    // The VAO is the one the frame will draw with
+    const GLuint vao = FindVAO(pass.app, submesh, GetPipelineVertexProgram(pass.app, pipelineIdx));
+    WarmUp(pass, pipelineIdx, layoutKey, vao, submesh.primitiveType, &submesh);
+}
+
+void WarmUpModelPipelines(App* app, u32 modelIdx, bool timed)
+{
+    if (!app->pipelineWarmUp.framebuffer)
+        return;
+
+    WarmUpPass pass = {};
+    pass.app = app;
+    pass.timed = timed;
+
+    // The embedded quad and point cloud nodes have fixed layouts, key 0
+    if (!IsWarm(pass, app->texturedQuadPipelineIdx, 0, GL_TRIANGLES))
+        WarmUp(pass, app->texturedQuadPipelineIdx, 0, app->vao, GL_TRIANGLES, nullptr);
+
+    if (app->models.IsValid(modelIdx))
+    {
+        const Model& model = app->models[modelIdx];
+        const Mesh& mesh = app->meshes[model.meshIdx];
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            const Material& material = app->materials[model.materialIdx[i]];
+            WarmUpSubmesh(pass, GetTexturedMeshPipeline(app, material), mesh.submeshes[i]);
+            if (app->virtualTexturing.enabled && material.albedoVirtualTextureIdx != UINT32_MAX)
+                WarmUpSubmesh(pass, app->virtualTexturing.feedbackPipelineIdx, mesh.submeshes[i]);
+        }
+
+        const u32 pointCloudPipelineIdx = app->pointCloudStreaming.pipelineIdx;
+        for (u32 pointCloudIdx : model.pointCloudIdx)
+        {
+            if (IsWarm(pass, pointCloudPipelineIdx, 0, GL_POINTS))
+                break;
+            for (const PointCloudNode& node : app->pointClouds[pointCloudIdx].nodes)
+            {
+                if (node.vao)
+                {
+                    WarmUp(pass, pointCloudPipelineIdx, 0, node.vao, GL_POINTS, nullptr);
+                    break;
+                }
+            }
+        }
+    }
+
+    if (pass.targetBound)
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+    }
+}
+
+void ForgetWarmedProgram(App* app, u32 programIdx)
+{
+    std::unordered_map<u64, WarmedDraw>& warmed = app->pipelineWarmUp.warmed;
+    for (auto it = warmed.begin(); it != warmed.end();)
+    {
+        const PipelineDesc& desc = app->pipelines[it->second.pipelineIdx].desc;
+        if (desc.programIdx == programIdx || desc.fragmentProgramIdx == programIdx)
+            it = warmed.erase(it);
+        else
+            ++it;
+    }
+}
+
+void PipelineWarmUpGui(App* app)
+{
+    const PipelineWarmUp& warmUp = app->pipelineWarmUp;
+
+    ImGui::Begin("Pipeline warm-up");
+    ImGui::Text("Combinations warmed: %u, %.2f ms in total", (u32)warmUp.warmed.size(), warmUp.totalMilliseconds);
+    for (const auto& [key, draw] : warmUp.warmed)
+    {
+        const PipelineDesc& desc = app->pipelines[draw.pipelineIdx].desc;
+        ImGui::Text("%6.2f ms  pipeline %u (%s%s), layout %016llx", draw.milliseconds, draw.pipelineIdx,
+                    app->programs[desc.programIdx].programName.c_str(), desc.fragmentProgramIdx ? " + fragment stage" : "", draw.layoutKey);
+    }
+    ImGui::End();
+}
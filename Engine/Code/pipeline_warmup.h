@@ -0,0 +1,26 @@
+//
+// pipeline_warmup.h: Drivers defer part of the program compile, and its
+// specialization for the vertex format and render state, to the first draw.
+// Every (pipeline, vertex layout, primitive) combination the scene uses is
+// drawn once into a tiny offscreen target before any frame needs it, so that
+// cost lands while loading instead of as a hitch in the first frames.
+//
+
+#pragma once
+
+#include "engine.h"
+
+// Creates the offscreen target, call once the GL context is up
+void InitPipelineWarmUp(App* app);
+
+// Draws the combinations of the model (its point clouds included) that weren't
+// warmed yet. Call when it finished loading or its pipelines changed, before
+// it is drawn and outside of the uniform ring frame. Cheap when all are warm.
+// Timed waits for each draw with glFinish(), only meant for loading screens.
+void WarmUpModelPipelines(App* app, u32 modelIdx, bool timed = false);
+
+// The combinations drawn with the program are warmed again on the next
+// WarmUpModelPipelines(), call when its GL program changes
+void ForgetWarmedProgram(App* app, u32 programIdx);
+
+void PipelineWarmUpGui(App* app);
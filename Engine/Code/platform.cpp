@@ -16,12 +16,17 @@
 #endif
 
 #include "engine.h"
+#include "job_system.h"
+#include "async_assets.h"
 
 #include <GLFW/glfw3.h>
 #include <stdio.h>
+#include <string.h>
 #include <imgui.h>
 #include <imgui_impl_glfw.h>
 #include <imgui_impl_opengl3.h>
+#include <mutex>
+#include <filesystem>
 
 #define WINDOW_TITLE  "Advanced Graphics Programming"
 #define WINDOW_WIDTH  800
@@ -31,6 +36,10 @@
 u8* GlobalFrameArenaMemory = NULL;
 u32 GlobalFrameArenaHead = 0;
 
+// Hidden context sharing objects with the window one, for GL work off the main thread
+GLFWwindow* GlobalSharedContext = NULL;
+std::mutex  GlobalSharedContextMutex;
+
 void OnGlfwError(int errorCode, const char *errorMessage)
 {
 	fprintf(stderr, "glfw failed with error %d: %s\n", errorCode, errorMessage);
@@ -114,13 +123,23 @@ void OnGlfwCloseWindow(GLFWwindow* window)
     app->isRunning = false;
 }
 
-int main()
+int main(int argc, char** argv)
 {
     App app         = {};
     app.deltaTime   = 1.0f/60.0f;
     app.displaySize = ivec2(WINDOW_WIDTH, WINDOW_HEIGHT);
     app.isRunning   = true;
 
+    // Settings
+    app.separablePrograms = true;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--linked-programs") == 0)
+            app.separablePrograms = false;
+        else
+            ELOG("Unknown option %s\n", argv[i]);
+    }
+
 		glfwSetErrorCallback(OnGlfwError);
 
     if (!glfwInit())
@@ -160,6 +179,12 @@ int main()
         return -1;
     }
 
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GlobalSharedContext = glfwCreateWindow(1, 1, WINDOW_TITLE, NULL, window);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (!GlobalSharedContext)
+        ELOG("Could not create the shared OpenGL context, background GL work will run on the main thread\n");
+
     IMGUI_CHECKVERSION();
     ImGui::CreateContext();
 
@@ -199,6 +224,8 @@ int main()
 
     GlobalFrameArenaMemory = (u8*)malloc(GLOBAL_FRAME_ARENA_SIZE);
 
+    InitJobSystem();
+
     Init(&app);
 
     while (app.isRunning)
@@ -262,11 +289,17 @@ int main()
         GlobalFrameArenaHead = 0;
     }
 
+    CancelAsyncAssets();
+    ShutdownJobSystem();
+    DestroyAsyncAssets();
+
     free(GlobalFrameArenaMemory);
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
 
+    if (GlobalSharedContext)
+        glfwDestroyWindow(GlobalSharedContext);
     glfwDestroyWindow(window);
 
     glfwTerminate();
@@ -274,6 +307,22 @@ int main()
     return 0;
 }
 
+bool AcquireSharedGlContext()
+{
+    // A thread with a current context (the main thread) must keep it
+    if (!GlobalSharedContext || glfwGetCurrentContext())
+        return false;
+    GlobalSharedContextMutex.lock();
+    glfwMakeContextCurrent(GlobalSharedContext);
+    return true;
+}
+
+void ReleaseSharedGlContext()
+{
+    glfwMakeContextCurrent(NULL);
+    GlobalSharedContextMutex.unlock();
+}
+
 u32 Strlen(const char* string)
 {
     u32 len = 0;
@@ -399,6 +448,109 @@ u64 GetFileLastWriteTimestamp(const char* filepath)
     return 0;
 }
 
+std::string GetCacheFilePath(const char* sourcePath, const char* extension)
+{
+    std::error_code error;
+    std::filesystem::create_directories(CACHE_DIRECTORY, error);
+
+    char hash[32];
+    sprintf(hash, ".%016llx", HashBytes(sourcePath, strlen(sourcePath)));
+    return std::string(CACHE_DIRECTORY "/") + std::filesystem::path(sourcePath).filename().string() + hash + extension;
+}
+
+bool SeekFile(FILE* file, u64 offset)
+{
+#ifdef _WIN32
+    return _fseeki64(file, (i64)offset, SEEK_SET) == 0;
+#else
+    return fseeko(file, (off_t)offset, SEEK_SET) == 0;
+#endif
+}
+
+static const u64 HashPrime1 = 11400714785074694791ULL;
+static const u64 HashPrime2 = 14029467366897019727ULL;
+static const u64 HashPrime3 =  1609587929392839161ULL;
+static const u64 HashPrime4 =  9650029242287828579ULL;
+static const u64 HashPrime5 =  2870177450012600261ULL;
+
+static inline u64 HashRotl(u64 x, u32 r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline u64 HashRound(u64 acc, u64 lane)
+{
+    acc += lane * HashPrime2;
+    acc  = HashRotl(acc, 31);
+    acc *= HashPrime1;
+    return acc;
+}
+
+static inline u64 HashMerge(u64 acc, u64 val)
+{
+    acc ^= HashRound(0, val);
+    return acc * HashPrime1 + HashPrime4;
+}
+
+static inline u64 HashRead64(const u8* p) { u64 v; memcpy(&v, p, sizeof(v)); return v; }
+static inline u32 HashRead32(const u8* p) { u32 v; memcpy(&v, p, sizeof(v)); return v; }
+
+u64 HashBytes(const void* data, u64 byteCount, u64 seed)
+{
+    const u8* p   = (const u8*)data;
+    const u8* end = p + byteCount;
+    u64 h;
+
+    if (byteCount >= 32)
+    {
+        // Four independent lanes so the loop is not latency bound
+        u64 v1 = seed + HashPrime1 + HashPrime2;
+        u64 v2 = seed + HashPrime2;
+        u64 v3 = seed;
+        u64 v4 = seed - HashPrime1;
+        const u8* limit = end - 32;
+        do {
+            v1 = HashRound(v1, HashRead64(p)); p += 8;
+            v2 = HashRound(v2, HashRead64(p)); p += 8;
+            v3 = HashRound(v3, HashRead64(p)); p += 8;
+            v4 = HashRound(v4, HashRead64(p)); p += 8;
+        } while (p <= limit);
+
+        h = HashRotl(v1, 1) + HashRotl(v2, 7) + HashRotl(v3, 12) + HashRotl(v4, 18);
+        h = HashMerge(h, v1);
+        h = HashMerge(h, v2);
+        h = HashMerge(h, v3);
+        h = HashMerge(h, v4);
+    }
+    else
+    {
+        h = seed + HashPrime5;
+    }
+
+    h += byteCount;
+
+    while (p + 8 <= end) {
+        h ^= HashRound(0, HashRead64(p));
+        h  = HashRotl(h, 27) * HashPrime1 + HashPrime4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (u64)HashRead32(p) * HashPrime1;
+        h  = HashRotl(h, 23) * HashPrime2 + HashPrime3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p) * HashPrime5;
+        h  = HashRotl(h, 11) * HashPrime1;
+        p++;
+    }
+
+    h ^= h >> 33; h *= HashPrime2;
+    h ^= h >> 29; h *= HashPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
 void LogString(const char* str)
 {
 #ifdef _WIN32
@@ -81,6 +81,44 @@ String ReadTextFile(const char *filepath);
  */
 u64 GetFileLastWriteTimestamp(const char *filepath);
 
+/**
+ * Moves to an absolute offset of a file. Unlike fseek() it reaches past 2GB on
+ * Windows, where long is 32 bits. Returns false on failure.
+ */
+bool SeekFile(FILE* file, u64 offset);
+
+/**
+ * Every file generated from the assets (mip chains, virtual texture pages,
+ * octrees, program binaries) goes under this directory of the working one,
+ * never next to the sources.
+ */
+#define CACHE_DIRECTORY "cache"
+
+/**
+ * Path of the cache file generated from a source file, creating the cache
+ * directory if needed. The name keeps the file name of the source followed by
+ * a hash of its whole path, so sources with the same name don't collide.
+ */
+std::string GetCacheFilePath(const char* sourcePath, const char* extension);
+
+/**
+ * Makes a hidden OpenGL context that shares objects with the main one current on
+ * the calling thread, so worker threads can compile programs or upload data.
+ * Only one thread holds it at a time, Acquire blocks until it is released.
+ * Returns false (and takes nothing) if the platform couldn't create it, or on
+ * a thread that already has a current context, like the main thread.
+ * Objects created on it must be fenced before the main context uses them.
+ */
+bool AcquireSharedGlContext();
+
+void ReleaseSharedGlContext();
+
+/**
+ * Fast non-cryptographic 64-bit hash of a block of memory (xxHash64-like).
+ * Used to detect identical pixel or vertex data loaded from different files.
+ */
+u64 HashBytes(const void *data, u64 byteCount, u64 seed = 0);
+
 /**
  * It logs a string to whichever outputs are configured in the platform layer.
  * By default, the string is printed in the output console of VisualStudio.
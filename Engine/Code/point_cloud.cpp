@@ -0,0 +1,644 @@
+//
+// point_cloud.cpp: Octree cooking, node selection and node streaming.
+//
+// The node file holds a header, then the points of every node one after the
+// other and the node table at the end, so it is written in a single pass
+// while the octree is built.
+//
+
+#include "point_cloud.h"
+#include "async_assets.h"
+#include "program_reflection.h"
+#include "gl_state.h"
+#include "../assimp_model_loading.h"
+#include <imgui.h>
+#include <algorithm>
+#include <float.h>
+
+#define POINT_CLOUD_FILE_MAGIC 0x31435050 // "PPC1"
+
+// A node keeps the first point in each cell of a grid this size over its
+// bounds, so its spacing is the size of a cell
+#define POINT_CLOUD_GRID_CELLS      128
+// Nodes with fewer points keep all of them instead of splitting
+#define POINT_CLOUD_MAX_LEAF_POINTS 65536
+#define POINT_CLOUD_MAX_DEPTH       16
+#define POINT_CLOUD_MAX_POINT_SIZE  16.0f
+
+struct PointCloudVertex
+{
+    vec3 position;
+    u32  color; // RGBA8
+};
+
+struct PointCloudFileHeader
+{
+    u32 magic;
+    u32 nodeCount;
+    u64 pointCount;
+    u64 nodeTableOffset;
+};
+
+struct PointCloudFileNode
+{
+    vec3 boundsMin;
+    vec3 boundsMax;
+    f32  spacing;
+    u32  children[8];
+    u32  pointCount;
+    u64  fileOffset;
+};
+
+static std::string GetNodeFilePath(const char* filepath, u32 meshIndex)
+{
+    return GetCacheFilePath(filepath, ("." + std::to_string(meshIndex) + ".octree").c_str());
+}
+
+static u32 PackColor(const aiColor4D& color)
+{
+    const u32 r = (u32)(glm::clamp(color.r, 0.0f, 1.0f) * 255.0f + 0.5f);
+    const u32 g = (u32)(glm::clamp(color.g, 0.0f, 1.0f) * 255.0f + 0.5f);
+    const u32 b = (u32)(glm::clamp(color.b, 0.0f, 1.0f) * 255.0f + 0.5f);
+    const u32 a = (u32)(glm::clamp(color.a, 0.0f, 1.0f) * 255.0f + 0.5f);
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+bool IsPointCloudMesh(const aiMesh* mesh, u32 minPoints)
+{
+    return minPoints > 0 && mesh->mNumVertices >= minPoints && GetAssimpPrimitiveType(mesh) == GL_POINTS;
+}
+
+// Points are read straight from the assimp mesh, already in memory, so the
+// only per point memory of the build is the order array
+struct OctreeBuilder
+{
+    const aiMesh*                   mesh;
+    std::vector<u32>                order;    // Point indices, grouped per node as the nodes are built
+    std::vector<bool>               occupied; // Sampling grid of the node being built
+    std::vector<PointCloudVertex>   scratch;
+    std::vector<PointCloudFileNode> nodes;
+    FILE*                           file;
+    u64                             fileOffset;
+    bool                            failed;
+};
+
+// Builds the node holding the points order[begin, end), which are inside the
+// cube at boundsMin, and its children. Returns the index of the node.
+static u32 BuildOctreeNode(OctreeBuilder& builder, u64 begin, u64 end, vec3 boundsMin, f32 size, u32 depth)
+{
+    const aiMesh* mesh = builder.mesh;
+    auto positionOf = [mesh](u32 pointIdx) {
+        const aiVector3D& p = mesh->mVertices[pointIdx];
+        return vec3(p.x, p.y, p.z);
+    };
+
+    const u32 nodeIdx = (u32)builder.nodes.size();
+    PointCloudFileNode node = {};
+    node.boundsMin = boundsMin;
+    node.boundsMax = boundsMin + vec3(size);
+    node.spacing = size / POINT_CLOUD_GRID_CELLS;
+    for (u32& child : node.children)
+        child = UINT32_MAX;
+
+    // Small or too deep nodes keep every point, the others keep one per grid
+    // cell and move the rest to the front of the range their children take
+    u64 keptEnd = end;
+    if (end - begin > POINT_CLOUD_MAX_LEAF_POINTS && depth < POINT_CLOUD_MAX_DEPTH)
+    {
+        std::fill(builder.occupied.begin(), builder.occupied.end(), false);
+        keptEnd = begin;
+        for (u64 i = begin; i < end; ++i)
+        {
+            const ivec3 cell = glm::clamp(ivec3((positionOf(builder.order[i]) - boundsMin) / node.spacing),
+                                          ivec3(0), ivec3(POINT_CLOUD_GRID_CELLS - 1));
+            const u32 cellIdx = (cell.z * POINT_CLOUD_GRID_CELLS + cell.y) * POINT_CLOUD_GRID_CELLS + cell.x;
+            if (builder.occupied[cellIdx])
+                continue;
+            builder.occupied[cellIdx] = true;
+            std::swap(builder.order[keptEnd++], builder.order[i]);
+        }
+    }
+
+    builder.scratch.clear();
+    for (u64 i = begin; i < keptEnd; ++i)
+    {
+        const u32 pointIdx = builder.order[i];
+        const u32 color = mesh->mColors[0] ? PackColor(mesh->mColors[0][pointIdx]) : 0xFFFFFFFFu;
+        builder.scratch.push_back(PointCloudVertex{ positionOf(pointIdx), color });
+    }
+    node.pointCount = (u32)builder.scratch.size();
+    node.fileOffset = builder.fileOffset;
+    if (fwrite(builder.scratch.data(), sizeof(PointCloudVertex), builder.scratch.size(), builder.file) != builder.scratch.size())
+        builder.failed = true;
+    builder.fileOffset += builder.scratch.size() * sizeof(PointCloudVertex);
+    builder.nodes.push_back(node);
+
+    if (keptEnd == end)
+        return nodeIdx;
+
+    // Group the remaining points per octant
+    const f32 half = size * 0.5f;
+    const vec3 center = boundsMin + vec3(half);
+    auto octantOf = [&](u32 pointIdx) {
+        const vec3 p = positionOf(pointIdx);
+        return (p.x >= center.x ? 1u : 0u) | (p.y >= center.y ? 2u : 0u) | (p.z >= center.z ? 4u : 0u);
+    };
+
+    u64 octantBegin[9] = {};
+    for (u64 i = keptEnd; i < end; ++i)
+        octantBegin[octantOf(builder.order[i]) + 1]++;
+    for (u32 octant = 0; octant < 8; ++octant)
+        octantBegin[octant + 1] += octantBegin[octant];
+
+    // In place, swapping every point into the range of its octant
+    u64 cursor[8];
+    std::copy(octantBegin, octantBegin + 8, cursor);
+    for (u32 octant = 0; octant < 8; ++octant)
+    {
+        while (cursor[octant] < octantBegin[octant + 1])
+        {
+            const u64 i = keptEnd + cursor[octant];
+            const u32 target = octantOf(builder.order[i]);
+            if (target == octant)
+                cursor[octant]++;
+            else
+                std::swap(builder.order[i], builder.order[keptEnd + cursor[target]++]);
+        }
+    }
+
+    for (u32 octant = 0; octant < 8; ++octant)
+    {
+        if (octantBegin[octant] == octantBegin[octant + 1])
+            continue;
+        const vec3 childMin = boundsMin + vec3((octant & 1) ? half : 0.0f, (octant & 2) ? half : 0.0f, (octant & 4) ? half : 0.0f);
+        const u32 childIdx = BuildOctreeNode(builder, keptEnd + octantBegin[octant], keptEnd + octantBegin[octant + 1], childMin, half, depth + 1);
+        builder.nodes[nodeIdx].children[octant] = childIdx;
+    }
+    return nodeIdx;
+}
+
+static bool CookPointCloud(const aiMesh* mesh, const std::string& nodeFilePath)
+{
+    const u32 pointCount = mesh->mNumVertices;
+    vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+    for (u32 i = 0; i < pointCount; ++i)
+    {
+        const vec3 position(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
+        boundsMin = glm::min(boundsMin, position);
+        boundsMax = glm::max(boundsMax, position);
+    }
+
+    FILE* file = fopen(nodeFilePath.c_str(), "wb");
+    if (!file)
+    {
+        ELOG("Could not write point cloud nodes %s", nodeFilePath.c_str());
+        return false;
+    }
+
+    PointCloudFileHeader header = { POINT_CLOUD_FILE_MAGIC, 0, pointCount, 0 };
+    fwrite(&header, sizeof(header), 1, file);
+
+    OctreeBuilder builder = {};
+    builder.mesh = mesh;
+    builder.order.resize(pointCount);
+    for (u32 i = 0; i < pointCount; ++i)
+        builder.order[i] = i;
+    builder.occupied.resize(POINT_CLOUD_GRID_CELLS * POINT_CLOUD_GRID_CELLS * POINT_CLOUD_GRID_CELLS);
+    builder.file = file;
+    builder.fileOffset = sizeof(header);
+
+    // The octree is a cube, so every node has the same spacing on all axes
+    const vec3 extent = boundsMax - boundsMin;
+    const f32 size = glm::max(glm::max(extent.x, extent.y), glm::max(extent.z, 1e-6f)) * 1.0001f;
+    BuildOctreeNode(builder, 0, pointCount, boundsMin, size, 0);
+
+    header.nodeCount = (u32)builder.nodes.size();
+    header.nodeTableOffset = builder.fileOffset;
+    bool written = !builder.failed &&
+                   fwrite(builder.nodes.data(), sizeof(PointCloudFileNode), builder.nodes.size(), file) == builder.nodes.size() &&
+                   SeekFile(file, 0) &&
+                   fwrite(&header, sizeof(header), 1, file) == 1;
+    fclose(file);
+
+    if (!written)
+    {
+        ELOG("Could not write point cloud nodes %s", nodeFilePath.c_str());
+        remove(nodeFilePath.c_str());
+        return false;
+    }
+
+    ILOG("Cooked %llu points into %u octree nodes: %s", header.pointCount, header.nodeCount, nodeFilePath.c_str());
+    return true;
+}
+
+static bool ReadNodeFileHeader(FILE* file, PointCloudFileHeader& header)
+{
+    return fread(&header, sizeof(header), 1, file) == 1 && header.magic == POINT_CLOUD_FILE_MAGIC;
+}
+
+static bool IsNodeFileUpToDate(const std::string& nodeFilePath, const char* sourcePath, u64 pointCount)
+{
+    if (GetFileLastWriteTimestamp(nodeFilePath.c_str()) < GetFileLastWriteTimestamp(sourcePath))
+        return false;
+
+    FILE* file = fopen(nodeFilePath.c_str(), "rb");
+    if (!file)
+        return false;
+    PointCloudFileHeader header = {};
+    bool read = ReadNodeFileHeader(file, header);
+    fclose(file);
+
+    return read && header.pointCount == pointCount;
+}
+
+static bool ReadNodeTable(const std::string& nodeFilePath, std::vector<PointCloudFileNode>& nodes)
+{
+    FILE* file = fopen(nodeFilePath.c_str(), "rb");
+    if (!file)
+        return false;
+
+    PointCloudFileHeader header = {};
+    bool read = ReadNodeFileHeader(file, header) && SeekFile(file, header.nodeTableOffset);
+    if (read)
+    {
+        nodes.resize(header.nodeCount);
+        read = fread(nodes.data(), sizeof(PointCloudFileNode), nodes.size(), file) == nodes.size();
+    }
+    fclose(file);
+    return read;
+}
+
+static std::vector<PointCloudVertex> ReadNodePoints(const std::string& nodeFilePath, u64 fileOffset, u32 pointCount)
+{
+    std::vector<PointCloudVertex> points;
+    FILE* file = fopen(nodeFilePath.c_str(), "rb");
+    if (!file)
+        return points;
+
+    points.resize(pointCount);
+    if (!SeekFile(file, fileOffset) || fread(points.data(), sizeof(PointCloudVertex), pointCount, file) != pointCount)
+        points.clear();
+    fclose(file);
+    return points;
+}
+
+void CookScenePointClouds(const aiScene* scene, const char* filepath, u32 minPoints)
+{
+    std::vector<const aiMesh*> meshes;
+    CollectAssimpMeshes(scene, scene->mRootNode, meshes);
+    for (u32 i = 0; i < meshes.size(); ++i)
+    {
+        if (!IsPointCloudMesh(meshes[i], minPoints))
+            continue;
+        const std::string nodeFilePath = GetNodeFilePath(filepath, i);
+        if (!IsNodeFileUpToDate(nodeFilePath, filepath, meshes[i]->mNumVertices))
+            CookPointCloud(meshes[i], nodeFilePath);
+    }
+}
+
+static void UploadNode(App* app, PointCloudNode& node, const std::vector<PointCloudVertex>& points)
+{
+    const u64 bytes = points.size() * sizeof(PointCloudVertex);
+
+    glGenBuffers(1, &node.vertexBufferHandle);
+    glBindBuffer(GL_ARRAY_BUFFER, node.vertexBufferHandle);
+    glBufferData(GL_ARRAY_BUFFER, bytes, points.data(), GL_STATIC_DRAW);
+
+    glGenVertexArrays(1, &node.vao);
+    glBindVertexArray(node.vao);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(PointCloudVertex), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(PointCloudVertex), (void*)offsetof(PointCloudVertex, color));
+    glEnableVertexAttribArray(1);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // Counts as seen now, or it would be the first one evicted
+    node.lastUsedFrame = app->pointCloudStreaming.frame;
+    app->pointCloudStreaming.residentBytes += bytes;
+    app->pointCloudStreaming.nodesLoaded++;
+}
+
+static void UnloadNode(App* app, PointCloudNode& node)
+{
+    if (!node.vertexBufferHandle)
+        return;
+
+    glDeleteVertexArrays(1, &node.vao);
+    glDeleteBuffers(1, &node.vertexBufferHandle);
+    node.vao = 0;
+    node.vertexBufferHandle = 0;
+    app->pointCloudStreaming.residentBytes -= (u64)node.pointCount * sizeof(PointCloudVertex);
+}
+
+static AssetTask LoadNodeAsync(App* app, u32 pointCloudIdx, u32 nodeIdx)
+{
+    PointCloudStreaming& pcs = app->pointCloudStreaming;
+    PointCloudNode& node = app->pointClouds[pointCloudIdx].nodes[nodeIdx];
+    node.loadPending = true;
+    pcs.pendingLoads++;
+
+    const std::string nodeFilePath = app->pointClouds[pointCloudIdx].nodeFilePath;
+    const u64 fileOffset = node.fileOffset;
+    const u32 pointCount = node.pointCount;
+
+    co_await ResumeOnWorker{ JobPriority_Normal };
+
+    std::vector<PointCloudVertex> points = ReadNodePoints(nodeFilePath, fileOffset, pointCount);
+
+    co_await ResumeOnMainThread{ JobPriority_Normal };
+
+    pcs.pendingLoads--;
+
+    // The cloud may have been released meanwhile
+    PointCloud* cloud = app->pointClouds.Get(pointCloudIdx);
+    if (!cloud)
+        co_return UINT32_MAX;
+
+    PointCloudNode& loaded = cloud->nodes[nodeIdx];
+    loaded.loadPending = false;
+    if (points.empty())
+    {
+        ELOG("Could not read point cloud node %u from %s", nodeIdx, nodeFilePath.c_str());
+        co_return UINT32_MAX;
+    }
+
+    UploadNode(app, loaded, points);
+    co_return nodeIdx;
+}
+
+void InitPointClouds(App* app)
+{
+    PointCloudStreaming& pcs = app->pointCloudStreaming;
+    pcs.enabled = true;
+    pcs.minPoints = 1000000;
+    pcs.targetSpacing = 2.0f;
+    pcs.pointBudget = 10000000;
+    pcs.budgetBytes = MB(512);
+    pcs.maxPendingLoads = 8;
+
+    pcs.programIdx = LoadProgram(app, "shaders.glsl", "POINT_CLOUD");
+
+    PipelineDesc pipeline = {};
+    pipeline.programIdx = pcs.programIdx;
+    pipeline.depthTest = true;
+    pipeline.depthWrite = true;
+    pipeline.programPointSize = true;
+    pcs.pipelineIdx = GetPipeline(app, pipeline);
+}
+
+u32 AddPointCloud(App* app, const char* filepath, u32 meshIndex, const aiMesh* mesh)
+{
+    PointCloud cloud = {};
+    cloud.sourcePath = filepath;
+    cloud.nodeFilePath = GetNodeFilePath(filepath, meshIndex);
+    cloud.pointCount = mesh->mNumVertices;
+
+    if (!IsNodeFileUpToDate(cloud.nodeFilePath, filepath, cloud.pointCount))
+        CookPointCloud(mesh, cloud.nodeFilePath);
+
+    std::vector<PointCloudFileNode> fileNodes;
+    if (!ReadNodeTable(cloud.nodeFilePath, fileNodes))
+        ELOG("Could not read point cloud nodes %s", cloud.nodeFilePath.c_str());
+
+    for (const PointCloudFileNode& fileNode : fileNodes)
+    {
+        PointCloudNode node = {};
+        node.boundsMin = fileNode.boundsMin;
+        node.boundsMax = fileNode.boundsMax;
+        node.spacing = fileNode.spacing;
+        std::copy(fileNode.children, fileNode.children + 8, node.children);
+        node.pointCount = fileNode.pointCount;
+        node.fileOffset = fileNode.fileOffset;
+        cloud.nodes.push_back(node);
+    }
+
+    // The root is drawn while everything else streams in, keep it resident
+    if (!cloud.nodes.empty())
+    {
+        std::vector<PointCloudVertex> points = ReadNodePoints(cloud.nodeFilePath, cloud.nodes[0].fileOffset, cloud.nodes[0].pointCount);
+        if (!points.empty())
+            UploadNode(app, cloud.nodes[0], points);
+    }
+
+    return app->pointClouds.Add(std::move(cloud));
+}
+
+void ReleasePointCloud(App* app, u32 pointCloudIdx)
+{
+    if (pointCloudIdx == UINT32_MAX || !app->pointClouds.Release(pointCloudIdx))
+        return;
+
+    for (PointCloudNode& node : app->pointClouds[pointCloudIdx].nodes)
+        UnloadNode(app, node);
+    app->pointClouds.Remove(pointCloudIdx);
+}
+
+// Without a camera the mesh shader divides positions by a clipping scale of 5,
+// so the visible volume is a cube of that half size
+static bool IsNodeInView(const PointCloudNode& node, f32 clippingScale)
+{
+    return node.boundsMax.x >= -clippingScale && node.boundsMin.x <= clippingScale &&
+           node.boundsMax.y >= -clippingScale && node.boundsMin.y <= clippingScale &&
+           node.boundsMax.z >= -clippingScale && node.boundsMin.z <= clippingScale;
+}
+
+struct NodeCandidate
+{
+    f32 screenSize; // Pixels, bigger nodes are refined first
+    u32 pointCloudIdx;
+    u32 nodeIdx;
+
+    bool operator<(const NodeCandidate& other) const { return screenSize < other.screenSize; }
+};
+
+// Refines from the roots, biggest nodes first, while their points are further
+// apart on screen than the target and the point budget allows. Children are
+// only reached through resident parents, missing nodes are returned to load.
+static void SelectVisibleNodes(App* app, const Model& model, f32 pixelsPerWorldUnit, f32 clippingScale, std::vector<NodeCandidate>& missing)
+{
+    PointCloudStreaming& pcs = app->pointCloudStreaming;
+
+    std::vector<NodeCandidate> queue;
+    for (u32 pointCloudIdx : model.pointCloudIdx)
+    {
+        const PointCloud& cloud = app->pointClouds[pointCloudIdx];
+        if (!cloud.nodes.empty())
+            queue.push_back(NodeCandidate{ FLT_MAX, pointCloudIdx, 0 });
+    }
+    std::make_heap(queue.begin(), queue.end());
+
+    u64 selectedPoints = 0;
+    while (!queue.empty())
+    {
+        std::pop_heap(queue.begin(), queue.end());
+        const NodeCandidate candidate = queue.back();
+        queue.pop_back();
+
+        PointCloud& cloud = app->pointClouds[candidate.pointCloudIdx];
+        PointCloudNode& node = cloud.nodes[candidate.nodeIdx];
+        if (!IsNodeInView(node, clippingScale))
+            continue;
+        if (!node.vertexBufferHandle)
+        {
+            if (!node.loadPending)
+                missing.push_back(candidate);
+            continue;
+        }
+        if (selectedPoints > 0 && selectedPoints + node.pointCount > pcs.pointBudget)
+            break;
+
+        node.lastUsedFrame = pcs.frame;
+        cloud.visibleNodes.push_back(candidate.nodeIdx);
+        selectedPoints += node.pointCount;
+
+        if (node.spacing * pixelsPerWorldUnit <= pcs.targetSpacing)
+            continue;
+        for (u32 childIdx : node.children)
+        {
+            if (childIdx == UINT32_MAX)
+                continue;
+            const PointCloudNode& child = cloud.nodes[childIdx];
+            queue.push_back(NodeCandidate{ (child.boundsMax.x - child.boundsMin.x) * pixelsPerWorldUnit, candidate.pointCloudIdx, childIdx });
+            std::push_heap(queue.begin(), queue.end());
+        }
+    }
+
+    pcs.pointsDrawn = selectedPoints;
+}
+
+// Nodes drawn without their children stretch their points to cover the gaps
+// the children would fill
+static void ComputePointSizes(App* app, const Model& model, f32 pixelsPerWorldUnit)
+{
+    PointCloudStreaming& pcs = app->pointCloudStreaming;
+    for (u32 pointCloudIdx : model.pointCloudIdx)
+    {
+        PointCloud& cloud = app->pointClouds[pointCloudIdx];
+        for (u32 nodeIdx : cloud.visibleNodes)
+        {
+            const PointCloudNode& node = cloud.nodes[nodeIdx];
+            bool childrenDrawn = false;
+            for (u32 childIdx : node.children)
+                if (childIdx != UINT32_MAX && cloud.nodes[childIdx].lastUsedFrame == pcs.frame)
+                    childrenDrawn = true;
+
+            const f32 nodeSpacing = glm::clamp(node.spacing * pixelsPerWorldUnit, pcs.targetSpacing, POINT_CLOUD_MAX_POINT_SIZE);
+            cloud.visiblePointSizes.push_back(childrenDrawn ? pcs.targetSpacing : nodeSpacing);
+        }
+        pcs.visibleNodes += cloud.visibleNodes.size();
+    }
+}
+
+// Least recently drawn nodes go first. Roots and nodes drawn this frame stay.
+static void EvictNodes(App* app)
+{
+    PointCloudStreaming& pcs = app->pointCloudStreaming;
+    if (pcs.residentBytes <= pcs.budgetBytes)
+        return;
+
+    std::vector<NodeCandidate> resident;
+    for (u32 slot = 0; slot < app->pointClouds.SlotCount(); ++slot)
+    {
+        if (!app->pointClouds.IsSlotAlive(slot))
+            continue;
+        const u32 pointCloudIdx = app->pointClouds.HandleAt(slot);
+        const PointCloud& cloud = app->pointClouds[pointCloudIdx];
+        for (u32 nodeIdx = 1; nodeIdx < cloud.nodes.size(); ++nodeIdx)
+        {
+            const PointCloudNode& node = cloud.nodes[nodeIdx];
+            if (node.vertexBufferHandle && node.lastUsedFrame < pcs.frame)
+                resident.push_back(NodeCandidate{ (f32)(pcs.frame - node.lastUsedFrame), pointCloudIdx, nodeIdx });
+        }
+    }
+    std::sort(resident.begin(), resident.end(), [](const NodeCandidate& a, const NodeCandidate& b) { return a.screenSize > b.screenSize; });
+
+    for (u32 i = 0; i < resident.size() && pcs.residentBytes > pcs.budgetBytes; ++i)
+    {
+        UnloadNode(app, app->pointClouds[resident[i].pointCloudIdx].nodes[resident[i].nodeIdx]);
+        pcs.nodesEvicted++;
+    }
+}
+
+void UpdatePointClouds(App* app)
+{
+    PointCloudStreaming& pcs = app->pointCloudStreaming;
+    if (app->pointClouds.Count() == 0)
+        return;
+
+    pcs.frame++;
+    pcs.visibleNodes = 0;
+    pcs.pointsDrawn = 0;
+    for (PointCloud& cloud : app->pointClouds)
+    {
+        cloud.visibleNodes.clear();
+        cloud.visiblePointSizes.clear();
+    }
+
+    if (app->models.IsValid(app->model))
+    {
+        const Model& model = app->models[app->model];
+
+        // Same projection as the mesh shader, see UpdateTextureStreaming()
+        const f32 clippingScale = 5.0f;
+        const f32 pixelsPerWorldUnit = app->displaySize.y * 0.5f / clippingScale;
+
+        std::vector<NodeCandidate> missing;
+        SelectVisibleNodes(app, model, pixelsPerWorldUnit, clippingScale, missing);
+        ComputePointSizes(app, model, pixelsPerWorldUnit);
+
+        if (pcs.enabled)
+        {
+            std::sort(missing.begin(), missing.end(), [](const NodeCandidate& a, const NodeCandidate& b) { return b < a; });
+            for (u32 i = 0; i < missing.size() && pcs.pendingLoads < pcs.maxPendingLoads; ++i)
+                LoadNodeAsync(app, missing[i].pointCloudIdx, missing[i].nodeIdx);
+        }
+    }
+
+    EvictNodes(app);
+}
+
+void RenderPointClouds(App* app, const Model& model)
+{
+    PointCloudStreaming& pcs = app->pointCloudStreaming;
+    if (model.pointCloudIdx.empty())
+        return;
+
+    Program& program = app->programs[pcs.programIdx];
+    BindPipeline(app, pcs.pipelineIdx);
+
+    for (u32 pointCloudIdx : model.pointCloudIdx)
+    {
+        const PointCloud& cloud = app->pointClouds[pointCloudIdx];
+        for (u32 i = 0; i < cloud.visibleNodes.size(); ++i)
+        {
+            const PointCloudNode& node = cloud.nodes[cloud.visibleNodes[i]];
+            SetUniform(program, ShaderId("uPointSize"), cloud.visiblePointSizes[i]);
+            BindVertexArray(app, node.vao);
+            glDrawArrays(GL_POINTS, 0, node.pointCount);
+        }
+    }
+}
+
+void PointCloudGui(App* app)
+{
+    PointCloudStreaming& pcs = app->pointCloudStreaming;
+    if (app->pointClouds.Count() == 0)
+        return;
+
+    ImGui::Begin("Point clouds");
+    ImGui::Checkbox("Streaming", &pcs.enabled);
+    ImGui::SliderFloat("Target spacing (px)", &pcs.targetSpacing, 0.5f, POINT_CLOUD_MAX_POINT_SIZE);
+    int pointBudgetM = (int)(pcs.pointBudget / 1000000);
+    if (ImGui::SliderInt("Point budget (M)", &pointBudgetM, 1, 200))
+        pcs.pointBudget = (u64)pointBudgetM * 1000000;
+    int budgetMB = (int)(pcs.budgetBytes / MB(1));
+    if (ImGui::SliderInt("Budget (MB)", &budgetMB, 16, 8192))
+        pcs.budgetBytes = (u64)budgetMB * MB(1);
+    ImGui::Text("Point clouds: %u", app->pointClouds.Count());
+    ImGui::Text("Visible nodes: %u, points drawn: %.2f M", pcs.visibleNodes, pcs.pointsDrawn / 1000000.0);
+    ImGui::Text("Resident: %.2f MB", pcs.residentBytes / (f64)MB(1));
+    ImGui::Text("Pending loads: %u", pcs.pendingLoads);
+    ImGui::Text("Nodes loaded: %u, evicted: %u", pcs.nodesLoaded, pcs.nodesEvicted);
+    ImGui::End();
+}
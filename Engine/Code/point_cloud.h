@@ -0,0 +1,43 @@
+//
+// point_cloud.h: Out-of-core rendering of big point meshes. Points are cooked
+// into an octree on disk at import; every frame the nodes dense enough on
+// screen are selected within a point budget and streamed in from the node file.
+//
+// Only rendering is out of core. Assimp imports the whole source file, so
+// cooking needs the scan in RAM: the assimp mesh (12 bytes per point, 28 with
+// colors) plus 4 bytes per point for the octree build. Scans bigger than that
+// must be split into several files before import.
+//
+
+#pragma once
+
+#include "engine.h"
+
+struct aiScene;
+struct aiMesh;
+
+void InitPointClouds(App* app);
+
+// Whether an imported mesh should become a point cloud instead of a submesh
+bool IsPointCloudMesh(const aiMesh* mesh, u32 minPoints);
+
+// Cooks the octree of every point cloud of the scene whose node file is
+// missing or older than the source. It doesn't touch the App nor OpenGL so it
+// can be called from a worker thread.
+void CookScenePointClouds(const aiScene* scene, const char* filepath, u32 minPoints);
+
+// Registers the point cloud of the meshIndex-th mesh of the scene (in
+// CollectAssimpMeshes() order), cooking its node file if needed. The handle
+// returned holds the only reference.
+u32 AddPointCloud(App* app, const char* filepath, u32 meshIndex, const aiMesh* mesh);
+
+// Drops a reference. The last one frees the resident nodes and the slot.
+void ReleasePointCloud(App* app, u32 pointCloudIdx);
+
+// Selects the visible nodes of the current model, queues the loads of the
+// missing ones and evicts over budget. Call once per frame from the main thread.
+void UpdatePointClouds(App* app);
+
+void RenderPointClouds(App* app, const Model& model);
+
+void PointCloudGui(App* app);
@@ -0,0 +1,157 @@
+//
+// program_cache.cpp: Program binaries stored in cache/programs/<key>.bin.
+//
+
+#include "program_cache.h"
+#include <filesystem>
+
+#define PROGRAM_CACHE_DIRECTORY  CACHE_DIRECTORY "/programs"
+#define PROGRAM_CACHE_FILE_MAGIC 0x31425250 // "PRB1"
+
+struct ProgramBinaryFileHeader
+{
+    u32    magic;
+    GLenum format;
+    u32    size;
+};
+
+void InitProgramCache(App* app)
+{
+    ProgramCache& cache = app->programCache;
+
+    GLint formatCount = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+    std::error_code error;
+    std::filesystem::create_directories(PROGRAM_CACHE_DIRECTORY, error);
+    cache.enabled = formatCount > 0 && !error;
+    if (!cache.enabled)
+        ILOG("Program binary cache disabled: %s", formatCount > 0 ? "can't create " PROGRAM_CACHE_DIRECTORY : "no binary formats");
+
+    // Binaries are only valid for the driver that produced them
+    const OpenGLInfo& info = app->oGlI;
+    u64 hash = HashBytes(info.vendor, strlen(info.vendor));
+    hash = HashBytes(info.renderer, strlen(info.renderer), hash);
+    cache.driverHash = HashBytes(info.openGlVersion, strlen(info.openGlVersion), hash);
+}
+
+static std::string GetProgramBinaryPath(u64 key)
+{
+    char filename[64];
+    sprintf(filename, PROGRAM_CACHE_DIRECTORY "/%016llx.bin", key);
+    return filename;
+}
+
+// Preprocessed sources already carry the version and every define
+static u64 GetProgramKey(const ProgramCache& cache, const PreprocessedProgram& source)
+{
+    return HashPreprocessedProgram(source, cache.driverHash);
+}
+
+static GLuint LoadProgramBinary(const std::string& path, bool separable)
+{
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file)
+        return 0;
+
+    ProgramBinaryFileHeader header = {};
+    std::vector<u8> binary;
+    bool read = fread(&header, sizeof(header), 1, file) == 1 && header.magic == PROGRAM_CACHE_FILE_MAGIC;
+    if (read)
+    {
+        binary.resize(header.size);
+        read = fread(binary.data(), 1, binary.size(), file) == binary.size();
+    }
+    fclose(file);
+    if (!read)
+        return 0;
+
+    GLuint programHandle = glCreateProgram();
+    if (separable)
+        glProgramParameteri(programHandle, GL_PROGRAM_SEPARABLE, GL_TRUE);
+    glProgramBinary(programHandle, header.format, binary.data(), (GLsizei)binary.size());
+
+    GLint success = GL_FALSE;
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+    if (!success)
+    {
+        glDeleteProgram(programHandle);
+        return 0;
+    }
+    return programHandle;
+}
+
+static void StoreProgramBinary(const std::string& path, GLuint programHandle)
+{
+    GLint size = 0;
+    glGetProgramiv(programHandle, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0)
+        return;
+
+    ProgramBinaryFileHeader header = { PROGRAM_CACHE_FILE_MAGIC, 0, (u32)size };
+    std::vector<u8> binary(size);
+    glGetProgramBinary(programHandle, size, NULL, &header.format, binary.data());
+
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file)
+    {
+        ELOG("Could not write program binary %s", path.c_str());
+        return;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(binary.data(), 1, binary.size(), file);
+    fclose(file);
+}
+
+static GLuint CreateProgramFromSource(const PreprocessedProgram& source, const char* programName)
+{
+    switch (source.stage)
+    {
+        case GL_VERTEX_SHADER:   return CreateSeparableProgramFromSource(GL_VERTEX_SHADER, source.vertexSource.c_str(), programName);
+        case GL_FRAGMENT_SHADER: return CreateSeparableProgramFromSource(GL_FRAGMENT_SHADER, source.fragmentSource.c_str(), programName);
+        default:                 return CreateProgramFromSource(source.vertexSource.c_str(), source.fragmentSource.c_str(), programName);
+    }
+}
+
+GLuint CreateCachedProgram(const ProgramCache& cache, const PreprocessedProgram& source, const char* programName, ProgramCacheCounters& counters)
+{
+    if (!cache.enabled)
+        return CreateProgramFromSource(source, programName);
+
+    const std::string path = GetProgramBinaryPath(GetProgramKey(cache, source));
+
+    GLuint programHandle = LoadProgramBinary(path, source.stage != 0);
+    if (programHandle)
+    {
+        counters.hits++;
+        return programHandle;
+    }
+
+    // Missing, or rejected after a driver change the key didn't catch
+    if (GetFileLastWriteTimestamp(path.c_str()) != 0)
+        counters.rejected++;
+
+    programHandle = CreateProgramFromSource(source, programName);
+    counters.compiled++;
+
+    GLint success = GL_FALSE;
+    glGetProgramiv(programHandle, GL_LINK_STATUS, &success);
+    if (success)
+        StoreProgramBinary(path, programHandle);
+
+    return programHandle;
+}
+
+GLuint CreateCachedProgram(App* app, const PreprocessedProgram& source, const char* programName)
+{
+    ProgramCacheCounters counters = {};
+    GLuint programHandle = CreateCachedProgram(app->programCache, source, programName, counters);
+    AddProgramCacheCounters(app, counters);
+    return programHandle;
+}
+
+void AddProgramCacheCounters(App* app, const ProgramCacheCounters& counters)
+{
+    app->programCache.hits += counters.hits;
+    app->programCache.compiled += counters.compiled;
+    app->programCache.rejected += counters.rejected;
+}
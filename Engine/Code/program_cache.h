@@ -0,0 +1,32 @@
+//
+// program_cache.h: Disk cache of linked program binaries. Entries are keyed by
+// a hash of the exact source handed to the driver and of the driver itself,
+// so shader edits and driver updates just miss the cache.
+//
+
+#pragma once
+
+#include "engine.h"
+#include "shader_preprocessor.h"
+
+// Needs app->oGlI, call once the GL context is up
+void InitProgramCache(App* app);
+
+struct ProgramCacheCounters
+{
+    u32 hits;
+    u32 compiled;
+    u32 rejected;
+};
+
+// Loads the program binary from the cache, or compiles the program from
+// source (as CreateProgramFromSource(), or CreateSeparableProgramFromSource()
+// for a single stage) and stores its binary. Binaries the
+// driver rejects are compiled again and replaced.
+GLuint CreateCachedProgram(App* app, const PreprocessedProgram& source, const char* programName);
+
+// Same without touching the App, for threads holding the shared GL context.
+// The outcome is counted in counters, add them to app->programCache later.
+GLuint CreateCachedProgram(const ProgramCache& cache, const PreprocessedProgram& source, const char* programName, ProgramCacheCounters& counters);
+
+void AddProgramCacheCounters(App* app, const ProgramCacheCounters& counters);
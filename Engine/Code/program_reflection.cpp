@@ -0,0 +1,230 @@
+//
+// program_reflection.cpp: Reflection through the program interface queries.
+//
+
+#include "program_reflection.h"
+#include <algorithm>
+
+static void ReflectVertexInputs(Program& program)
+{
+    program.vertexInputLayout.attributes.clear();
+
+    GLint attributeCount;
+    glGetProgramiv(program.handle, GL_ACTIVE_ATTRIBUTES, &attributeCount);
+
+    GLchar attributeName[128];
+    GLsizei attributeNameLength;
+    GLint attributeSize;
+    GLenum attributeType;
+
+    for (int i = 0; i < attributeCount; ++i)
+    {
+        glGetActiveAttrib(program.handle, i, 128,
+            &attributeNameLength,
+            &attributeSize,
+            &attributeType,
+            attributeName);
+
+        u8 attribute= glGetAttribLocation(program.handle, attributeName);
+
+        program.vertexInputLayout.attributes.push_back({ attribute, u8(attributeSize) });
+    }
+}
+
+static u32 HashResourceName(const GLchar* name, GLsizei length)
+{
+    if (length >= 3 && strcmp(name + length - 3, "[0]") == 0)
+        length -= 3;
+    return HashShaderName(name, (u32)length);
+}
+
+static void ReflectUniforms(Program& program)
+{
+    std::vector<ProgramUniform>& uniforms = program.reflection.uniforms;
+    uniforms.clear();
+
+    GLint uniformCount = 0;
+    glGetProgramInterfaceiv(program.handle, GL_UNIFORM, GL_ACTIVE_RESOURCES, &uniformCount);
+
+    const GLenum properties[] = { GL_BLOCK_INDEX, GL_LOCATION, GL_TYPE, GL_ARRAY_SIZE };
+    GLint values[ARRAY_COUNT(properties)];
+    GLchar name[128];
+    GLsizei nameLength;
+
+    for (GLint i = 0; i < uniformCount; ++i)
+    {
+        glGetProgramResourceiv(program.handle, GL_UNIFORM, i, ARRAY_COUNT(properties), properties, ARRAY_COUNT(values), NULL, values);
+
+        // Block members are set through their buffer
+        if (values[0] != -1)
+            continue;
+
+        glGetProgramResourceName(program.handle, GL_UNIFORM, i, sizeof(name), &nameLength, name);
+        uniforms.push_back({ HashResourceName(name, nameLength), values[1], (GLenum)values[2], (u32)values[3] });
+    }
+
+    std::sort(uniforms.begin(), uniforms.end(), [](const ProgramUniform& a, const ProgramUniform& b) { return a.nameHash < b.nameHash; });
+}
+
+static void ReflectBlocks(Program& program, GLenum interface, GLenum memberInterface, bool storage)
+{
+    GLint blockCount = 0;
+    glGetProgramInterfaceiv(program.handle, interface, GL_ACTIVE_RESOURCES, &blockCount);
+
+    const GLenum properties[] = { GL_BUFFER_BINDING, GL_BUFFER_DATA_SIZE, GL_NUM_ACTIVE_VARIABLES };
+    GLint values[ARRAY_COUNT(properties)];
+    const GLenum memberProperties[] = { GL_OFFSET, GL_TYPE, GL_ARRAY_SIZE, GL_ARRAY_STRIDE };
+    GLint memberValues[ARRAY_COUNT(memberProperties)];
+    GLchar name[128];
+    GLsizei nameLength;
+    GLchar memberName[128];
+    GLsizei memberNameLength;
+
+    for (GLint i = 0; i < blockCount; ++i)
+    {
+        glGetProgramResourceiv(program.handle, interface, i, ARRAY_COUNT(properties), properties, ARRAY_COUNT(values), NULL, values);
+        glGetProgramResourceName(program.handle, interface, i, sizeof(name), &nameLength, name);
+
+        ProgramBlock block = { HashResourceName(name, nameLength), (GLuint)i, values[0], (u32)values[1], storage };
+        block.firstMember = program.reflection.blockMembers.size();
+        block.memberCount = values[2];
+
+        std::vector<GLint> memberIndices(values[2]);
+        const GLenum activeVariables = GL_ACTIVE_VARIABLES;
+        if (!memberIndices.empty())
+            glGetProgramResourceiv(program.handle, interface, i, 1, &activeVariables, memberIndices.size(), NULL, memberIndices.data());
+
+        for (GLint memberIndex : memberIndices)
+        {
+            glGetProgramResourceiv(program.handle, memberInterface, memberIndex, ARRAY_COUNT(memberProperties), memberProperties, ARRAY_COUNT(memberValues), NULL, memberValues);
+            glGetProgramResourceName(program.handle, memberInterface, memberIndex, sizeof(memberName), &memberNameLength, memberName);
+
+            // Blocks with an instance name prefix their members with the block name
+            const GLchar* memberBegin = memberName;
+            if (memberNameLength > nameLength && strncmp(memberName, name, nameLength) == 0 && memberName[nameLength] == '.')
+                memberBegin += nameLength + 1;
+
+            const u32 arraySize = memberValues[2] > 1 || memberValues[3] > 0 ? (u32)memberValues[2] : 0;
+            program.reflection.blockMembers.push_back({ HashResourceName(memberBegin, memberNameLength - (GLsizei)(memberBegin - memberName)),
+                                                        (u32)memberValues[0], (GLenum)memberValues[1], arraySize, arraySize ? (u32)memberValues[3] : 0 });
+        }
+
+        std::sort(program.reflection.blockMembers.begin() + block.firstMember, program.reflection.blockMembers.end(),
+                  [](const ProgramBlockMember& a, const ProgramBlockMember& b) { return a.offset < b.offset; });
+        program.reflection.blocks.push_back(block);
+    }
+}
+
+void ReflectProgram(Program& program)
+{
+    ReflectVertexInputs(program);
+    ReflectUniforms(program);
+
+    program.reflection.blocks.clear();
+    program.reflection.blockMembers.clear();
+    ReflectBlocks(program, GL_UNIFORM_BLOCK, GL_UNIFORM, false);
+    ReflectBlocks(program, GL_SHADER_STORAGE_BLOCK, GL_BUFFER_VARIABLE, true);
+    std::sort(program.reflection.blocks.begin(), program.reflection.blocks.end(),
+              [](const ProgramBlock& a, const ProgramBlock& b) { return a.nameHash < b.nameHash; });
+
+    // Two names hashing the same would shadow each other
+    for (u32 i = 1; i < program.reflection.uniforms.size(); ++i)
+        if (program.reflection.uniforms[i].nameHash == program.reflection.uniforms[i - 1].nameHash)
+            ELOG("Program %s has two uniforms with the same name hash", program.programName.c_str());
+}
+
+const ProgramUniform* FindUniform(const Program& program, u32 nameHash)
+{
+    const std::vector<ProgramUniform>& uniforms = program.reflection.uniforms;
+    auto it = std::lower_bound(uniforms.begin(), uniforms.end(), nameHash,
+                               [](const ProgramUniform& uniform, u32 hash) { return uniform.nameHash < hash; });
+    return it != uniforms.end() && it->nameHash == nameHash ? &*it : nullptr;
+}
+
+const ProgramBlock* FindBlock(const Program& program, u32 nameHash)
+{
+    const std::vector<ProgramBlock>& blocks = program.reflection.blocks;
+    auto it = std::lower_bound(blocks.begin(), blocks.end(), nameHash,
+                               [](const ProgramBlock& block, u32 hash) { return block.nameHash < hash; });
+    return it != blocks.end() && it->nameHash == nameHash ? &*it : nullptr;
+}
+
+void SetUniform(const Program& program, u32 nameHash, i32 value)
+{
+    if (const ProgramUniform* uniform = FindUniform(program, nameHash))
+        glProgramUniform1i(program.handle, uniform->location, value);
+}
+
+void SetUniform(const Program& program, u32 nameHash, f32 value)
+{
+    if (const ProgramUniform* uniform = FindUniform(program, nameHash))
+        glProgramUniform1f(program.handle, uniform->location, value);
+}
+
+void SetUniform(const Program& program, u32 nameHash, const vec2& value)
+{
+    if (const ProgramUniform* uniform = FindUniform(program, nameHash))
+        glProgramUniform2fv(program.handle, uniform->location, 1, glm::value_ptr(value));
+}
+
+void SetUniform(const Program& program, u32 nameHash, const vec3& value)
+{
+    if (const ProgramUniform* uniform = FindUniform(program, nameHash))
+        glProgramUniform3fv(program.handle, uniform->location, 1, glm::value_ptr(value));
+}
+
+void SetUniform(const Program& program, u32 nameHash, const vec4& value)
+{
+    if (const ProgramUniform* uniform = FindUniform(program, nameHash))
+        glProgramUniform4fv(program.handle, uniform->location, 1, glm::value_ptr(value));
+}
+
+void SetUniform(const Program& program, u32 nameHash, const glm::mat4& value)
+{
+    if (const ProgramUniform* uniform = FindUniform(program, nameHash))
+        glProgramUniformMatrix4fv(program.handle, uniform->location, 1, GL_FALSE, glm::value_ptr(value));
+}
+
+bool ValidateUniformBlock(const Program& program, const UniformBlockInfo& info)
+{
+    const ProgramBlock* block = FindBlock(program, HashShaderName(info.name));
+    if (!block)
+        return true;
+
+    bool valid = true;
+    if (block->memberCount != info.memberCount)
+    {
+        ELOG("Block %s of program %s has %u members, the C++ struct %u", info.name, program.programName.c_str(), block->memberCount, info.memberCount);
+        valid = false;
+    }
+    if (info.size < block->dataSize)
+    {
+        ELOG("Block %s of program %s takes %u bytes, the C++ struct only %u", info.name, program.programName.c_str(), block->dataSize, info.size);
+        valid = false;
+    }
+
+    for (u32 i = 0; i < info.memberCount; ++i)
+    {
+        const UniformBlockMember& expected = info.members[i];
+        const u32 nameHash = HashShaderName(expected.name);
+
+        const ProgramBlockMember* member = nullptr;
+        for (u32 j = 0; j < block->memberCount; ++j)
+            if (program.reflection.blockMembers[block->firstMember + j].nameHash == nameHash)
+                member = &program.reflection.blockMembers[block->firstMember + j];
+
+        if (!member)
+        {
+            ELOG("Block %s of program %s has no member %s", info.name, program.programName.c_str(), expected.name);
+            valid = false;
+        }
+        else if (member->type != expected.type || member->offset != expected.offset || member->arraySize != expected.arraySize ||
+                 (member->arraySize > 0 && member->arrayStride != expected.elementSize))
+        {
+            ELOG("Member %s of block %s in program %s is at offset %u (stride %u), the C++ struct has it at %u (stride %u) or with another type",
+                 expected.name, info.name, program.programName.c_str(), member->offset, member->arrayStride, expected.offset, expected.elementSize);
+            valid = false;
+        }
+    }
+    return valid;
+}
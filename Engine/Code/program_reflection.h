@@ -0,0 +1,62 @@
+//
+// program_reflection.h: Uniforms and blocks of a linked program, looked up by
+// name hash. Render code hashes names at compile time with ShaderId(), so
+// setting a parameter is a search in a small sorted table, without strings.
+// The table is rebuilt with the program on hot reload, locations never go stale.
+//
+
+#pragma once
+
+#include "engine.h"
+
+// FNV-1a. Array uniforms are reflected without their "[0]" suffix.
+constexpr u32 HashShaderName(const char* name, u32 length)
+{
+    u32 hash = 2166136261u;
+    for (u32 i = 0; i < length; ++i)
+    {
+        hash ^= (u8)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+constexpr u32 HashShaderName(const char* name)
+{
+    u32 length = 0;
+    while (name[length])
+        length++;
+    return HashShaderName(name, length);
+}
+
+consteval u32 ShaderId(const char* name)
+{
+    return HashShaderName(name);
+}
+
+// Reflects the vertex inputs, uniforms, uniform blocks and storage blocks
+void ReflectProgram(Program& program);
+
+// nullptr if the program doesn't have it (another variant, optimized out...)
+const ProgramUniform* FindUniform(const Program& program, u32 nameHash);
+
+const ProgramBlock* FindBlock(const Program& program, u32 nameHash);
+
+// Set through glProgramUniform, the program doesn't need to be bound.
+// Uniforms the program doesn't have are ignored.
+void SetUniform(const Program& program, u32 nameHash, i32 value);
+void SetUniform(const Program& program, u32 nameHash, f32 value);
+void SetUniform(const Program& program, u32 nameHash, const vec2& value);
+void SetUniform(const Program& program, u32 nameHash, const vec3& value);
+void SetUniform(const Program& program, u32 nameHash, const vec4& value);
+void SetUniform(const Program& program, u32 nameHash, const glm::mat4& value);
+
+// Checks a C++ mirror of a block (see uniform_layout.h) against the offsets
+// the driver gave. Programs without the block pass.
+bool ValidateUniformBlock(const Program& program, const UniformBlockInfo& info);
+
+template <typename T>
+bool ValidateUniformBlock(const Program& program)
+{
+    return ValidateUniformBlock(program, GetUniformBlockInfo<T>());
+}
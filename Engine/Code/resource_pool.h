@@ -0,0 +1,143 @@
+//
+// resource_pool.h: Slot map storage for the engine resources, addressed by
+// generational handles.
+//
+
+#pragma once
+
+#include "platform.h"
+
+// A handle packs the slot index in its low bits and the generation of the slot
+// in the high bits. Removing a resource bumps the generation of its slot, so
+// old handles are detected as stale even after the slot gets reused.
+// Generations never reach the all-ones value, so UINT32_MAX is never a valid
+// handle and keeps meaning "no resource".
+#define RESOURCE_HANDLE_INDEX_BITS     20
+#define RESOURCE_HANDLE_INDEX_MASK     ((1u << RESOURCE_HANDLE_INDEX_BITS) - 1u)
+#define RESOURCE_HANDLE_MAX_GENERATION ((1u << (32 - RESOURCE_HANDLE_INDEX_BITS)) - 2u)
+
+inline u32 GetHandleIndex(u32 handle)      { return handle & RESOURCE_HANDLE_INDEX_MASK; }
+inline u32 GetHandleGeneration(u32 handle) { return handle >> RESOURCE_HANDLE_INDEX_BITS; }
+inline u32 MakeHandle(u32 index, u32 generation) { return index | (generation << RESOURCE_HANDLE_INDEX_BITS); }
+
+template <typename T>
+struct ResourcePool
+{
+    struct Slot
+    {
+        T    value;
+        u32  generation;
+        u32  refCount;
+        bool alive;
+    };
+
+    std::vector<Slot> slots;
+    std::vector<u32>  freeSlots;
+    u32               liveCount = 0;
+
+    // The new resource starts with a single reference, owned by the caller
+    u32 Add(T value)
+    {
+        u32 index;
+        if (!freeSlots.empty())
+        {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else
+        {
+            ASSERT(slots.size() < RESOURCE_HANDLE_INDEX_MASK, "Too many resources of the same type");
+            index = (u32)slots.size();
+            slots.push_back(Slot{ T{}, 1, 0, false });
+        }
+
+        Slot& slot = slots[index];
+        slot.value = std::move(value);
+        slot.refCount = 1;
+        slot.alive = true;
+        liveCount++;
+        return MakeHandle(index, slot.generation);
+    }
+
+    bool IsValid(u32 handle) const
+    {
+        const u32 index = GetHandleIndex(handle);
+        return handle != UINT32_MAX && index < slots.size() &&
+               slots[index].alive && slots[index].generation == GetHandleGeneration(handle);
+    }
+
+    // Returns nullptr for stale handles
+    T* Get(u32 handle)
+    {
+        return IsValid(handle) ? &slots[GetHandleIndex(handle)].value : nullptr;
+    }
+
+    T& operator[](u32 handle)
+    {
+        ASSERT(IsValid(handle), "Stale or invalid resource handle");
+        return slots[GetHandleIndex(handle)].value;
+    }
+
+    const T& operator[](u32 handle) const
+    {
+        ASSERT(IsValid(handle), "Stale or invalid resource handle");
+        return slots[GetHandleIndex(handle)].value;
+    }
+
+    void AddRef(u32 handle)
+    {
+        ASSERT(IsValid(handle), "Stale or invalid resource handle");
+        slots[GetHandleIndex(handle)].refCount++;
+    }
+
+    // Returns true when the last reference is dropped. The resource stays
+    // accessible so the caller can free what it owns before calling Remove().
+    bool Release(u32 handle)
+    {
+        ASSERT(IsValid(handle), "Stale or invalid resource handle");
+        Slot& slot = slots[GetHandleIndex(handle)];
+        ASSERT(slot.refCount > 0, "Resource released more times than referenced");
+        return --slot.refCount == 0;
+    }
+
+    // Frees the slot and the CPU data of the resource, invalidating its handles
+    void Remove(u32 handle)
+    {
+        ASSERT(IsValid(handle), "Stale or invalid resource handle");
+        const u32 index = GetHandleIndex(handle);
+        Slot& slot = slots[index];
+        slot.value = T{};
+        slot.refCount = 0;
+        slot.alive = false;
+        slot.generation = slot.generation == RESOURCE_HANDLE_MAX_GENERATION ? 1 : slot.generation + 1;
+        freeSlots.push_back(index);
+        liveCount--;
+    }
+
+    u32 GetRefCount(u32 handle) const
+    {
+        return IsValid(handle) ? slots[GetHandleIndex(handle)].refCount : 0;
+    }
+
+    u32 Count() const     { return liveCount; }
+    u32 SlotCount() const { return (u32)slots.size(); }
+
+    // Slot-wise access, to walk all the handles in use
+    bool IsSlotAlive(u32 index) const { return slots[index].alive; }
+    u32  HandleAt(u32 index) const    { return MakeHandle(index, slots[index].generation); }
+
+    // Range-for over the live resources
+    struct Iterator
+    {
+        ResourcePool* pool;
+        u32           index;
+
+        T& operator*() const { return pool->slots[index].value; }
+        Iterator& operator++() { ++index; SkipFreeSlots(); return *this; }
+        bool operator!=(const Iterator& other) const { return index != other.index; }
+        void SkipFreeSlots() { while (index < pool->slots.size() && !pool->slots[index].alive) ++index; }
+    };
+
+    Iterator begin() { Iterator it = { this, 0 }; it.SkipFreeSlots(); return it; }
+    Iterator end()   { return Iterator{ this, (u32)slots.size() }; }
+};
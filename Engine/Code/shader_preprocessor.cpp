@@ -0,0 +1,497 @@
+//
+// shader_preprocessor.cpp: Conditional evaluation and include expansion.
+//
+// Conditions are evaluated with three values: known true, known false and
+// unknown (macro values, defines made inside unknown blocks...). Known blocks
+// are resolved here; unknown ones are passed through for the driver to decide.
+// Removed lines are dropped and a #line directive resyncs the numbers where
+// the output resumes, so edits to stripped code don't change the output.
+//
+
+#include "shader_preprocessor.h"
+#include <unordered_map>
+#include <unordered_set>
+
+const char* ShaderFeatureDefines[ShaderFeature_Count] = { "USE_VIRTUAL_TEXTURE" };
+
+#define SHADER_VERSION_STRING "#version 430\n"
+#define SHADER_MAX_INCLUDE_DEPTH 16
+
+enum Condition
+{
+    Condition_False,
+    Condition_True,
+    Condition_Unknown,
+};
+
+struct ConditionalBlock
+{
+    bool passThrough;  // Unknown condition: its directives go to the driver and every branch is kept
+    bool active;       // Lines of the current branch are kept
+    bool branchTaken;  // Some branch was already kept, the rest are dropped
+    bool parentActive;
+};
+
+struct Preprocessor
+{
+    std::unordered_map<std::string, std::string> fileCache; // Shared by both stages
+    std::vector<std::string>* files;
+    std::vector<std::string> includeStack;
+
+    std::unordered_set<std::string> defined;
+    std::unordered_set<std::string> unknown; // Defined or undefined inside pass-through blocks
+
+    std::vector<ConditionalBlock> blocks;
+    std::string* output;
+};
+
+static bool ReadShaderFile(Preprocessor& pp, const std::string& filepath, const std::string** text)
+{
+    auto it = pp.fileCache.find(filepath);
+    if (it == pp.fileCache.end())
+    {
+        FILE* file = fopen(filepath.c_str(), "rb");
+        if (!file)
+        {
+            ELOG("fopen() failed reading shader file %s", filepath.c_str());
+            return false;
+        }
+        std::string contents;
+        fseek(file, 0, SEEK_END);
+        contents.resize(ftell(file));
+        fseek(file, 0, SEEK_SET);
+        fread(&contents[0], 1, contents.size(), file);
+        fclose(file);
+        it = pp.fileCache.emplace(filepath, std::move(contents)).first;
+    }
+    *text = &it->second;
+    return true;
+}
+
+static u32 GetFileIndex(Preprocessor& pp, const std::string& filepath)
+{
+    for (u32 i = 0; i < pp.files->size(); ++i)
+        if ((*pp.files)[i] == filepath)
+            return i;
+    pp.files->push_back(filepath);
+    return pp.files->size() - 1;
+}
+
+static bool IsActive(const Preprocessor& pp)
+{
+    return pp.blocks.empty() || pp.blocks.back().active;
+}
+
+// Whether the current line may not be compiled, so defines made here are unknown
+static bool IsInsidePassThrough(const Preprocessor& pp)
+{
+    for (const ConditionalBlock& block : pp.blocks)
+        if (block.passThrough)
+            return true;
+    return false;
+}
+
+static bool IsIdentifierChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+static void SkipSpaces(const char*& c)
+{
+    while (*c == ' ' || *c == '\t')
+        c++;
+}
+
+static std::string ReadIdentifier(const char*& c)
+{
+    SkipSpaces(c);
+    const char* begin = c;
+    while (IsIdentifierChar(*c))
+        c++;
+    return std::string(begin, c);
+}
+
+static Condition IsDefined(const Preprocessor& pp, const std::string& name)
+{
+    if (pp.unknown.count(name))
+        return Condition_Unknown;
+    return pp.defined.count(name) ? Condition_True : Condition_False;
+}
+
+static Condition EvaluateOr(const Preprocessor& pp, const char*& c);
+
+// Primary: defined(NAME), defined NAME, !primary, (expression) or a number
+static Condition EvaluatePrimary(const Preprocessor& pp, const char*& c)
+{
+    SkipSpaces(c);
+    if (*c == '!')
+    {
+        c++;
+        Condition value = EvaluatePrimary(pp, c);
+        return value == Condition_Unknown ? value : (value == Condition_True ? Condition_False : Condition_True);
+    }
+    if (*c == '(')
+    {
+        c++;
+        Condition value = EvaluateOr(pp, c);
+        SkipSpaces(c);
+        if (*c != ')')
+            return Condition_Unknown;
+        c++;
+        return value;
+    }
+    if (*c >= '0' && *c <= '9')
+    {
+        const char* begin = c;
+        while (IsIdentifierChar(*c))
+            c++;
+        return std::string(begin, c) == "0" ? Condition_False : (std::string(begin, c) == "1" ? Condition_True : Condition_Unknown);
+    }
+
+    std::string word = ReadIdentifier(c);
+    if (word != "defined")
+        return Condition_Unknown; // Macro values are left to the driver
+
+    SkipSpaces(c);
+    const bool parenthesis = *c == '(';
+    if (parenthesis)
+        c++;
+    Condition value = IsDefined(pp, ReadIdentifier(c));
+    SkipSpaces(c);
+    if (parenthesis)
+    {
+        if (*c != ')')
+            return Condition_Unknown;
+        c++;
+    }
+    return value;
+}
+
+static Condition EvaluateAnd(const Preprocessor& pp, const char*& c)
+{
+    Condition value = EvaluatePrimary(pp, c);
+    SkipSpaces(c);
+    while (c[0] == '&' && c[1] == '&')
+    {
+        c += 2;
+        Condition rhs = EvaluatePrimary(pp, c);
+        if (value == Condition_False || rhs == Condition_False)
+            value = Condition_False;
+        else if (value == Condition_Unknown || rhs == Condition_Unknown)
+            value = Condition_Unknown;
+        SkipSpaces(c);
+    }
+    return value;
+}
+
+static Condition EvaluateOr(const Preprocessor& pp, const char*& c)
+{
+    Condition value = EvaluateAnd(pp, c);
+    SkipSpaces(c);
+    while (c[0] == '|' && c[1] == '|')
+    {
+        c += 2;
+        Condition rhs = EvaluateAnd(pp, c);
+        if (value == Condition_True || rhs == Condition_True)
+            value = Condition_True;
+        else if (value == Condition_Unknown || rhs == Condition_Unknown)
+            value = Condition_Unknown;
+        SkipSpaces(c);
+    }
+    return value;
+}
+
+static Condition EvaluateCondition(const Preprocessor& pp, const char* expression)
+{
+    const char* c = expression;
+    Condition value = EvaluateOr(pp, c);
+    SkipSpaces(c);
+    // Anything left (comparisons, arithmetic...) can't be evaluated here
+    if (*c != '\0' && *c != '\r' && *c != '\n' && *c != '/')
+        return Condition_Unknown;
+    return value;
+}
+
+static void PushBlock(Preprocessor& pp, Condition condition, const std::string& line)
+{
+    ConditionalBlock block = {};
+    block.parentActive = IsActive(pp);
+    if (!block.parentActive)
+    {
+        block.branchTaken = true;
+    }
+    else if (condition == Condition_Unknown)
+    {
+        block.passThrough = true;
+        block.active = true;
+        *pp.output += line;
+    }
+    else
+    {
+        block.active = condition == Condition_True;
+        block.branchTaken = block.active;
+    }
+    pp.blocks.push_back(block);
+}
+
+static bool PreprocessFile(Preprocessor& pp, const std::string& filepath);
+
+// Returns false on errors that make the program unusable
+static bool PreprocessDirective(Preprocessor& pp, const std::string& filepath, const std::string& line, u32 lineNumber)
+{
+    const char* c = line.c_str();
+    SkipSpaces(c);
+    c++; // '#'
+    const std::string directive = ReadIdentifier(c);
+    SkipSpaces(c);
+
+    if (directive == "ifdef" || directive == "ifndef")
+    {
+        Condition value = IsDefined(pp, ReadIdentifier(c));
+        if (directive == "ifndef" && value != Condition_Unknown)
+            value = value == Condition_True ? Condition_False : Condition_True;
+        PushBlock(pp, value, line);
+        return true;
+    }
+    if (directive == "if")
+    {
+        PushBlock(pp, EvaluateCondition(pp, c), line);
+        return true;
+    }
+
+    if (directive == "elif" || directive == "else" || directive == "endif")
+    {
+        if (pp.blocks.empty())
+        {
+            ELOG("%s:%u: #%s without #if", filepath.c_str(), lineNumber, directive.c_str());
+            return false;
+        }
+        ConditionalBlock& block = pp.blocks.back();
+
+        if (directive == "endif")
+        {
+            if (block.passThrough)
+                *pp.output += line;
+            pp.blocks.pop_back();
+        }
+        else if (block.passThrough)
+        {
+            *pp.output += line;
+        }
+        else if (directive == "else")
+        {
+            block.active = block.parentActive && !block.branchTaken;
+            block.branchTaken = true;
+        }
+        else if (block.branchTaken)
+        {
+            block.active = false;
+        }
+        else
+        {
+            Condition value = EvaluateCondition(pp, c);
+            if (value == Condition_Unknown)
+            {
+                // The branches before were all false and are gone, so the
+                // rest of the chain starts here for the driver
+                block.passThrough = true;
+                block.active = true;
+                *pp.output += "#if " + std::string(c);
+            }
+            else
+            {
+                block.active = value == Condition_True;
+                block.branchTaken = block.active;
+            }
+        }
+        return true;
+    }
+
+    if (!IsActive(pp))
+        return true;
+
+    if (directive == "include")
+    {
+        const char* begin = strchr(c, '"');
+        const char* end = begin ? strchr(begin + 1, '"') : nullptr;
+        if (!end)
+        {
+            ELOG("%s:%u: malformed #include", filepath.c_str(), lineNumber);
+            return false;
+        }
+
+        // Relative to the including file
+        const size_t slash = filepath.find_last_of("/\\");
+        const std::string directory = slash == std::string::npos ? "" : filepath.substr(0, slash + 1);
+        const std::string includePath = directory + std::string(begin + 1, end);
+
+        *pp.output += "#line 1 " + std::to_string(GetFileIndex(pp, includePath)) + "\n";
+        if (!PreprocessFile(pp, includePath))
+            return false;
+        *pp.output += "#line " + std::to_string(lineNumber + 1) + " " + std::to_string(GetFileIndex(pp, filepath)) + "\n";
+        return true;
+    }
+
+    // Every stage gets its version first
+    if (directive == "version")
+        return true;
+
+    if (directive == "define" || directive == "undef")
+    {
+        const std::string name = ReadIdentifier(c);
+        if (IsInsidePassThrough(pp))
+            pp.unknown.insert(name);
+        else if (directive == "define")
+            pp.defined.insert(name);
+        else
+            pp.defined.erase(name);
+    }
+
+    *pp.output += line;
+    return true;
+}
+
+static bool PreprocessFile(Preprocessor& pp, const std::string& filepath)
+{
+    for (const std::string& including : pp.includeStack)
+    {
+        if (including == filepath)
+        {
+            ELOG("Shader file %s includes itself", filepath.c_str());
+            return false;
+        }
+    }
+    if (pp.includeStack.size() >= SHADER_MAX_INCLUDE_DEPTH)
+    {
+        ELOG("Shader includes nested too deep at %s", filepath.c_str());
+        return false;
+    }
+
+    const std::string* text;
+    if (!ReadShaderFile(pp, filepath, &text))
+        return false;
+
+    pp.includeStack.push_back(filepath);
+    const size_t blockDepth = pp.blocks.size();
+
+    bool ok = true;
+    bool lineSynced = true; // Output line numbers match the file
+    u32 lineNumber = 1;
+    for (size_t lineBegin = 0; ok && lineBegin < text->size(); ++lineNumber)
+    {
+        size_t lineEnd = text->find('\n', lineBegin);
+        lineEnd = lineEnd == std::string::npos ? text->size() : lineEnd + 1;
+        const std::string line = text->substr(lineBegin, lineEnd - lineBegin);
+        lineBegin = lineEnd;
+
+        const std::string lineDirective = "#line " + std::to_string(lineNumber) + " " + std::to_string(GetFileIndex(pp, filepath)) + "\n";
+        const size_t outputSize = pp.output->size();
+
+        const char* c = line.c_str();
+        SkipSpaces(c);
+        if (*c == '#')
+            ok = PreprocessDirective(pp, filepath, line.back() == '\n' ? line : line + "\n", lineNumber);
+        else if (IsActive(pp))
+            *pp.output += line.back() == '\n' ? line : line + "\n";
+
+        if (pp.output->size() == outputSize)
+        {
+            lineSynced = false;
+        }
+        else if (!lineSynced)
+        {
+            // Includes emit their own
+            if (pp.output->compare(outputSize, 6, "#line ") != 0)
+                pp.output->insert(outputSize, lineDirective);
+            lineSynced = true;
+        }
+    }
+
+    if (ok && pp.blocks.size() != blockDepth)
+    {
+        ELOG("Unterminated #if in shader file %s", filepath.c_str());
+        ok = false;
+    }
+
+    pp.includeStack.pop_back();
+    return ok;
+}
+
+static bool PreprocessStage(Preprocessor& pp, const char* filepath, const char* programName, const char* stageName, u32 variantMask, bool separable, std::string& output)
+{
+    pp.defined.clear();
+    pp.unknown.clear();
+    pp.blocks.clear();
+    pp.output = &output;
+
+    output = SHADER_VERSION_STRING;
+    std::vector<const char*> defines = { programName, stageName };
+    for (u32 i = 0; i < ShaderFeature_Count; ++i)
+        if (variantMask & (1u << i))
+            defines.push_back(ShaderFeatureDefines[i]);
+
+    // The defines stay in the source for the conditions left to the driver
+    for (const char* define : defines)
+    {
+        pp.defined.insert(define);
+        output += "#define " + std::string(define) + "\n";
+    }
+
+    // Separable programs only match built-in outputs with the next stage when
+    // the vertex stage redeclares them
+    if (separable && strcmp(stageName, "VERTEX") == 0)
+        output += "out gl_PerVertex { vec4 gl_Position; float gl_PointSize; };\n";
+    output += "#line 1 0\n";
+
+    return PreprocessFile(pp, filepath);
+}
+
+bool PreprocessProgram(const char* filepath, const char* programName, u32 variantMask, PreprocessedProgram& program, GLenum stage)
+{
+    Preprocessor pp;
+    pp.files = &program.files;
+    program.files.clear();
+    program.files.push_back(filepath);
+    program.stage = stage;
+    program.vertexSource.clear();
+    program.fragmentSource.clear();
+
+    const bool separable = stage != 0;
+    if (stage != GL_FRAGMENT_SHADER && !PreprocessStage(pp, filepath, programName, "VERTEX", variantMask, separable, program.vertexSource))
+        return false;
+    if (stage != GL_VERTEX_SHADER && !PreprocessStage(pp, filepath, programName, "FRAGMENT", variantMask, separable, program.fragmentSource))
+        return false;
+    return true;
+}
+
+u64 GetProgramSourceTimestamp(const std::vector<std::string>& files)
+{
+    u64 timestamp = 0;
+    for (const std::string& file : files)
+        timestamp = glm::max(timestamp, GetFileLastWriteTimestamp(file.c_str()));
+    return timestamp;
+}
+
+// #line directives are left out: lines added or removed above a block shift
+// the numbers of every later resync, without changing the code
+static u64 HashSourceWithoutLineDirectives(const std::string& source, u64 seed)
+{
+    u64 hash = seed;
+    size_t begin = 0;
+    while (begin < source.size())
+    {
+        size_t end = source.find('\n', begin);
+        end = end == std::string::npos ? source.size() : end + 1;
+        if (source.compare(begin, 6, "#line ") != 0)
+            hash = HashBytes(source.data() + begin, end - begin, hash);
+        begin = end;
+    }
+    return hash;
+}
+
+u64 HashPreprocessedProgram(const PreprocessedProgram& program, u64 seed)
+{
+    u64 hash = HashBytes(&program.stage, sizeof(program.stage), seed);
+    hash = HashSourceWithoutLineDirectives(program.vertexSource, hash);
+    return HashSourceWithoutLineDirectives(program.fragmentSource, hash);
+}
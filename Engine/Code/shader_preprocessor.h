@@ -0,0 +1,44 @@
+//
+// shader_preprocessor.h: CPU side GLSL preprocessing. Resolves #include,
+// tracks the files a program depends on and strips the #if blocks whose
+// condition is known from the program name, stage and variant defines, so the
+// driver only compiles what the permutation uses.
+//
+
+#pragma once
+
+#include "engine.h"
+
+// Bit i of a program variant mask defines ShaderFeatureDefines[i]
+enum ShaderFeature
+{
+    ShaderFeature_VirtualTexture = 1 << 0,
+    ShaderFeature_Count          = 1
+};
+
+extern const char* ShaderFeatureDefines[ShaderFeature_Count];
+
+struct PreprocessedProgram
+{
+    GLenum      stage;          // 0 for a linked program, else the only stage of a separable one
+    std::string vertexSource;   // Complete stage sources, #version included
+    std::string fragmentSource; // The one not built stays empty
+
+    // The program file first, then every file it includes. #line directives
+    // use these indices as source string numbers, so compile errors like
+    // "2(14)" point to line 14 of files[2].
+    std::vector<std::string> files;
+};
+
+// Builds both stages of the programName block of the file for the variant, or
+// only stage (GL_VERTEX_SHADER or GL_FRAGMENT_SHADER) for a separable program.
+// It only reads files, so it can run on a worker thread.
+bool PreprocessProgram(const char* filepath, const char* programName, u32 variantMask, PreprocessedProgram& program, GLenum stage = 0);
+
+// Newest write time of the files a program was built from
+u64 GetProgramSourceTimestamp(const std::vector<std::string>& files);
+
+// Hash of the stage sources, #line directives excluded. Edits that don't change
+// the code the driver gets, like another program's block, a comment in a
+// stripped #if or lines added above the program, keep it.
+u64 HashPreprocessedProgram(const PreprocessedProgram& program, u64 seed = 0);
@@ -0,0 +1,124 @@
+//
+// startup.cpp: Startup task scheduler and timing report.
+//
+
+#include "startup.h"
+#include <imgui.h>
+#include <chrono>
+#include <thread>
+
+static std::chrono::steady_clock::time_point GlobalStartupBegin;
+
+static f64 GetStartupMs()
+{
+    return std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - GlobalStartupBegin).count();
+}
+
+void RunStartupTasks(App* app, std::vector<StartupTask>& tasks)
+{
+    GlobalStartupBegin = std::chrono::steady_clock::now();
+
+    StartupReport& report = app->startup;
+    report.tasks.resize(tasks.size());
+    for (u32 i = 0; i < tasks.size(); ++i)
+        report.tasks[i] = StartupTiming{ tasks[i].name, 0.0, 0.0, (bool)tasks[i].runAsync, 0.0 };
+
+    enum TaskState { TaskState_Waiting, TaskState_Running, TaskState_Done };
+    std::vector<TaskState> states(tasks.size(), TaskState_Waiting);
+    std::vector<AssetTask> running(tasks.size());
+    u32 doneCount = 0;
+
+    while (doneCount < tasks.size())
+    {
+        bool progressed = false;
+
+        for (u32 i = 0; i < tasks.size(); ++i)
+        {
+            if (states[i] == TaskState_Waiting)
+            {
+                bool ready = true;
+                for (u32 dependency : tasks[i].dependencies)
+                    ready = ready && states[dependency] == TaskState_Done;
+                if (!ready)
+                    continue;
+
+                report.tasks[i].startMs = GetStartupMs();
+                if (tasks[i].runAsync)
+                {
+                    running[i] = tasks[i].runAsync();
+                    states[i] = TaskState_Running;
+                }
+                else
+                {
+                    tasks[i].run();
+                    states[i] = TaskState_Done;
+                    report.tasks[i].endMs = GetStartupMs();
+                    doneCount++;
+                }
+                progressed = true;
+            }
+
+            if (states[i] == TaskState_Running && running[i].IsDone())
+            {
+                if (tasks[i].result)
+                    *tasks[i].result = running[i].Result();
+                states[i] = TaskState_Done;
+                report.tasks[i].endMs = GetStartupMs();
+                report.tasks[i].mainThreadMs = running[i].state->mainThreadMs;
+                doneCount++;
+                progressed = true;
+            }
+        }
+
+        // GL work of the loads that came back from the workers, in one batch
+        PumpAsyncAssets();
+
+        if (!progressed)
+            std::this_thread::yield();
+    }
+
+    report.initMs = GetStartupMs();
+
+    ILOG("Startup: Init() took %.2f ms", report.initMs);
+    for (const StartupTiming& timing : report.tasks)
+    {
+        // Async tasks still do their GL work, uploads and the like, on the
+        // main thread, and that part holds up every other task
+        if (timing.async)
+        {
+            ILOG("  %-32s %8.2f ms -> %8.2f ms (%.2f ms, async, %.2f ms on the main thread)", timing.name.c_str(),
+                 timing.startMs, timing.endMs, timing.endMs - timing.startMs, timing.mainThreadMs);
+        }
+        else
+        {
+            ILOG("  %-32s %8.2f ms -> %8.2f ms (%.2f ms)", timing.name.c_str(), timing.startMs, timing.endMs,
+                 timing.endMs - timing.startMs);
+        }
+    }
+}
+
+void MarkFirstFrame(App* app)
+{
+    if (app->startup.firstFrameMs > 0.0)
+        return;
+
+    app->startup.firstFrameMs = GetStartupMs();
+    ILOG("Startup: first frame after %.2f ms", app->startup.firstFrameMs);
+}
+
+void StartupGui(App* app)
+{
+    const StartupReport& report = app->startup;
+
+    ImGui::Begin("Startup");
+    ImGui::Text("Init: %.2f ms, first frame: %.2f ms", report.initMs, report.firstFrameMs);
+    ImGui::Separator();
+    for (const StartupTiming& timing : report.tasks)
+    {
+        if (timing.async)
+            ImGui::Text("%-32s %8.2f -> %8.2f ms (async, %.2f ms on the main thread)", timing.name.c_str(), timing.startMs, timing.endMs, timing.mainThreadMs);
+        else
+            ImGui::Text("%-32s %8.2f -> %8.2f ms", timing.name.c_str(), timing.startMs, timing.endMs);
+    }
+    ImGui::End();
+}
@@ -0,0 +1,32 @@
+//
+// startup.h: Runs Init() as a graph of load tasks. Tasks whose dependencies
+// are done start right away, so file reads, decoding and imports of
+// independent assets overlap on the job system while the main thread does the
+// GL work of whatever finished.
+//
+
+#pragma once
+
+#include "engine.h"
+#include "async_assets.h"
+#include <functional>
+
+struct StartupTask
+{
+    const char*                name = "";
+    std::vector<u32>           dependencies; // Indices of tasks that have to finish first
+
+    // Either main thread work...
+    std::function<void()>      run;
+    // ...or a load that hops to the job system, with the handle it produces
+    std::function<AssetTask()> runAsync;
+    u32*                       result = nullptr;
+};
+
+// Blocks until every task has finished, filling app->startup with the timings
+void RunStartupTasks(App* app, std::vector<StartupTask>& tasks);
+
+// Call once the first frame has been rendered
+void MarkFirstFrame(App* app);
+
+void StartupGui(App* app);
@@ -0,0 +1,683 @@
+//
+// texture_processing.cpp: CPU-side image cooking. Textures coming from models go
+// through here so that shaders sample as few maps as possible.
+//
+
+#include "texture_processing.h"
+#include "job_system.h"
+#include "virtual_texture.h"
+#include "async_assets.h"
+#include "pipeline_warmup.h"
+#include <emmintrin.h>
+
+// Normalized value of channel c of the pixel starting at the given address
+static f32 ReadChannel(const Image& image, const u8* pixel, i32 c)
+{
+    switch (image.pixelType)
+    {
+        case PixelType_U16: return ((const u16*)pixel)[c] / 65535.0f;
+        case PixelType_F32: return ((const f32*)pixel)[c];
+        default:            return pixel[c] / 255.0f;
+    }
+}
+
+bool IsUniformImage(const Image& image, vec4* color)
+{
+    const u8* pixels = (const u8*)image.pixels;
+    const u32 pixelSize = GetPixelSize(image);
+
+    for (i32 y = 0; y < image.size.y; ++y)
+    {
+        const u8* row = pixels + (size_t)y * image.stride;
+        for (i32 x = 0; x < image.size.x; ++x)
+            if (memcmp(row + x * pixelSize, pixels, pixelSize) != 0)
+                return false;
+    }
+
+    vec4 value = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+    for (i32 c = 0; c < image.nchannels && c < 4; ++c)
+        value[c] = ReadChannel(image, pixels, c);
+
+    // Grayscale images replicate their value in the color channels
+    if (image.nchannels <= 2)
+    {
+        if (image.nchannels == 2) value.a = value.g;
+        value.g = value.b = value.r;
+    }
+
+    *color = value;
+    return true;
+}
+
+f32 SampleGrayscale(const Image& image, i32 x, i32 y)
+{
+    const u8* pixel = (const u8*)image.pixels + (size_t)y * image.stride + x * GetPixelSize(image);
+    f32 value = ReadChannel(image, pixel, 0);
+    if (image.nchannels >= 3)
+        value = (value + ReadChannel(image, pixel, 1) + ReadChannel(image, pixel, 2)) / 3.0f;
+    return value;
+}
+
+Image PackGrayscaleChannels(const Image* sources[4], vec4 constants)
+{
+    ivec2 size = ivec2(1, 1);
+    for (u32 c = 0; c < 4; ++c)
+        if (sources[c])
+            size = glm::max(size, sources[c]->size);
+
+    Image packed = {};
+    packed.size = size;
+    packed.nchannels = 4;
+    packed.stride = size.x * 4;
+    // malloc'd like stb_image does, so FreeImage() can release it
+    packed.pixels = malloc((size_t)packed.stride * size.y);
+
+    u8* dst = (u8*)packed.pixels;
+    for (u32 c = 0; c < 4; ++c)
+    {
+        const Image* src = sources[c];
+        if (!src)
+        {
+            const u8 value = (u8)(glm::clamp(constants[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+            for (i32 i = 0; i < size.x * size.y; ++i)
+                dst[i * 4 + c] = value;
+            continue;
+        }
+
+        // Nearest sampling when the sources don't share a resolution
+        for (i32 y = 0; y < size.y; ++y)
+        {
+            const i32 sy = y * src->size.y / size.y;
+            for (i32 x = 0; x < size.x; ++x)
+            {
+                const i32 sx = x * src->size.x / size.x;
+                dst[(y * size.x + x) * 4 + c] = (u8)(glm::clamp(SampleGrayscale(*src, sx, sy), 0.0f, 1.0f) * 255.0f + 0.5f);
+            }
+        }
+    }
+
+    return packed;
+}
+
+// Converts row y of the height map (wrapping) into floats, in [0, 1] except for
+// HDR maps, with one extra texel on each side so the Sobel kernel never has to
+// clamp. 16-bit and HDR heights keep their precision.
+static void LoadHeightRow(const Image& height, i32 y, f32* row)
+{
+    const i32 width = height.size.x;
+    y = (y + height.size.y) % height.size.y;
+    for (i32 x = -1; x <= width; ++x)
+        row[x + 1] = SampleGrayscale(height, (x + width) % width, y);
+}
+
+static inline u8 EncodeNormal(f32 n)
+{
+    return (u8)(n * 127.5f + 127.5f);
+}
+
+Image NormalMapFromHeight(const Image& height, f32 strength)
+{
+    const i32 width = height.size.x;
+    const i32 rows = height.size.y;
+
+    Image normals = {};
+    normals.size = height.size;
+    normals.nchannels = 3;
+    normals.stride = width * 3;
+    normals.pixels = malloc((size_t)normals.stride * rows);
+
+    ParallelFor(rows, 32, [&](u32 beginRow, u32 endRow)
+    {
+        // Sliding window of three padded rows
+        const u32 paddedWidth = width + 2 + 3; // + 3 so SIMD loads past the end stay in bounds
+        std::vector<f32> window(paddedWidth * 3, 0.0f);
+        f32* r0 = &window[0];
+        f32* r1 = &window[paddedWidth];
+        f32* r2 = &window[paddedWidth * 2];
+        LoadHeightRow(height, (i32)beginRow - 1, r0);
+        LoadHeightRow(height, (i32)beginRow, r1);
+
+        const __m128 two = _mm_set1_ps(2.0f);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 scale = _mm_set1_ps(-strength);
+        alignas(16) f32 nx[4], ny[4], nz[4];
+
+        for (u32 y = beginRow; y < endRow; ++y)
+        {
+            LoadHeightRow(height, (i32)y + 1, r2);
+            u8* dst = (u8*)normals.pixels + (size_t)y * normals.stride;
+
+            for (i32 x = 0; x < width; x += 4)
+            {
+                // Padded index x + 1 is the centre texel, so x and x + 2 are its neighbours
+                __m128 l0 = _mm_loadu_ps(r0 + x), c0 = _mm_loadu_ps(r0 + x + 1), g0 = _mm_loadu_ps(r0 + x + 2);
+                __m128 l1 = _mm_loadu_ps(r1 + x),                                 g1 = _mm_loadu_ps(r1 + x + 2);
+                __m128 l2 = _mm_loadu_ps(r2 + x), c2 = _mm_loadu_ps(r2 + x + 1), g2 = _mm_loadu_ps(r2 + x + 2);
+
+                __m128 dx = _mm_sub_ps(_mm_add_ps(_mm_add_ps(g0, g2), _mm_mul_ps(two, g1)),
+                                       _mm_add_ps(_mm_add_ps(l0, l2), _mm_mul_ps(two, l1)));
+                __m128 dy = _mm_sub_ps(_mm_add_ps(_mm_add_ps(l2, g2), _mm_mul_ps(two, c2)),
+                                       _mm_add_ps(_mm_add_ps(l0, g0), _mm_mul_ps(two, c0)));
+
+                __m128 vx = _mm_mul_ps(dx, scale);
+                __m128 vy = _mm_mul_ps(dy, scale);
+                __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), one));
+                __m128 invLen = _mm_div_ps(one, len);
+
+                _mm_store_ps(nx, _mm_mul_ps(vx, invLen));
+                _mm_store_ps(ny, _mm_mul_ps(vy, invLen));
+                _mm_store_ps(nz, invLen);
+
+                const i32 count = width - x < 4 ? width - x : 4;
+                for (i32 i = 0; i < count; ++i)
+                {
+                    u8* pixel = dst + (x + i) * 3;
+                    pixel[0] = EncodeNormal(nx[i]);
+                    pixel[1] = EncodeNormal(ny[i]);
+                    pixel[2] = EncodeNormal(nz[i]);
+                }
+            }
+
+            f32* recycled = r0;
+            r0 = r1;
+            r1 = r2;
+            r2 = recycled;
+        }
+    });
+
+    return normals;
+}
+
+u32 GetMipCount(ivec2 size)
+{
+    u32 count = 1;
+    i32 largest = glm::max(size.x, size.y);
+    while (largest > 1)
+    {
+        largest /= 2;
+        count++;
+    }
+    return count;
+}
+
+static f32 SrgbToLinear(f32 c)
+{
+    return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static f32 LinearToSrgb(f32 c)
+{
+    return c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+}
+
+// Decoding 8-bit sRGB is a plain lookup, encoding goes through a finer table
+struct SrgbTables
+{
+    f32 toLinear[256];
+    u8  toSrgb[4096];
+
+    SrgbTables()
+    {
+        for (u32 i = 0; i < 256; ++i)
+            toLinear[i] = SrgbToLinear(i / 255.0f);
+        for (u32 i = 0; i < 4096; ++i)
+            toSrgb[i] = (u8)(LinearToSrgb(i / 4095.0f) * 255.0f + 0.5f);
+    }
+};
+
+static const SrgbTables& GetSrgbTables()
+{
+    static SrgbTables tables;
+    return tables;
+}
+
+// Converts an image into normalized floats (linearized if srgb is set)
+static std::vector<f32> ImageToFloat(const Image& image, bool srgb)
+{
+    const u64 count = (u64)image.size.x * image.size.y * image.nchannels;
+    std::vector<f32> values(count);
+    const SrgbTables& tables = GetSrgbTables();
+
+    ParallelFor(image.size.y, 64, [&](u32 beginRow, u32 endRow)
+    {
+        const u32 rowValues = image.size.x * image.nchannels;
+        for (u32 y = beginRow; y < endRow; ++y)
+        {
+            const u8* src = (const u8*)image.pixels + (size_t)y * image.stride;
+            f32* dst = &values[(size_t)y * rowValues];
+            for (u32 i = 0; i < rowValues; ++i)
+            {
+                switch (image.pixelType)
+                {
+                    case PixelType_U16: dst[i] = ((const u16*)src)[i] / 65535.0f; break;
+                    case PixelType_F32: dst[i] = ((const f32*)src)[i]; break;
+                    default:
+                        // Alpha is never gamma encoded
+                        const bool isAlpha = (image.nchannels == 4 && i % 4 == 3) || (image.nchannels == 2 && i % 2 == 1);
+                        dst[i] = srgb && !isAlpha ? tables.toLinear[src[i]] : src[i] / 255.0f;
+                        break;
+                }
+            }
+        }
+    });
+
+    return values;
+}
+
+static Image FloatToImage(const std::vector<f32>& values, ivec2 size, const Image& format, bool srgb)
+{
+    Image image = {};
+    image.size = size;
+    image.nchannels = format.nchannels;
+    image.pixelType = format.pixelType;
+    image.stride = size.x * GetPixelSize(image);
+    image.pixels = malloc((size_t)image.stride * size.y);
+    const SrgbTables& tables = GetSrgbTables();
+
+    ParallelFor(size.y, 64, [&](u32 beginRow, u32 endRow)
+    {
+        const u32 rowValues = size.x * image.nchannels;
+        for (u32 y = beginRow; y < endRow; ++y)
+        {
+            const f32* src = &values[(size_t)y * rowValues];
+            u8* dst = (u8*)image.pixels + (size_t)y * image.stride;
+            for (u32 i = 0; i < rowValues; ++i)
+            {
+                const f32 v = glm::clamp(src[i], 0.0f, 1.0f);
+                switch (image.pixelType)
+                {
+                    case PixelType_U16: ((u16*)dst)[i] = (u16)(v * 65535.0f + 0.5f); break;
+                    case PixelType_F32: ((f32*)dst)[i] = src[i]; break;
+                    default:
+                        const bool isAlpha = (image.nchannels == 4 && i % 4 == 3) || (image.nchannels == 2 && i % 2 == 1);
+                        dst[i] = srgb && !isAlpha ? tables.toSrgb[(u32)(v * 4095.0f + 0.5f)] : (u8)(v * 255.0f + 0.5f);
+                        break;
+                }
+            }
+        }
+    });
+
+    return image;
+}
+
+// One 2x2 box filter step. Odd sizes replicate the last row/column.
+static std::vector<f32> DownsampleFloat(const std::vector<f32>& src, ivec2 srcSize, ivec2 dstSize, i32 nchannels)
+{
+    std::vector<f32> dst((size_t)dstSize.x * dstSize.y * nchannels);
+    const u32 srcRowValues = srcSize.x * nchannels;
+    const u32 dstRowValues = dstSize.x * nchannels;
+
+    ParallelFor(dstSize.y, 16, [&](u32 beginRow, u32 endRow)
+    {
+        std::vector<f32> rowSum(srcRowValues + 4);
+        const __m128 quarter = _mm_set1_ps(0.25f);
+
+        for (u32 y = beginRow; y < endRow; ++y)
+        {
+            const f32* r0 = &src[(size_t)glm::min(2 * (i32)y,     srcSize.y - 1) * srcRowValues];
+            const f32* r1 = &src[(size_t)glm::min(2 * (i32)y + 1, srcSize.y - 1) * srcRowValues];
+
+            // Vertical pass: rows are contiguous so this vectorizes regardless of the channel count
+            u32 i = 0;
+            for (; i + 4 <= srcRowValues; i += 4)
+                _mm_storeu_ps(&rowSum[i], _mm_add_ps(_mm_loadu_ps(r0 + i), _mm_loadu_ps(r1 + i)));
+            for (; i < srcRowValues; ++i)
+                rowSum[i] = r0[i] + r1[i];
+
+            // Horizontal pass
+            f32* out = &dst[(size_t)y * dstRowValues];
+            for (i32 x = 0; x < dstSize.x; ++x)
+            {
+                const f32* p0 = &rowSum[glm::min(2 * x,     srcSize.x - 1) * nchannels];
+                const f32* p1 = &rowSum[glm::min(2 * x + 1, srcSize.x - 1) * nchannels];
+                if (nchannels == 4)
+                {
+                    _mm_storeu_ps(out + x * 4, _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(p0), _mm_loadu_ps(p1)), quarter));
+                }
+                else
+                {
+                    for (i32 c = 0; c < nchannels; ++c)
+                        out[x * nchannels + c] = (p0[c] + p1[c]) * 0.25f;
+                }
+            }
+        }
+    });
+
+    return dst;
+}
+
+std::vector<Image> GenerateMipChain(const Image& base, bool srgb)
+{
+    std::vector<Image> levels;
+    const u32 mipCount = GetMipCount(base.size);
+    if (mipCount <= 1)
+        return levels;
+
+    // Filtering happens on floats so levels don't accumulate quantization error
+    std::vector<f32> current = ImageToFloat(base, srgb);
+    ivec2 size = base.size;
+
+    for (u32 level = 1; level < mipCount; ++level)
+    {
+        ivec2 nextSize = glm::max(size / 2, ivec2(1, 1));
+        std::vector<f32> next = DownsampleFloat(current, size, nextSize, base.nchannels);
+        levels.push_back(FloatToImage(next, nextSize, base, srgb));
+        current.swap(next);
+        size = nextSize;
+    }
+
+    return levels;
+}
+
+// Result of decoding and cooking the sources of a material slot
+struct CookedMaterialSlot
+{
+    Image image;         // Texture to upload, pixels is null if there is none
+    u32   textureFlags;
+    bool  folded;        // Single color map, its value is in constant
+    vec4  constant;      // Color of a folded map, or the packed constants
+    u32   foldedCount;
+    u32   packedCount;
+    bool  normalsFromBump;
+    u64   bytesSaved;
+};
+
+// Name the texture of a slot is registered under. Maps built at load time get
+// a synthetic name made of their sources.
+static std::string GetMaterialSlotTexturePath(const MaterialTextureSources& sources, MaterialSlot slot)
+{
+    switch (slot)
+    {
+        case MaterialSlot_Albedo:   return sources.albedo;
+        case MaterialSlot_Emissive: return sources.emissive;
+        case MaterialSlot_Normals:
+            if (!sources.normals.empty())
+                return sources.normals;
+            if (!sources.bump.empty())
+                return "normals:" + sources.bump;
+            return std::string();
+        case MaterialSlot_Packed:
+            if (sources.specular.empty() && sources.smoothness.empty() && sources.occlusion.empty())
+                return std::string();
+            return "packed:" + sources.specular + ";" + sources.smoothness + ";" + sources.occlusion + ";;";
+        default:
+            return std::string();
+    }
+}
+
+static u32* GetMaterialSlotTexture(Material& material, MaterialSlot slot)
+{
+    switch (slot)
+    {
+        case MaterialSlot_Albedo:   return &material.albedoTextureIdx;
+        case MaterialSlot_Emissive: return &material.emissiveTextureIdx;
+        case MaterialSlot_Normals:  return &material.normalsTextureIdx;
+        default:                    return &material.packedTextureIdx;
+    }
+}
+
+// Decodes a color map, folding it into a constant if it is a single solid color
+static CookedMaterialSlot CookColorMap(const std::string& filepath, u32 flags)
+{
+    CookedMaterialSlot cooked = {};
+    cooked.textureFlags = flags;
+
+    Image image = LoadImage(filepath.c_str());
+    if (!image.pixels)
+        return cooked;
+
+    if (IsUniformImage(image, &cooked.constant))
+    {
+        cooked.folded = true;
+        cooked.foldedCount = 1;
+        cooked.bytesSaved = (u64)image.stride * image.size.y;
+        FreeImage(image);
+        return cooked;
+    }
+
+    cooked.image = image;
+    return cooked;
+}
+
+// Turns a height map into a normal map. There's no texture if the height map
+// is flat (vertex normals are enough then).
+static CookedMaterialSlot CookNormalsFromBump(const std::string& bumpPath, f32 strength)
+{
+    CookedMaterialSlot cooked = {};
+    cooked.textureFlags = TextureFlag_LinearData | TextureFlag_Generated;
+
+    Image height = LoadImage(bumpPath.c_str());
+    if (!height.pixels)
+        return cooked;
+
+    if (IsUniformImage(height, &cooked.constant))
+    {
+        cooked.folded = true;
+        cooked.foldedCount = 1;
+        FreeImage(height);
+        return cooked;
+    }
+
+    cooked.image = NormalMapFromHeight(height, strength);
+    cooked.normalsFromBump = true;
+    FreeImage(height);
+    return cooked;
+}
+
+// Grayscale maps: R specular, G smoothness, B occlusion. Bump maps are never
+// sampled at runtime, they are converted to normal maps.
+static CookedMaterialSlot CookPackedMap(const MaterialTextureSources& sources, vec4 constants)
+{
+    CookedMaterialSlot cooked = {};
+    cooked.textureFlags = TextureFlag_LinearData | TextureFlag_Generated;
+
+    const std::string noSource;
+    const std::string* grayPaths[4] = { &sources.specular, &sources.smoothness, &sources.occlusion, &noSource };
+
+    Image grayImages[4] = {};
+    const Image* packSources[4] = {};
+    u64 sourceBytes = 0;
+
+    for (u32 c = 0; c < 4; ++c)
+    {
+        if (grayPaths[c]->empty())
+            continue;
+
+        Image image = LoadImage(grayPaths[c]->c_str());
+        if (!image.pixels)
+            continue;
+
+        vec4 color;
+        if (IsUniformImage(image, &color))
+        {
+            constants[c] = color.r;
+            cooked.foldedCount++;
+            cooked.bytesSaved += (u64)image.stride * image.size.y;
+            FreeImage(image);
+            continue;
+        }
+
+        grayImages[c] = image;
+        packSources[c] = &grayImages[c];
+        sourceBytes += (u64)image.stride * image.size.y;
+        cooked.packedCount++;
+    }
+
+    cooked.constant = constants;
+    if (cooked.packedCount == 0)
+        return cooked;
+
+    cooked.image = PackGrayscaleChannels(packSources, constants);
+    const u64 packedBytes = (u64)cooked.image.stride * cooked.image.size.y;
+    if (sourceBytes > packedBytes)
+        cooked.bytesSaved += sourceBytes - packedBytes;
+
+    for (u32 c = 0; c < 4; ++c)
+        if (packSources[c])
+            FreeImage(grayImages[c]);
+
+    return cooked;
+}
+
+// Decodes and cooks the sources of a slot on the job system, then creates
+// the texture on the main thread
+static AssetTask CookMaterialSlotAsync(App* app, u32 materialIdx, MaterialSlot slot, std::string texturePath)
+{
+    const Material& material = app->materials[materialIdx];
+    const MaterialTextureSources sources = material.sources;
+    const vec4 packedConstants = material.packedConstants;
+    const f32 bumpStrength = app->bumpToNormalStrength;
+
+    VirtualTextureCookSettings virtualSettings = {};
+    if (slot == MaterialSlot_Albedo)
+    {
+        virtualSettings = GetVirtualTextureCookSettings(app);
+        app->virtualTexturing.cookingSources.insert(sources.albedo);
+    }
+
+    co_await ResumeOnWorker{ JobPriority_High };
+
+    CookedMaterialSlot cooked = {};
+    switch (slot)
+    {
+        case MaterialSlot_Albedo:   cooked = CookColorMap(sources.albedo, 0); break;
+        case MaterialSlot_Emissive: cooked = CookColorMap(sources.emissive, 0); break;
+        case MaterialSlot_Normals:
+            // A flat normal map is the same as using the interpolated vertex normal
+            if (!sources.normals.empty())
+                cooked = CookColorMap(sources.normals, TextureFlag_LinearData);
+            else
+                cooked = CookNormalsFromBump(sources.bump, bumpStrength);
+            break;
+        case MaterialSlot_Packed:   cooked = CookPackedMap(sources, packedConstants); break;
+        default:;
+    }
+
+    // Albedo maps bigger than the virtual texturing threshold are paged from
+    // disk. The pages are cooked here, the main thread only creates the GL objects.
+    CookedVirtualTexture cookedVirtual = {};
+    const bool isVirtual = slot == MaterialSlot_Albedo && cooked.image.pixels && WantsVirtualTexture(virtualSettings, cooked.image);
+    TextureUpload upload = {};
+    if (isVirtual)
+    {
+        cookedVirtual = CookVirtualTexture(virtualSettings, sources.albedo.c_str(), cooked.image);
+        FreeImage(cooked.image);
+    }
+    else if (cooked.image.pixels)
+    {
+        upload = PrepareTextureUpload(cooked.image, cooked.textureFlags);
+    }
+    cooked.image = {};
+
+    co_await ResumeOnMainThread{ JobPriority_High };
+
+    if (slot == MaterialSlot_Albedo)
+        app->virtualTexturing.cookingSources.erase(sources.albedo);
+
+    app->cookStats.texturesFolded += cooked.foldedCount;
+    app->cookStats.texturesPacked += cooked.packedCount;
+    app->cookStats.normalMapsFromBump += cooked.normalsFromBump ? 1 : 0;
+    app->cookStats.bytesSaved += cooked.bytesSaved;
+
+    // The material may have been unloaded meanwhile
+    Material* target = app->materials.Get(materialIdx);
+    if (!target)
+    {
+        FreeTextureUpload(upload);
+        free(cookedVirtual.coarsestPage);
+        co_return UINT32_MAX;
+    }
+
+    u32 texIdx = UINT32_MAX;
+    if (isVirtual)
+    {
+        target->albedoVirtualTextureIdx = AddVirtualTexture(app, cookedVirtual);
+
+        // Its submeshes switch to the virtual texture pipeline on the next frame
+        WarmUpModelPipelines(app, app->model);
+    }
+    else if (upload.image.pixels)
+    {
+        // Another material may have cooked the same map meanwhile
+        texIdx = FindTexture2D(app, texturePath.c_str());
+        if (texIdx != UINT32_MAX)
+        {
+            RetainTexture(app, texIdx);
+            FreeTextureUpload(upload);
+        }
+        else
+        {
+            texIdx = AddTexture2D(app, texturePath.c_str(), std::move(upload), cooked.textureFlags);
+        }
+    }
+
+    if (cooked.folded && slot == MaterialSlot_Albedo)
+        target->albedo = vec3(cooked.constant);
+    if (cooked.folded && slot == MaterialSlot_Emissive)
+        target->emissive = vec3(cooked.constant);
+    if (slot == MaterialSlot_Packed)
+        target->packedConstants = cooked.constant;
+
+    *GetMaterialSlotTexture(*target, slot) = texIdx;
+    target->slotStates[slot] = MaterialSlotState_Ready;
+    co_return texIdx;
+}
+
+void InitMaterialTextures(Material& material, const MaterialTextureSources& sources)
+{
+    material.sources = sources;
+    material.albedoTextureIdx = UINT32_MAX;
+    material.emissiveTextureIdx = UINT32_MAX;
+    material.normalsTextureIdx = UINT32_MAX;
+    material.albedoVirtualTextureIdx = UINT32_MAX;
+    material.packedTextureIdx = UINT32_MAX;
+    material.packedConstants = vec4(material.specular, material.smoothness, 1.0f, 1.0f);
+    for (MaterialSlotState& state : material.slotStates)
+        state = MaterialSlotState_Unloaded;
+}
+
+u32 RequestMaterialTexture(App* app, u32 materialIdx, MaterialSlot slot)
+{
+    Material& material = app->materials[materialIdx];
+    if (material.slotStates[slot] == MaterialSlotState_Ready)
+        return *GetMaterialSlotTexture(material, slot);
+
+    if (material.slotStates[slot] == MaterialSlotState_Unloaded)
+    {
+        if (slot == MaterialSlot_Albedo)
+        {
+            // Wait for another material cooking the same source
+            if (app->virtualTexturing.cookingSources.count(material.sources.albedo))
+                return app->magentaTexIdx;
+
+            const u32 virtualTextureIdx = FindVirtualTexture(app, material.sources.albedo);
+            if (virtualTextureIdx != UINT32_MAX)
+            {
+                app->virtualTextures.AddRef(virtualTextureIdx);
+                material.albedoVirtualTextureIdx = virtualTextureIdx;
+                material.slotStates[slot] = MaterialSlotState_Ready;
+                return UINT32_MAX;
+            }
+        }
+
+        std::string texturePath = GetMaterialSlotTexturePath(material.sources, slot);
+        if (texturePath.empty())
+        {
+            material.slotStates[slot] = MaterialSlotState_Ready;
+            return UINT32_MAX;
+        }
+
+        u32 texIdx = FindTexture2D(app, texturePath.c_str());
+        if (texIdx != UINT32_MAX)
+        {
+            *GetMaterialSlotTexture(material, slot) = RetainTexture(app, texIdx);
+            material.slotStates[slot] = MaterialSlotState_Ready;
+            return texIdx;
+        }
+
+        material.slotStates[slot] = MaterialSlotState_Loading;
+        CookMaterialSlotAsync(app, materialIdx, slot, texturePath);
+    }
+
+    return app->magentaTexIdx;
+}
@@ -0,0 +1,45 @@
+//
+// texture_processing.h: CPU-side image cooking done at load time, before the
+// pixels reach the GPU (constant folding, channel packing...).
+//
+
+#pragma once
+
+#include "engine.h"
+
+// Returns true if every pixel of the image has the same value, which is
+// written normalized into color (missing channels are 0, alpha defaults to 1)
+bool IsUniformImage(const Image& image, vec4* color);
+
+// Value of a pixel reduced to a single channel (average of the color channels),
+// normalized at the precision of the image. HDR values aren't clamped.
+f32 SampleGrayscale(const Image& image, i32 x, i32 y);
+
+// Merges up to four grayscale images into one RGBA8 image of the largest size.
+// Channels with a null source are filled with the matching constant.
+// The result can be released with FreeImage().
+Image PackGrayscaleChannels(const Image* sources[4], vec4 constants);
+
+// Builds a tangent-space normal map (RGB8, +Y up) from a height map using a
+// Sobel filter. Rows are processed in parallel on the job system, 4 pixels at
+// a time with SSE. The result can be released with FreeImage().
+Image NormalMapFromHeight(const Image& height, f32 strength);
+
+// Number of levels of a full mip chain for the given base size
+u32 GetMipCount(ivec2 size);
+
+// Downsamples the base image into the rest of its mip chain (level 1 onwards)
+// with a 2x2 box filter. 8-bit color images are filtered in linear space when
+// srgb is set. Rows are filtered in parallel on the job system with SSE.
+// Every level can be released with FreeImage().
+std::vector<Image> GenerateMipChain(const Image& base, bool srgb);
+
+// Sets up the texture slots of a material, nothing is loaded yet
+void InitMaterialTextures(Material& material, const MaterialTextureSources& sources);
+
+// Texture to bind for a material slot. The first request starts cooking the
+// slot on the job system (uniform maps are folded into the material constants,
+// grayscale ones packed and height maps turned into normal maps) and the
+// magenta placeholder is returned until it's done. UINT32_MAX if the slot has
+// no texture.
+u32 RequestMaterialTexture(App* app, u32 materialIdx, MaterialSlot slot);
@@ -0,0 +1,378 @@
+//
+// texture_streaming.cpp: Mip streaming. Immutable textures can't grow, so
+// changing the resident mips means allocating a new texture, copying the mips
+// that are kept with glCopyImageSubData and uploading the new ones.
+//
+// The first stream-in of a texture decodes its source and writes every mip to
+// a file of the cache directory (header, then levels finest first, tightly packed).
+// Later ones, after an eviction or a budget change, only read the levels they
+// need from it.
+//
+
+#include "texture_streaming.h"
+#include "texture_processing.h"
+#include "job_system.h"
+#include <imgui.h>
+#include <mutex>
+#include <algorithm>
+
+// Mips decoded by a worker, waiting for the main thread to upload them
+struct StreamedMips
+{
+    u32 texIdx;
+    u32 firstMip;
+    std::vector<Image> levels; // levels[i] is mip firstMip + i
+};
+
+static std::mutex                GlobalStreamedMipsMutex;
+static std::vector<StreamedMips> GlobalStreamedMips;
+
+#define MIP_CACHE_FILE_MAGIC 0x3150494D // "MIP1"
+
+struct MipCacheFileHeader
+{
+    u32 magic;
+    i32 width;
+    i32 height;
+    i32 nchannels;
+    u32 pixelType;
+    u32 mipCount;
+    u32 srgb;
+};
+
+static Image MakeMipCacheLevel(const MipCacheFileHeader& header, u32 level)
+{
+    Image image = {};
+    image.size = GetMipSize(ivec2(header.width, header.height), level);
+    image.nchannels = header.nchannels;
+    image.pixelType = (PixelType)header.pixelType;
+    image.stride = image.size.x * GetPixelSize(image);
+    return image;
+}
+
+// Levels [firstMip, endMip) of the cache, empty if it is missing, older than
+// the source or of another size
+static std::vector<Image> ReadMipCache(const std::string& filepath, ivec2 size, bool srgb, u32 firstMip, u32 endMip)
+{
+    std::vector<Image> levels;
+    const std::string cachePath = GetCacheFilePath(filepath.c_str(), ".mips");
+    if (GetFileLastWriteTimestamp(cachePath.c_str()) < GetFileLastWriteTimestamp(filepath.c_str()))
+        return levels;
+
+    FILE* file = fopen(cachePath.c_str(), "rb");
+    if (!file)
+        return levels;
+
+    MipCacheFileHeader header = {};
+    bool read = fread(&header, sizeof(header), 1, file) == 1 && header.magic == MIP_CACHE_FILE_MAGIC &&
+                header.width == size.x && header.height == size.y && header.srgb == (u32)srgb && endMip <= header.mipCount;
+
+    u64 offset = sizeof(header);
+    for (u32 level = 0; read && level < firstMip; ++level)
+    {
+        const Image skipped = MakeMipCacheLevel(header, level);
+        offset += (u64)skipped.stride * skipped.size.y;
+    }
+    read = read && SeekFile(file, offset);
+
+    for (u32 level = firstMip; read && level < endMip; ++level)
+    {
+        Image image = MakeMipCacheLevel(header, level);
+        const size_t bytes = (size_t)image.stride * image.size.y;
+        image.pixels = malloc(bytes);
+        read = fread(image.pixels, bytes, 1, file) == 1;
+        levels.push_back(image);
+    }
+    fclose(file);
+
+    if (!read)
+    {
+        for (Image& level : levels)
+            FreeImage(level);
+        levels.clear();
+    }
+    return levels;
+}
+
+static void WriteMipCache(const std::string& filepath, bool srgb, const Image& base, const std::vector<Image>& mips)
+{
+    const std::string cachePath = GetCacheFilePath(filepath.c_str(), ".mips");
+    FILE* file = fopen(cachePath.c_str(), "wb");
+    if (!file)
+        return;
+
+    const MipCacheFileHeader header = { MIP_CACHE_FILE_MAGIC, base.size.x, base.size.y, base.nchannels,
+                                        (u32)base.pixelType, 1 + (u32)mips.size(), (u32)srgb };
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (u32 level = 0; written && level < header.mipCount; ++level)
+    {
+        const Image& image = level == 0 ? base : mips[level - 1];
+        const u32 rowBytes = image.size.x * GetPixelSize(image);
+        for (i32 y = 0; written && y < image.size.y; ++y)
+            written = fwrite((const u8*)image.pixels + (size_t)y * image.stride, rowBytes, 1, file) == 1;
+    }
+    fclose(file);
+
+    if (!written)
+    {
+        ELOG("Could not write mip cache %s", cachePath.c_str());
+        remove(cachePath.c_str());
+    }
+}
+
+void InitTextureStreaming(TextureStreaming& streaming)
+{
+    streaming.enabled = true;
+    streaming.budgetBytes = MB(256);
+    streaming.residentBytes = 0;
+    streaming.tailSize = 64;
+    streaming.maxPendingLoads = 4;
+    streaming.pendingLoads = 0;
+}
+
+u32 GetInitialStreamingMip(const TextureStreaming& streaming, ivec2 size)
+{
+    u32 mip = 0;
+    while ((u32)glm::max(size.x >> mip, size.y >> mip) > streaming.tailSize)
+        mip++;
+    return mip;
+}
+
+// Swaps the GL texture for one holding mips [newFirstMip, mipCount). Mips
+// already resident are copied on the GPU, the rest come from newLevels.
+static void ReallocateTexture(App* app, Texture& tex, u32 newFirstMip, const StreamedMips* newLevels)
+{
+    GLuint newHandle = AllocateTexture2D(tex.format, tex.size, tex.mipCount, newFirstMip);
+
+    for (u32 level = newFirstMip; level < tex.mipCount; ++level)
+    {
+        if (level >= tex.residentMip)
+        {
+            ivec2 mipSize = GetMipSize(tex.size, level);
+            glCopyImageSubData(tex.handle, GL_TEXTURE_2D, level - tex.residentMip, 0, 0, 0,
+                               newHandle,  GL_TEXTURE_2D, level - newFirstMip,     0, 0, 0,
+                               mipSize.x, mipSize.y, 1);
+        }
+        else
+        {
+            UploadTextureMip(tex.format, level, newFirstMip, newLevels->levels[level - newLevels->firstMip]);
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glDeleteTextures(1, &tex.handle);
+    app->streaming.residentBytes -= GetMipRangeBytes(tex, tex.residentMip);
+    app->streaming.residentBytes += GetMipRangeBytes(tex, newFirstMip);
+
+    tex.handle = newHandle;
+    tex.residentMip = newFirstMip;
+}
+
+static void StreamInTexture(App* app, u32 texIdx)
+{
+    Texture& tex = app->textures[texIdx];
+    tex.streamPending = true;
+    app->streaming.pendingLoads++;
+
+    const std::string filepath = tex.filepath;
+    const ivec2 size = tex.size;
+    const bool srgb = !(tex.flags & TextureFlag_LinearData);
+    const u32 firstMip = tex.wantedMip;
+    const u32 endMip = tex.residentMip;
+
+    RunJob([texIdx, filepath, size, srgb, firstMip, endMip]()
+    {
+        StreamedMips result = {};
+        result.texIdx = texIdx;
+        result.firstMip = firstMip;
+        result.levels = ReadMipCache(filepath, size, srgb, firstMip, endMip);
+
+        Image image = {};
+        if (result.levels.empty())
+            image = LoadImage(filepath.c_str());
+        if (image.pixels)
+        {
+            std::vector<Image> mips = GenerateMipChain(image, srgb);
+            WriteMipCache(filepath, srgb, image, mips);
+            for (u32 level = firstMip; level < endMip; ++level)
+            {
+                if (level == 0)
+                {
+                    result.levels.push_back(image);
+                    image.pixels = nullptr;
+                }
+                else
+                {
+                    result.levels.push_back(mips[level - 1]);
+                    mips[level - 1].pixels = nullptr;
+                }
+            }
+            for (Image& mip : mips)
+                if (mip.pixels)
+                    FreeImage(mip);
+            if (image.pixels)
+                FreeImage(image);
+        }
+
+        std::lock_guard<std::mutex> lock(GlobalStreamedMipsMutex);
+        GlobalStreamedMips.push_back(std::move(result));
+    });
+}
+
+static void UploadStreamedMips(App* app)
+{
+    std::vector<StreamedMips> completed;
+    {
+        std::lock_guard<std::mutex> lock(GlobalStreamedMipsMutex);
+        completed.swap(GlobalStreamedMips);
+    }
+
+    for (StreamedMips& streamed : completed)
+    {
+        app->streaming.pendingLoads--;
+
+        // The texture may have been unloaded while decoding
+        Texture* tex = app->textures.Get(streamed.texIdx);
+        if (tex)
+            tex->streamPending = false;
+
+        // Decoding failed or the texture got evicted meanwhile
+        const bool valid = tex && !streamed.levels.empty() && streamed.firstMip + streamed.levels.size() >= tex->residentMip;
+        if (valid && streamed.firstMip < tex->residentMip)
+        {
+            ReallocateTexture(app, *tex, streamed.firstMip, &streamed);
+            app->streaming.streamedIn++;
+        }
+
+        for (Image& level : streamed.levels)
+            FreeImage(level);
+    }
+}
+
+// Finest mip needed by a submesh drawn with the given texture, following the
+// projection of the textured mesh shader
+static u32 EstimateRequiredMip(const App* app, const Texture& tex, const Submesh& submesh)
+{
+    const f32 texelsPerWorldUnit = submesh.uvDensity * (f32)glm::max(tex.size.x, tex.size.y);
+    const f32 texelsPerPixel = texelsPerWorldUnit / app->streaming.pixelsPerWorldUnit;
+    if (texelsPerPixel <= 1.0f)
+        return 0;
+    return (u32)glm::min(log2f(texelsPerPixel), (f32)(tex.mipCount - 1));
+}
+
+void UpdateTextureStreaming(App* app)
+{
+    TextureStreaming& streaming = app->streaming;
+
+    // Loads in flight still have to land even if streaming got disabled
+    UploadStreamedMips(app);
+
+    if (!streaming.enabled)
+        return;
+
+    // Minimized, there's no screen to size the mips for: keep the resident ones
+    if (app->displaySize.y <= 0)
+        return;
+
+    // Without a camera the mesh shader divides positions by a clipping scale of 5
+    const f32 clippingScale = 5.0f;
+    streaming.pixelsPerWorldUnit = app->displaySize.y * 0.5f / clippingScale;
+
+    // Unused textures fall back to their tail
+    for (Texture& tex : app->textures)
+    {
+        tex.wantedMip = (tex.flags & TextureFlag_Generated) ? 0 : GetInitialStreamingMip(streaming, tex.size);
+        tex.streamingPriority = 0.0f;
+    }
+
+    if (app->models.IsValid(app->model))
+    {
+        const Model& model = app->models[app->model];
+        const Mesh& mesh = app->meshes[model.meshIdx];
+        for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+        {
+            const Material& material = app->materials[model.materialIdx[i]];
+            const u32 textureIndices[] = { material.albedoTextureIdx, material.emissiveTextureIdx, material.normalsTextureIdx, material.packedTextureIdx };
+            const f32 screenArea = mesh.submeshes[i].surfaceArea * streaming.pixelsPerWorldUnit * streaming.pixelsPerWorldUnit;
+
+            for (u32 texIdx : textureIndices)
+            {
+                if (texIdx == UINT32_MAX)
+                    continue;
+                Texture& tex = app->textures[texIdx];
+                if (tex.flags & TextureFlag_Generated)
+                    continue;
+                tex.wantedMip = glm::min(tex.wantedMip, EstimateRequiredMip(app, tex, mesh.submeshes[i]));
+                tex.streamingPriority += screenArea;
+            }
+        }
+    }
+
+    // Fit the budget by dropping the finest mip of the least important textures first
+    std::vector<u32> order;
+    u64 wantedBytes = 0;
+    for (u32 slot = 0; slot < app->textures.SlotCount(); ++slot)
+    {
+        if (!app->textures.IsSlotAlive(slot))
+            continue;
+        u32 texIdx = app->textures.HandleAt(slot);
+        order.push_back(texIdx);
+        wantedBytes += GetMipRangeBytes(app->textures[texIdx], app->textures[texIdx].wantedMip);
+    }
+    std::sort(order.begin(), order.end(), [app](u32 a, u32 b) {
+        return app->textures[a].streamingPriority < app->textures[b].streamingPriority;
+    });
+
+    bool dropped = true;
+    while (wantedBytes > streaming.budgetBytes && dropped)
+    {
+        dropped = false;
+        for (u32 texIdx : order)
+        {
+            Texture& tex = app->textures[texIdx];
+            if (tex.flags & TextureFlag_Generated)
+                continue;
+            if (tex.wantedMip >= GetInitialStreamingMip(streaming, tex.size))
+                continue;
+
+            wantedBytes -= GetMipRangeBytes(tex, tex.wantedMip) - GetMipRangeBytes(tex, tex.wantedMip + 1);
+            tex.wantedMip++;
+            dropped = true;
+            if (wantedBytes <= streaming.budgetBytes)
+                break;
+        }
+    }
+
+    // Evict first so the memory is there for the loads
+    for (Texture& tex : app->textures)
+    {
+        if (!tex.streamPending && tex.wantedMip > tex.residentMip)
+        {
+            ReallocateTexture(app, tex, tex.wantedMip, nullptr);
+            streaming.evicted++;
+        }
+    }
+
+    // Stream in, most important textures first
+    for (auto it = order.rbegin(); it != order.rend() && streaming.pendingLoads < streaming.maxPendingLoads; ++it)
+    {
+        Texture& tex = app->textures[*it];
+        if (!tex.streamPending && tex.wantedMip < tex.residentMip)
+            StreamInTexture(app, *it);
+    }
+}
+
+void TextureStreamingGui(App* app)
+{
+    TextureStreaming& streaming = app->streaming;
+
+    ImGui::Begin("Texture streaming");
+    ImGui::Checkbox("Enabled", &streaming.enabled);
+    int budgetMB = (int)(streaming.budgetBytes / MB(1));
+    if (ImGui::SliderInt("Budget (MB)", &budgetMB, 1, 4096))
+        streaming.budgetBytes = (u64)budgetMB * MB(1);
+    ImGui::Text("Resident: %.2f MB", streaming.residentBytes / (f64)MB(1));
+    ImGui::Text("Pending loads: %u", streaming.pendingLoads);
+    ImGui::Text("Streamed in: %u, evicted: %u", streaming.streamedIn, streaming.evicted);
+    ImGui::End();
+}
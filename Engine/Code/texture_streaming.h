@@ -0,0 +1,19 @@
+//
+// texture_streaming.h: Keeps in VRAM only the mips each texture needs on screen,
+// within a memory budget. Missing mips are decoded on the job system.
+//
+
+#pragma once
+
+#include "engine.h"
+
+void InitTextureStreaming(TextureStreaming& streaming);
+
+// First mip uploaded when a streamable texture is created (its low mip tail)
+u32 GetInitialStreamingMip(const TextureStreaming& streaming, ivec2 size);
+
+// Estimates the mip each texture needs, applies the budget and issues the
+// stream-in/evict operations. Call once per frame from the main thread.
+void UpdateTextureStreaming(App* app);
+
+void TextureStreamingGui(App* app);
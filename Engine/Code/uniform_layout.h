@@ -0,0 +1,133 @@
+//
+// uniform_layout.h: C++ mirrors of std140/std430 blocks. A struct declared with
+// UNIFORM_BLOCK_LAYOUT() has its member offsets checked against the GLSL rules
+// at compile time and against the program reflection at load time, so it can
+// be copied into a buffer as is:
+//
+//     struct LocalParams
+//     {
+//         glm::mat4 uWorldMatrix;
+//         glm::mat4 uWorldViewProjectionMatrix;
+//     };
+//     UNIFORM_BLOCK_LAYOUT(LocalParams, UniformLayout_Std140,
+//         UNIFORM_BLOCK_MEMBER(LocalParams, uWorldMatrix),
+//         UNIFORM_BLOCK_MEMBER(LocalParams, uWorldViewProjectionMatrix));
+//
+// Member names must match the GLSL ones. Padding members the shader doesn't
+// have are left out of the list.
+//
+
+#pragma once
+
+#include "platform.h"
+#include <glad/glad.h>
+#include <cstddef>
+#include <type_traits>
+
+enum UniformLayout
+{
+    UniformLayout_Std140, // Uniform blocks
+    UniformLayout_Std430, // Storage blocks: arrays aren't rounded up to vec4
+};
+
+// GLSL type of a C++ member type. Types without a specialization (glm::mat3,
+// bool...) don't have the same size on both sides and fail to compile.
+template <typename T> struct GlslType;
+
+template <> struct GlslType<f32>       { static constexpr GLenum type = GL_FLOAT;        static constexpr u32 alignment = 4; };
+template <> struct GlslType<i32>       { static constexpr GLenum type = GL_INT;          static constexpr u32 alignment = 4; };
+template <> struct GlslType<u32>       { static constexpr GLenum type = GL_UNSIGNED_INT; static constexpr u32 alignment = 4; };
+template <> struct GlslType<glm::vec2> { static constexpr GLenum type = GL_FLOAT_VEC2;   static constexpr u32 alignment = 8; };
+template <> struct GlslType<glm::vec3> { static constexpr GLenum type = GL_FLOAT_VEC3;   static constexpr u32 alignment = 16; };
+template <> struct GlslType<glm::vec4> { static constexpr GLenum type = GL_FLOAT_VEC4;   static constexpr u32 alignment = 16; };
+template <> struct GlslType<glm::ivec2>{ static constexpr GLenum type = GL_INT_VEC2;     static constexpr u32 alignment = 8; };
+template <> struct GlslType<glm::ivec4>{ static constexpr GLenum type = GL_INT_VEC4;     static constexpr u32 alignment = 16; };
+template <> struct GlslType<glm::mat4> { static constexpr GLenum type = GL_FLOAT_MAT4;   static constexpr u32 alignment = 16; };
+
+struct UniformBlockMember
+{
+    const char* name;
+    u32    offset;      // In the C++ struct
+    GLenum type;
+    u32    alignment;   // Base alignment of the element type
+    u32    elementSize; // sizeof() of the element type
+    u32    arraySize;   // 0 if it isn't an array
+};
+
+template <typename M>
+constexpr UniformBlockMember MakeUniformBlockMember(const char* name, size_t offset)
+{
+    using Element = std::remove_all_extents_t<M>;
+    static_assert(std::rank_v<M> <= 1, "Only one dimensional arrays are supported in uniform blocks");
+    return { name, (u32)offset, GlslType<Element>::type, GlslType<Element>::alignment, (u32)sizeof(Element), (u32)std::extent_v<M> };
+}
+
+struct UniformBlockInfo
+{
+    const char*               name;
+    UniformLayout             layout;
+    u32                       size;
+    const UniformBlockMember* members;
+    u32                       memberCount;
+};
+
+// Specialized by UNIFORM_BLOCK_LAYOUT()
+template <typename T> struct UniformBlockLayout;
+
+constexpr u32 AlignUp(u32 value, u32 alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Distance between array elements according to the layout rules
+constexpr u32 GetUniformArrayStride(const UniformBlockMember& member, UniformLayout layout)
+{
+    const u32 alignment = layout == UniformLayout_Std140 ? AlignUp(member.alignment, 16) : member.alignment;
+    return AlignUp(member.elementSize, alignment);
+}
+
+// Offset the layout rules give to each member, knowing where the previous one
+// ends in the C++ struct. Returns the index of the first member the C++ struct
+// places elsewhere, or memberCount if they all match.
+constexpr u32 FindMisplacedUniformMember(const UniformBlockInfo& info)
+{
+    u32 end = 0;
+    for (u32 i = 0; i < info.memberCount; ++i)
+    {
+        const UniformBlockMember& member = info.members[i];
+        u32 alignment = member.alignment;
+        u32 size = member.elementSize;
+        if (member.arraySize > 0)
+        {
+            const u32 stride = GetUniformArrayStride(member, info.layout);
+            if (stride != member.elementSize)
+                return i; // C++ arrays are tightly packed
+            alignment = info.layout == UniformLayout_Std140 ? AlignUp(alignment, 16) : alignment;
+            size = stride * member.arraySize;
+        }
+        if (member.offset != AlignUp(end, alignment))
+            return i;
+        end = member.offset + size;
+    }
+    return info.memberCount;
+}
+
+template <typename T>
+constexpr UniformBlockInfo GetUniformBlockInfo()
+{
+    using Layout = UniformBlockLayout<T>;
+    return { Layout::name, Layout::layout, (u32)sizeof(T), Layout::members, (u32)ARRAY_COUNT(Layout::members) };
+}
+
+#define UNIFORM_BLOCK_MEMBER(type, member) MakeUniformBlockMember<decltype(type::member)>(#member, offsetof(type, member))
+
+#define UNIFORM_BLOCK_LAYOUT(type, blockLayout, ...)                                                        \
+template <> struct UniformBlockLayout<type>                                                                 \
+{                                                                                                           \
+    static constexpr const char*        name = #type;                                                       \
+    static constexpr UniformLayout      layout = blockLayout;                                               \
+    static constexpr UniformBlockMember members[] = { __VA_ARGS__ };                                        \
+};                                                                                                          \
+static_assert(std::is_standard_layout_v<type>, #type " must be standard layout to mirror a GLSL block");    \
+static_assert(FindMisplacedUniformMember(GetUniformBlockInfo<type>()) == ARRAY_COUNT(UniformBlockLayout<type>::members), \
+              #type " doesn't follow the layout of its GLSL block, add padding or reorder the members")
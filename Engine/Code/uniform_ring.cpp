@@ -0,0 +1,92 @@
+//
+// uniform_ring.cpp: Ring of per-frame uniform regions. Without buffer storage
+// (GL 4.4) the region is mapped unsynchronized every frame instead of
+// persistently; the fences do the synchronization.
+//
+
+#include "uniform_ring.h"
+#include "gl_state.h"
+
+void InitUniformRing(App* app, u32 frameSize)
+{
+    UniformRing& ring = app->uniformRing;
+
+    // Regions start aligned, so offsets inside them only need aligning to the head
+    ring.frameSize = AlignUp(frameSize, (u32)app->uniformBlockAlignment);
+
+    glGenBuffers(1, &ring.handle);
+    glBindBuffer(GL_UNIFORM_BUFFER, ring.handle);
+    glBufferData(GL_UNIFORM_BUFFER, (GLsizeiptr)ring.frameSize * UNIFORM_RING_FRAMES, NULL, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void BeginUniformFrame(App* app)
+{
+    UniformRing& ring = app->uniformRing;
+    ring.frame = (ring.frame + 1) % UNIFORM_RING_FRAMES;
+    ring.head = 0;
+
+    GLsync& fence = ring.fences[ring.frame];
+    if (fence)
+    {
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+        {
+            ring.stalls++;
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED);
+        }
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    // The fence already synchronized this region
+    glBindBuffer(GL_UNIFORM_BUFFER, ring.handle);
+    ring.mapped = (u8*)glMapBufferRange(GL_UNIFORM_BUFFER, (GLintptr)ring.frame * ring.frameSize, ring.frameSize,
+                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+u32 PushUniforms(App* app, const void* data, u32 size)
+{
+    UniformRing& ring = app->uniformRing;
+    ASSERT(ring.mapped, "Uniforms pushed outside of BeginUniformFrame() / FlushUniformFrame()");
+
+    const u32 offset = AlignUp(ring.head, (u32)app->uniformBlockAlignment);
+    if (offset + size > ring.frameSize)
+    {
+        if (ring.overflows++ == 0)
+            ELOG("Uniform ring full (%u bytes per frame), draws are being dropped", ring.frameSize);
+        return UINT32_MAX;
+    }
+
+    memcpy(ring.mapped + offset, data, size);
+    ring.head = offset + size;
+    return ring.frame * ring.frameSize + offset;
+}
+
+void FlushUniformFrame(App* app)
+{
+    UniformRing& ring = app->uniformRing;
+    if (!ring.mapped)
+        return;
+
+    glBindBuffer(GL_UNIFORM_BUFFER, ring.handle);
+    if (ring.head > 0)
+        glFlushMappedBufferRange(GL_UNIFORM_BUFFER, 0, ring.head);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    ring.mapped = nullptr;
+    ring.usedBytes = ring.head;
+}
+
+void BindUniformRange(App* app, GLuint binding, u32 offset, u32 size)
+{
+    BindUniformBuffer(app, binding, app->uniformRing.handle, offset, size);
+}
+
+void EndUniformFrame(App* app)
+{
+    UniformRing& ring = app->uniformRing;
+    FlushUniformFrame(app);
+    ring.fences[ring.frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
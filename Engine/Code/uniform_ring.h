@@ -0,0 +1,44 @@
+//
+// uniform_ring.h: Per-frame constants. One uniform buffer split in a region per
+// frame in flight; each frame maps its region once, suballocates the constants
+// of every draw at GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT and binds them with
+// glBindBufferRange. A fence per region keeps the CPU from overwriting
+// constants the GPU hasn't read yet, without synchronizing on every map.
+//
+//     BeginUniformFrame(app);
+//     u32 offset = PushUniformBlock(app, localParams);
+//     FlushUniformFrame(app);
+//     BindUniformRange(app, LOCAL_PARAMS_BINDING, offset, sizeof(LocalParams));
+//     ...draw...
+//     EndUniformFrame(app);
+//
+
+#pragma once
+
+#include "engine.h"
+
+void InitUniformRing(App* app, u32 frameSize);
+
+// Waits for the GPU to release the region of this frame (rarely, with
+// UNIFORM_RING_FRAMES in flight) and maps it
+void BeginUniformFrame(App* app);
+
+// Copies the constants into the frame region. Returns their offset in the
+// buffer, or UINT32_MAX if the region is full.
+u32 PushUniforms(App* app, const void* data, u32 size);
+
+// Pushes a struct mirroring a GLSL block, see uniform_layout.h
+template <typename T>
+u32 PushUniformBlock(App* app, const T& block)
+{
+    static_assert(sizeof(UniformBlockLayout<T>::members) > 0, "Declare the block with UNIFORM_BLOCK_LAYOUT()");
+    return PushUniforms(app, &block, sizeof(T));
+}
+
+// Unmaps the region. Call after the last push, before the draws reading it.
+void FlushUniformFrame(App* app);
+
+void BindUniformRange(App* app, GLuint binding, u32 offset, u32 size);
+
+// Fences the region once the draws of the frame are submitted
+void EndUniformFrame(App* app);
@@ -0,0 +1,739 @@
+//
+// virtual_texture.cpp: Page cooking, feedback readback and page cache management.
+//
+// Feedback texels are RGBA8: R page x, G page y, B mip (low 4 bits) and
+// virtual texture index (high 4 bits), A 255 where a virtual texture was drawn.
+// This limits the system to VIRTUAL_TEXTURE_MAX_COUNT (16) virtual textures
+// of up to VIRTUAL_TEXTURE_MAX_PAGES_PER_SIDE (256) pages per side. Feedback
+// carries the slot index of a virtual texture in the pool, which is below 16
+// as long as at most 16 are alive, since freed slots are reused first.
+//
+
+#include "virtual_texture.h"
+#include "texture_processing.h"
+#include "program_reflection.h"
+#include "gl_state.h"
+#include "job_system.h"
+#include <imgui.h>
+#include <mutex>
+#include <algorithm>
+
+#define VIRTUAL_TEXTURE_FILE_MAGIC 0x32545456 // "VTT2", pages with borders
+
+struct VirtualTextureFileHeader
+{
+    u32 magic;
+    i32 width;
+    i32 height;
+    u32 pageSize;
+    u32 mipCount;
+};
+
+// Opened once per virtual texture. Workers reading pages of the same texture
+// take turns, as they share the file position.
+struct VirtualPageFile
+{
+    std::mutex mutex;
+    FILE*      file;
+
+    ~VirtualPageFile() { fclose(file); }
+};
+
+// Page read by a worker, waiting for the main thread to upload it
+struct LoadedPage
+{
+    u64 key;
+    u8* pixels;
+};
+
+static std::mutex              GlobalLoadedPagesMutex;
+static std::vector<LoadedPage> GlobalLoadedPages;
+
+// Keys hold the whole handle, so pages read for a released virtual texture
+// never match one that reuses its slot
+static u64 MakePageKey(u32 virtualTextureIdx, u32 mip, u32 x, u32 y)
+{
+    return ((u64)virtualTextureIdx << 32) | ((u64)mip << 16) | ((u64)y << 8) | (u64)x;
+}
+
+static void SplitPageKey(u64 key, u32* virtualTextureIdx, u32* mip, u32* x, u32* y)
+{
+    *virtualTextureIdx = (u32)(key >> 32);
+    *mip = (u32)(key >> 16) & 0xFF;
+    *y = (u32)(key >> 8) & 0xFF;
+    *x = (u32)key & 0xFF;
+}
+
+// Side of a page as stored in the page file and the cache, borders included
+static u32 GetStoredPageSize(u32 pageSize)
+{
+    return pageSize + 2 * VIRTUAL_TEXTURE_PAGE_BORDER;
+}
+
+static u32 NextPowerOfTwo(u32 value)
+{
+    u32 result = 1;
+    while (result < value)
+        result <<= 1;
+    return result;
+}
+
+void InitVirtualTexturing(App* app)
+{
+    VirtualTexturing& vt = app->virtualTexturing;
+    vt.enabled = true;
+    vt.minSourceSize = 8192;
+    vt.pageSize = 128;
+    vt.cacheSlotsPerSide = 16;
+    vt.feedbackDivisor = 8;
+    vt.maxLoadsPerFrame = 16;
+
+    const u32 cacheSize = GetStoredPageSize(vt.pageSize) * vt.cacheSlotsPerSide;
+    glGenTextures(1, &vt.pageCacheHandle);
+    glBindTexture(GL_TEXTURE_2D, vt.pageCacheHandle);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, cacheSize, cacheSize);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    vt.slots.resize(vt.cacheSlotsPerSide * vt.cacheSlotsPerSide);
+    for (VirtualPageSlot& slot : vt.slots)
+        slot.virtualTextureIdx = UINT32_MAX;
+
+    vt.feedbackProgramIdx = LoadProgram(app, "shaders.glsl", "VIRTUAL_TEXTURE_FEEDBACK");
+    PipelineDesc feedbackPipeline = {};
+    feedbackPipeline.programIdx = vt.feedbackProgramIdx;
+    feedbackPipeline.depthTest = true;
+    feedbackPipeline.depthWrite = true;
+    vt.feedbackPipelineIdx = GetPipeline(app, feedbackPipeline);
+    vt.feedbackSize = ivec2(0, 0);
+    glGenBuffers(2, vt.readbackBuffers);
+}
+
+static void ResizeFeedbackTarget(VirtualTexturing& vt, ivec2 displaySize)
+{
+    ivec2 size = glm::max(displaySize / (i32)vt.feedbackDivisor, ivec2(1, 1));
+    if (size == vt.feedbackSize)
+        return;
+
+    if (vt.feedbackFramebuffer)
+    {
+        glDeleteFramebuffers(1, &vt.feedbackFramebuffer);
+        glDeleteTextures(1, &vt.feedbackColor);
+        glDeleteRenderbuffers(1, &vt.feedbackDepth);
+    }
+    vt.feedbackSize = size;
+
+    glGenTextures(1, &vt.feedbackColor);
+    glBindTexture(GL_TEXTURE_2D, vt.feedbackColor);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, size.x, size.y);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenRenderbuffers(1, &vt.feedbackDepth);
+    glBindRenderbuffer(GL_RENDERBUFFER, vt.feedbackDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size.x, size.y);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &vt.feedbackFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, vt.feedbackFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, vt.feedbackColor, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, vt.feedbackDepth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        ELOG("Virtual texture feedback framebuffer is incomplete");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // Pending readbacks have the old size
+    for (u32 i = 0; i < 2; ++i)
+    {
+        if (vt.readbackFences[i])
+        {
+            glDeleteSync(vt.readbackFences[i]);
+            vt.readbackFences[i] = 0;
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, vt.readbackBuffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, size.x * size.y * 4, NULL, GL_STREAM_READ);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+VirtualTextureCookSettings GetVirtualTextureCookSettings(const App* app)
+{
+    // Cooks in flight may each take a virtual texture
+    const VirtualTexturing& vt = app->virtualTexturing;
+    const bool slotLeft = app->virtualTextures.Count() + vt.cookingSources.size() < VIRTUAL_TEXTURE_MAX_COUNT;
+    return { vt.enabled && slotLeft, vt.minSourceSize, vt.pageSize };
+}
+
+bool WantsVirtualTexture(const VirtualTextureCookSettings& settings, const Image& image)
+{
+    return settings.enabled &&
+           image.pixelType == PixelType_U8 &&
+           (u32)glm::max(image.size.x, image.size.y) >= settings.minSourceSize;
+}
+
+// Bilinear resample into RGBA8, so that every mip is a whole number of pages
+static Image ResampleToRGBA8(const Image& src, ivec2 size)
+{
+    Image dst = {};
+    dst.size = size;
+    dst.nchannels = 4;
+    dst.stride = size.x * 4;
+    dst.pixels = malloc((size_t)dst.stride * size.y);
+
+    ParallelFor(size.y, 64, [&](u32 beginRow, u32 endRow)
+    {
+        for (u32 y = beginRow; y < endRow; ++y)
+        {
+            const f32 sy = glm::clamp((y + 0.5f) * src.size.y / size.y - 0.5f, 0.0f, src.size.y - 1.0f);
+            const i32 y0 = (i32)sy, y1 = glm::min(y0 + 1, src.size.y - 1);
+            const f32 fy = sy - y0;
+
+            for (i32 x = 0; x < size.x; ++x)
+            {
+                const f32 sx = glm::clamp((x + 0.5f) * src.size.x / size.x - 0.5f, 0.0f, src.size.x - 1.0f);
+                const i32 x0 = (i32)sx, x1 = glm::min(x0 + 1, src.size.x - 1);
+                const f32 fx = sx - x0;
+
+                const u8* row0 = (const u8*)src.pixels + (size_t)y0 * src.stride;
+                const u8* row1 = (const u8*)src.pixels + (size_t)y1 * src.stride;
+                const u8* p00 = row0 + x0 * src.nchannels;
+                const u8* p10 = row0 + x1 * src.nchannels;
+                const u8* p01 = row1 + x0 * src.nchannels;
+                const u8* p11 = row1 + x1 * src.nchannels;
+
+                u8* out = (u8*)dst.pixels + (size_t)y * dst.stride + x * 4;
+                for (i32 c = 0; c < 4; ++c)
+                {
+                    // Grayscale sources replicate their value, missing alpha is opaque
+                    i32 sc = c;
+                    if (src.nchannels <= 2) sc = (c < 3) ? 0 : (src.nchannels == 2 ? 1 : -1);
+                    else if (c == 3 && src.nchannels == 3) sc = -1;
+
+                    if (sc < 0) { out[c] = 255; continue; }
+                    const f32 top = p00[sc] + (p10[sc] - p00[sc]) * fx;
+                    const f32 bottom = p01[sc] + (p11[sc] - p01[sc]) * fx;
+                    out[c] = (u8)(top + (bottom - top) * fy + 0.5f);
+                }
+            }
+        }
+    });
+
+    return dst;
+}
+
+// Copies the page (x, y) of a mip and its border into a square RGBA8 block of
+// GetStoredPageSize(pageSize). Texels past the edges of the mip, which mips
+// smaller than a page have too, repeat the closest edge texel.
+static void ExtractPage(const Image& mip, u32 pageSize, u32 x, u32 y, u8* page)
+{
+    const i32 border = VIRTUAL_TEXTURE_PAGE_BORDER;
+    const u32 storedSize = GetStoredPageSize(pageSize);
+    for (u32 row = 0; row < storedSize; ++row)
+    {
+        const i32 srcY = glm::clamp((i32)(y * pageSize + row) - border, 0, mip.size.y - 1);
+        const u8* src = (const u8*)mip.pixels + (size_t)srcY * mip.stride;
+        u8* dst = page + (size_t)row * storedSize * 4;
+        for (u32 col = 0; col < storedSize; ++col)
+        {
+            const i32 srcX = glm::clamp((i32)(x * pageSize + col) - border, 0, mip.size.x - 1);
+            memcpy(dst + col * 4, src + srcX * 4, 4);
+        }
+    }
+}
+
+static bool CookVirtualTexturePages(const VirtualTexture& texture, const Image& source, u32 pageSize)
+{
+    FILE* file = fopen(texture.pageFilePath.c_str(), "wb");
+    if (!file)
+    {
+        ELOG("Could not write virtual texture pages %s", texture.pageFilePath.c_str());
+        return false;
+    }
+
+    VirtualTextureFileHeader header = { VIRTUAL_TEXTURE_FILE_MAGIC, texture.size.x, texture.size.y, pageSize, texture.mipCount };
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    Image base = ResampleToRGBA8(source, texture.size);
+    std::vector<Image> mips = GenerateMipChain(base, true);
+    const u32 storedSize = GetStoredPageSize(pageSize);
+    std::vector<u8> page((size_t)storedSize * storedSize * 4);
+
+    for (u32 mip = 0; mip < texture.mipCount && written; ++mip)
+    {
+        const Image& image = mip == 0 ? base : mips[mip - 1];
+        for (i32 y = 0; y < texture.pagesPerMip[mip].y && written; ++y)
+        {
+            for (i32 x = 0; x < texture.pagesPerMip[mip].x && written; ++x)
+            {
+                ExtractPage(image, pageSize, x, y, page.data());
+                written = fwrite(page.data(), page.size(), 1, file) == 1;
+            }
+        }
+    }
+
+    for (Image& mip : mips)
+        FreeImage(mip);
+    FreeImage(base);
+    written = fclose(file) == 0 && written;
+
+    // A file cut short would look up to date next time
+    if (!written)
+    {
+        ELOG("Could not write virtual texture pages %s", texture.pageFilePath.c_str());
+        remove(texture.pageFilePath.c_str());
+        return false;
+    }
+    return true;
+}
+
+static u64 GetPageIndex(const VirtualTexture& texture, u32 mip, u32 x, u32 y)
+{
+    return texture.firstPageOfMip[mip] + (u64)y * texture.pagesPerMip[mip].x + x;
+}
+
+static std::shared_ptr<VirtualPageFile> OpenPageFile(const std::string& pageFilePath)
+{
+    FILE* file = fopen(pageFilePath.c_str(), "rb");
+    if (!file)
+    {
+        ELOG("Could not open virtual texture pages %s", pageFilePath.c_str());
+        return nullptr;
+    }
+
+    std::shared_ptr<VirtualPageFile> pageFile = std::make_shared<VirtualPageFile>();
+    pageFile->file = file;
+    return pageFile;
+}
+
+static u8* ReadPage(VirtualPageFile* pageFile, u32 pageSize, u64 pageIndex)
+{
+    if (!pageFile)
+        return nullptr;
+
+    const u64 storedSize = GetStoredPageSize(pageSize);
+    const u64 pageBytes = storedSize * storedSize * 4;
+    u8* pixels = (u8*)malloc(pageBytes);
+
+    std::lock_guard<std::mutex> lock(pageFile->mutex);
+    if (!SeekFile(pageFile->file, sizeof(VirtualTextureFileHeader) + pageIndex * pageBytes) ||
+        fread(pixels, pageBytes, 1, pageFile->file) != 1)
+    {
+        free(pixels);
+        pixels = nullptr;
+    }
+    return pixels;
+}
+
+static bool IsPageFileUpToDate(const VirtualTexture& texture, u32 pageSize)
+{
+    if (GetFileLastWriteTimestamp(texture.pageFilePath.c_str()) < GetFileLastWriteTimestamp(texture.sourcePath.c_str()))
+        return false;
+
+    FILE* file = fopen(texture.pageFilePath.c_str(), "rb");
+    if (!file)
+        return false;
+    VirtualTextureFileHeader header = {};
+    bool read = fread(&header, sizeof(header), 1, file) == 1;
+    fclose(file);
+
+    return read && header.magic == VIRTUAL_TEXTURE_FILE_MAGIC && header.pageSize == pageSize &&
+           header.width == texture.size.x && header.height == texture.size.y;
+}
+
+// Takes a free cache slot, or the least recently used one not seen this frame
+static u32 AcquireSlot(App* app)
+{
+    VirtualTexturing& vt = app->virtualTexturing;
+    u32 best = UINT32_MAX;
+    for (u32 i = 0; i < vt.slots.size(); ++i)
+    {
+        const VirtualPageSlot& slot = vt.slots[i];
+        if (slot.virtualTextureIdx == UINT32_MAX)
+            return i;
+        if (slot.locked || slot.lastUsedFrame >= vt.frame)
+            continue;
+        if (best == UINT32_MAX || slot.lastUsedFrame < vt.slots[best].lastUsedFrame)
+            best = i;
+    }
+
+    if (best != UINT32_MAX)
+    {
+        VirtualPageSlot& slot = vt.slots[best];
+        vt.residentPages.erase(MakePageKey(slot.virtualTextureIdx, slot.mip, slot.x, slot.y));
+        app->virtualTextures[slot.virtualTextureIdx].indirectionDirty = true;
+        slot.virtualTextureIdx = UINT32_MAX;
+        vt.pagesEvicted++;
+    }
+    return best;
+}
+
+static void StorePage(App* app, u64 key, const u8* pixels, bool locked)
+{
+    VirtualTexturing& vt = app->virtualTexturing;
+    const u32 slotIdx = AcquireSlot(app);
+    if (slotIdx == UINT32_MAX)
+        return; // Every page in the cache is in use this frame
+
+    u32 virtualTextureIdx, mip, x, y;
+    SplitPageKey(key, &virtualTextureIdx, &mip, &x, &y);
+
+    VirtualPageSlot& slot = vt.slots[slotIdx];
+    slot.virtualTextureIdx = virtualTextureIdx;
+    slot.mip = mip;
+    slot.x = x;
+    slot.y = y;
+    slot.lastUsedFrame = vt.frame;
+    slot.locked = locked;
+
+    const u32 slotX = slotIdx % vt.cacheSlotsPerSide;
+    const u32 slotY = slotIdx / vt.cacheSlotsPerSide;
+    const u32 storedSize = GetStoredPageSize(vt.pageSize);
+    glBindTexture(GL_TEXTURE_2D, vt.pageCacheHandle);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, slotX * storedSize, slotY * storedSize, storedSize, storedSize, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    vt.residentPages[key] = slotIdx;
+    app->virtualTextures[virtualTextureIdx].indirectionDirty = true;
+    vt.pagesLoaded++;
+}
+
+CookedVirtualTexture CookVirtualTexture(const VirtualTextureCookSettings& settings, const char* filepath, const Image& image)
+{
+    CookedVirtualTexture cooked = {};
+    VirtualTexture& texture = cooked.texture;
+    texture.sourcePath = filepath;
+    texture.pageFilePath = GetCacheFilePath(filepath, ".pages");
+
+    // Power-of-two page counts keep every mip a whole number of pages and
+    // match the mip chain of the indirection texture
+    ivec2 pages = ivec2(NextPowerOfTwo((image.size.x + settings.pageSize - 1) / settings.pageSize),
+                        NextPowerOfTwo((image.size.y + settings.pageSize - 1) / settings.pageSize));
+
+    // Feedback page coordinates are 8 bits, bigger sources are cooked downsampled
+    const ivec2 maxPages = ivec2(VIRTUAL_TEXTURE_MAX_PAGES_PER_SIDE);
+    if (glm::any(glm::greaterThan(pages, maxPages)))
+    {
+        ILOG("Virtual texture %s needs %dx%d pages, downsampling it to at most %dx%d",
+             filepath, pages.x, pages.y, maxPages.x, maxPages.y);
+        pages = glm::min(pages, maxPages);
+    }
+    texture.size = pages * (i32)settings.pageSize;
+    texture.mipCount = GetMipCount(pages);
+
+    u32 firstPage = 0;
+    for (u32 mip = 0; mip < texture.mipCount; ++mip)
+    {
+        ivec2 mipPages = GetMipSize(pages, mip);
+        texture.pagesPerMip.push_back(mipPages);
+        texture.firstPageOfMip.push_back(firstPage);
+        texture.indirection.push_back(std::vector<u32>(mipPages.x * mipPages.y, 0));
+        firstPage += mipPages.x * mipPages.y;
+    }
+
+    if (!IsPageFileUpToDate(texture, settings.pageSize))
+        CookVirtualTexturePages(texture, image, settings.pageSize);
+
+    texture.pageFile = OpenPageFile(texture.pageFilePath);
+    const u32 lastMip = texture.mipCount - 1;
+    cooked.coarsestPage = ReadPage(texture.pageFile.get(), settings.pageSize, GetPageIndex(texture, lastMip, 0, 0));
+    return cooked;
+}
+
+u32 AddVirtualTexture(App* app, CookedVirtualTexture& cooked)
+{
+    VirtualTexture& texture = cooked.texture;
+    ASSERT(app->virtualTextures.Count() < VIRTUAL_TEXTURE_MAX_COUNT, "Virtual texture added without a slot reserved by GetVirtualTextureCookSettings()");
+
+    glGenTextures(1, &texture.indirectionHandle);
+    glBindTexture(GL_TEXTURE_2D, texture.indirectionHandle);
+    glTexStorage2D(GL_TEXTURE_2D, texture.mipCount, GL_RGBA8, texture.pagesPerMip[0].x, texture.pagesPerMip[0].y);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    const u32 virtualTextureIdx = app->virtualTextures.Add(std::move(texture));
+
+    // The coarsest page is the fallback of every other page, keep it resident
+    const u32 lastMip = app->virtualTextures[virtualTextureIdx].mipCount - 1;
+    if (cooked.coarsestPage)
+    {
+        StorePage(app, MakePageKey(virtualTextureIdx, lastMip, 0, 0), cooked.coarsestPage, true);
+        free(cooked.coarsestPage);
+        cooked.coarsestPage = nullptr;
+    }
+
+    return virtualTextureIdx;
+}
+
+u32 FindVirtualTexture(App* app, const std::string& sourcePath)
+{
+    for (u32 i = 0; i < app->virtualTextures.SlotCount(); ++i)
+    {
+        if (!app->virtualTextures.IsSlotAlive(i))
+            continue;
+        const u32 virtualTextureIdx = app->virtualTextures.HandleAt(i);
+        if (app->virtualTextures[virtualTextureIdx].sourcePath == sourcePath)
+            return virtualTextureIdx;
+    }
+    return UINT32_MAX;
+}
+
+void ReleaseVirtualTexture(App* app, u32 virtualTextureIdx)
+{
+    if (virtualTextureIdx == UINT32_MAX || !app->virtualTextures.Release(virtualTextureIdx))
+        return;
+
+    VirtualTexturing& vt = app->virtualTexturing;
+    for (VirtualPageSlot& slot : vt.slots)
+    {
+        if (slot.virtualTextureIdx == virtualTextureIdx)
+        {
+            vt.residentPages.erase(MakePageKey(slot.virtualTextureIdx, slot.mip, slot.x, slot.y));
+            slot.virtualTextureIdx = UINT32_MAX;
+            slot.locked = false;
+        }
+    }
+
+    // Reads in flight keep the page file open, their pages are dropped once
+    // they arrive as they are no longer pending
+    vt.pendingPages.erase(std::remove_if(vt.pendingPages.begin(), vt.pendingPages.end(), [virtualTextureIdx](u64 key) {
+        return (u32)(key >> 32) == virtualTextureIdx;
+    }), vt.pendingPages.end());
+
+    glDeleteTextures(1, &app->virtualTextures[virtualTextureIdx].indirectionHandle);
+    app->virtualTextures.Remove(virtualTextureIdx);
+}
+
+void RenderVirtualTextureFeedback(App* app)
+{
+    VirtualTexturing& vt = app->virtualTexturing;
+    if (!vt.enabled || app->virtualTextures.Count() == 0 || !app->models.IsValid(app->model))
+        return;
+
+    ResizeFeedbackTarget(vt, app->displaySize);
+
+    // Only one readback in flight per buffer
+    const u32 buffer = vt.frame % 2;
+    if (vt.readbackFences[buffer])
+        return;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, vt.feedbackFramebuffer);
+    glViewport(0, 0, vt.feedbackSize.x, vt.feedbackSize.y);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    Program& program = app->programs[vt.feedbackProgramIdx];
+    BindPipeline(app, vt.feedbackPipelineIdx);
+    SetUniform(program, ShaderId("uFeedbackScale"), (f32)vt.feedbackDivisor);
+
+    Model& model = app->models[app->model];
+    Mesh& mesh = app->meshes[model.meshIdx];
+    for (u32 i = 0; i < mesh.submeshes.size(); ++i)
+    {
+        const Material& material = app->materials[model.materialIdx[i]];
+        if (material.albedoVirtualTextureIdx == UINT32_MAX)
+            continue;
+
+        const VirtualTexture& texture = app->virtualTextures[material.albedoVirtualTextureIdx];
+        SetUniform(program, ShaderId("uVirtualParams"), vec4(texture.size.x, texture.size.y, vt.pageSize, texture.mipCount));
+        SetUniform(program, ShaderId("uVirtualTextureId"), (f32)GetHandleIndex(material.albedoVirtualTextureIdx));
+
+        BindVertexArray(app, FindVAO(app, mesh.submeshes[i], program));
+        BindSubmeshBuffers(app, mesh.submeshes[i]);
+        DrawSubmesh(mesh.submeshes[i]);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, vt.readbackBuffers[buffer]);
+    glReadPixels(0, 0, vt.feedbackSize.x, vt.feedbackSize.y, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    vt.readbackFences[buffer] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, app->displaySize.x, app->displaySize.y);
+}
+
+// Collects the pages seen in the finished readbacks, without ever waiting
+static void ReadFeedback(App* app, std::vector<u64>& requests)
+{
+    VirtualTexturing& vt = app->virtualTexturing;
+    for (u32 buffer = 0; buffer < 2; ++buffer)
+    {
+        GLsync fence = vt.readbackFences[buffer];
+        if (!fence || glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+            continue;
+        glDeleteSync(fence);
+        vt.readbackFences[buffer] = 0;
+
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, vt.readbackBuffers[buffer]);
+        const u32* texels = (const u32*)glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+        if (texels)
+        {
+            u32 previous = 0;
+            for (i32 i = 0; i < vt.feedbackSize.x * vt.feedbackSize.y; ++i)
+            {
+                const u32 texel = texels[i];
+                if ((texel >> 24) == 0 || texel == previous)
+                    continue;
+                previous = texel;
+
+                const u32 x = texel & 0xFF;
+                const u32 y = (texel >> 8) & 0xFF;
+                const u32 mip = (texel >> 16) & 0xF;
+                const u32 slotIndex = (texel >> 20) & 0xF;
+                if (slotIndex >= app->virtualTextures.SlotCount() || !app->virtualTextures.IsSlotAlive(slotIndex))
+                    continue;
+                const u32 virtualTextureIdx = app->virtualTextures.HandleAt(slotIndex);
+                if (mip < app->virtualTextures[virtualTextureIdx].mipCount)
+                    requests.push_back(MakePageKey(virtualTextureIdx, mip, x, y));
+            }
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    std::sort(requests.begin(), requests.end());
+    requests.erase(std::unique(requests.begin(), requests.end()), requests.end());
+}
+
+static void RebuildIndirection(App* app, u32 virtualTextureIdx)
+{
+    VirtualTexturing& vt = app->virtualTexturing;
+    VirtualTexture& texture = app->virtualTextures[virtualTextureIdx];
+
+    glBindTexture(GL_TEXTURE_2D, texture.indirectionHandle);
+    for (i32 mip = texture.mipCount - 1; mip >= 0; --mip)
+    {
+        const ivec2 pages = texture.pagesPerMip[mip];
+        std::vector<u32>& entries = texture.indirection[mip];
+        for (i32 y = 0; y < pages.y; ++y)
+        {
+            for (i32 x = 0; x < pages.x; ++x)
+            {
+                auto it = vt.residentPages.find(MakePageKey(virtualTextureIdx, mip, x, y));
+                if (it != vt.residentPages.end())
+                {
+                    const u32 slotX = it->second % vt.cacheSlotsPerSide;
+                    const u32 slotY = it->second / vt.cacheSlotsPerSide;
+                    entries[y * pages.x + x] = slotX | (slotY << 8) | ((u32)mip << 16) | (0xFFu << 24);
+                }
+                else if (mip + 1 < (i32)texture.mipCount)
+                {
+                    // Fall back to whatever the parent page points to
+                    const ivec2 parentPages = texture.pagesPerMip[mip + 1];
+                    const i32 px = glm::min(x / 2, parentPages.x - 1);
+                    const i32 py = glm::min(y / 2, parentPages.y - 1);
+                    entries[y * pages.x + x] = texture.indirection[mip + 1][py * parentPages.x + px];
+                }
+                else
+                {
+                    entries[y * pages.x + x] = 0;
+                }
+            }
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, mip, 0, 0, pages.x, pages.y, GL_RGBA, GL_UNSIGNED_BYTE, entries.data());
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    texture.indirectionDirty = false;
+}
+
+void UpdateVirtualTexturing(App* app)
+{
+    VirtualTexturing& vt = app->virtualTexturing;
+    if (app->virtualTextures.Count() == 0)
+        return;
+
+    vt.frame++;
+
+    std::vector<u64> requests;
+    ReadFeedback(app, requests);
+
+    std::vector<u64> missing;
+    for (u64 key : requests)
+    {
+        auto it = vt.residentPages.find(key);
+        if (it != vt.residentPages.end())
+            vt.slots[it->second].lastUsedFrame = vt.frame;
+        else if (std::find(vt.pendingPages.begin(), vt.pendingPages.end(), key) == vt.pendingPages.end())
+            missing.push_back(key);
+    }
+
+    // Coarse pages first: they improve the fallback of many finer pages at once
+    std::sort(missing.begin(), missing.end(), [](u64 a, u64 b) {
+        return ((a >> 16) & 0xFF) > ((b >> 16) & 0xFF);
+    });
+
+    for (u32 i = 0; i < missing.size() && vt.pendingPages.size() < vt.maxLoadsPerFrame; ++i)
+    {
+        const u64 key = missing[i];
+        u32 virtualTextureIdx, mip, x, y;
+        SplitPageKey(key, &virtualTextureIdx, &mip, &x, &y);
+
+        vt.pendingPages.push_back(key);
+        const VirtualTexture& texture = app->virtualTextures[virtualTextureIdx];
+        const std::shared_ptr<VirtualPageFile> pageFile = texture.pageFile;
+        const u64 pageIndex = GetPageIndex(texture, mip, x, y);
+        const u32 pageSize = vt.pageSize;
+
+        RunJob([key, pageFile, pageSize, pageIndex]()
+        {
+            LoadedPage page = { key, ReadPage(pageFile.get(), pageSize, pageIndex) };
+            std::lock_guard<std::mutex> lock(GlobalLoadedPagesMutex);
+            GlobalLoadedPages.push_back(page);
+        });
+    }
+
+    std::vector<LoadedPage> loaded;
+    {
+        std::lock_guard<std::mutex> lock(GlobalLoadedPagesMutex);
+        loaded.swap(GlobalLoadedPages);
+    }
+    for (LoadedPage& page : loaded)
+    {
+        // Pages of released virtual textures aren't pending anymore
+        auto pending = std::find(vt.pendingPages.begin(), vt.pendingPages.end(), page.key);
+        if (pending != vt.pendingPages.end())
+        {
+            vt.pendingPages.erase(pending);
+            if (page.pixels)
+                StorePage(app, page.key, page.pixels, false);
+        }
+        free(page.pixels);
+    }
+
+    for (u32 i = 0; i < app->virtualTextures.SlotCount(); ++i)
+    {
+        if (!app->virtualTextures.IsSlotAlive(i))
+            continue;
+        const u32 virtualTextureIdx = app->virtualTextures.HandleAt(i);
+        if (app->virtualTextures[virtualTextureIdx].indirectionDirty)
+            RebuildIndirection(app, virtualTextureIdx);
+    }
+}
+
+void BindVirtualTexture(App* app, u32 virtualTextureIdx, const Program& program)
+{
+    const VirtualTexturing& vt = app->virtualTexturing;
+    const VirtualTexture& texture = app->virtualTextures[virtualTextureIdx];
+
+    BindTexture(app, 1, texture.indirectionHandle);
+    BindTexture(app, 2, vt.pageCacheHandle);
+
+    SetUniform(program, ShaderId("uVirtualParams"), vec4(texture.size.x, texture.size.y, vt.pageSize, texture.mipCount));
+}
+
+void VirtualTexturingGui(App* app)
+{
+    VirtualTexturing& vt = app->virtualTexturing;
+    if (app->virtualTextures.Count() == 0)
+        return;
+
+    ImGui::Begin("Virtual texturing");
+    ImGui::Text("Virtual textures: %u / %u", app->virtualTextures.Count(), VIRTUAL_TEXTURE_MAX_COUNT);
+    ImGui::Text("Resident pages: %u / %u", (u32)vt.residentPages.size(), (u32)vt.slots.size());
+    ImGui::Text("Pending pages: %u", (u32)vt.pendingPages.size());
+    ImGui::Text("Pages loaded: %u, evicted: %u", vt.pagesLoaded, vt.pagesEvicted);
+    ImGui::End();
+}
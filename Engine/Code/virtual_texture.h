@@ -0,0 +1,75 @@
+//
+// virtual_texture.h: Software virtual texturing for albedo maps too big to keep
+// in memory. Images are cooked into pages on disk; a low resolution feedback
+// pass tells which pages are visible and those are streamed into a cache
+// texture that the mesh shader reaches through an indirection texture.
+//
+
+#pragma once
+
+#include "engine.h"
+
+void InitVirtualTexturing(App* app);
+
+// The feedback encoding has 4 bits for the virtual texture index
+#define VIRTUAL_TEXTURE_MAX_COUNT 16
+
+// and 8 bits for each page coordinate
+#define VIRTUAL_TEXTURE_MAX_PAGES_PER_SIDE 256
+
+// Texels of the neighbouring pages stored around each page, so the bilinear
+// filter of the page cache never reaches into an unrelated slot. Mirrored in
+// virtual_texture.glsl.
+#define VIRTUAL_TEXTURE_PAGE_BORDER 4
+
+// What a worker needs to know to cook a virtual texture, copied on the main
+// thread before the job starts
+struct VirtualTextureCookSettings
+{
+    bool enabled;       // False as well when every virtual texture is taken
+    u32  minSourceSize;
+    u32  pageSize;
+};
+
+// Page layout of a virtual texture, its page file written
+struct CookedVirtualTexture
+{
+    VirtualTexture texture;
+    u8*            coarsestPage; // Read along, it never leaves the cache
+};
+
+// Counts the cooks in vt.cookingSources as taken virtual textures
+VirtualTextureCookSettings GetVirtualTextureCookSettings(const App* app);
+
+// Whether a decoded image should become a virtual texture instead of a regular one
+bool WantsVirtualTexture(const VirtualTextureCookSettings& settings, const Image& image);
+
+// Lays out the pages of the image and cooks them, if the page file is missing
+// or older than the source. Only touches files, so it runs on a worker.
+CookedVirtualTexture CookVirtualTexture(const VirtualTextureCookSettings& settings, const char* filepath, const Image& image);
+
+// Creates the GL objects of a cooked virtual texture and registers it. The
+// handle returned holds the only reference.
+u32 AddVirtualTexture(App* app, CookedVirtualTexture& cooked);
+
+// Virtual texture cooked from the source, UINT32_MAX if there's none. Takes
+// no reference.
+u32 FindVirtualTexture(App* app, const std::string& sourcePath);
+
+// Drops a reference. The last one frees the indirection texture and the
+// cache slots of the pages, and the slot becomes available to the next one.
+void ReleaseVirtualTexture(App* app, u32 virtualTextureIdx);
+
+// Renders the page IDs seen by the camera into the feedback buffer and
+// starts its asynchronous readback
+void RenderVirtualTextureFeedback(App* app);
+
+// Consumes feedback readbacks, queues page loads, uploads loaded pages and
+// refreshes the indirection textures. Call once per frame from the main thread.
+void UpdateVirtualTexturing(App* app);
+
+// Binds the indirection and page cache textures (units 1 and 2) for drawing
+// with the given virtual texture and sets the uVirtualParams of the program
+void BindVirtualTexture(App* app, u32 virtualTextureIdx, const Program& program);
+
+void VirtualTexturingGui(App* app);
@@ -0,0 +1,24 @@
+///////////////////////////////////////////////////////////////////////
+// common.glsl: Code shared by the programs of shaders.glsl
+///////////////////////////////////////////////////////////////////////
+
+#ifndef COMMON_GLSL
+#define COMMON_GLSL
+
+vec4 ProjectPosition(vec3 position)
+{
+	//We will usually not define the clipping scale manually...
+	//it is usually computed by the projection matrix. Because
+	//we are not passing uniform transforms yet, we increase
+	// the clipping scale so that Patrick fits the screen.
+
+	float clippingScale = 5.0;
+
+	vec4 clipPosition = vec4(position, clippingScale);
+
+	//Patrick looks away from the camera by default, so flip it here.
+	clipPosition.z = -clipPosition.z;
+	return clipPosition;
+}
+
+#endif
@@ -52,7 +52,6 @@ layout(binding = 1, std140) uniform LocalParams
 //layout (location = 3) in vec3 aTangent;
 //layout(location = 4) in vec3 aBitangent;
 
-
 out vec2 vTexCoord;
 out vec3 vPosition;		// In worldspace
 out vec3 vNormal;		// In worldspace
@@ -61,25 +60,10 @@ out vec3 vViewDir;
 
 void main()
 {
-	vTexCoord = aTexCoord;
-	/*
 	vTexCoord = aTexCoord;
 	vPosition = vec3( uWorldMatrix * vec4(aPosition, 1.0) );
-	vNormal = vec3( uWorldmatrix * vec4(aNormal,0.0) );
+	vNormal = vec3( uWorldMatrix * vec4(aNormal,0.0) );
 	gl_Position = uWorldViewProjectionMatrix * vec4(aPosition,1.0);
-
-	*/
-	//We will usually not define the clipping scale manually...
-	//it is usually computed by the projection matrix. Because
-	//we are not passing uniform transforms yet, we increase
-	// the clipping scale so that Patrick fits the screen.
-
-	float clippingScale = 5.0;
-
-	gl_Position = vec4(aPosition, clippingScale);
-
-	//Patrick looks away from the camera by default, so flip it here.
-	gl_Position.z = -gl_Position.z;
 }
 
 
@@ -91,12 +75,22 @@ in vec3 vNormal; //In Worldspace
 in vec3 vViewDir;
 
 uniform sampler2D uTexture;
+uniform vec3 uAlbedoColor;	// Used when the albedo map was folded into a constant
+uniform bool uHasAlbedoMap;
+
+#ifdef USE_VIRTUAL_TEXTURE
+#include "virtual_texture.glsl"
+#endif
 
 layout(location = 0) out vec4 oColor;
 
 void main()
 {
-	oColor = texture(uTexture,vTexCoord);
+#ifdef USE_VIRTUAL_TEXTURE
+	oColor = SampleVirtualTexture(vTexCoord, uAlbedoColor);
+#else
+	oColor = uHasAlbedoMap ? texture(uTexture,vTexCoord) : vec4(uAlbedoColor, 1.0);
+#endif
 	//oColor = vec4(vNormal,1.0f);
 }
 
@@ -104,9 +98,89 @@ void main()
 #endif
 
 
+#ifdef VIRTUAL_TEXTURE_FEEDBACK
+
+#if defined(VERTEX)///////////////////////////////////////////////////
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec3 aNormal;
+layout(location = 2) in vec2 aTexCoord;
+
+#include "common.glsl"
+
+out vec2 vTexCoord;
+
+void main()
+{
+	vTexCoord = aTexCoord;
+	gl_Position = ProjectPosition(aPosition);
+}
+
+#elif defined(FRAGMENT)	///////////////////////////////////////////////////////
+
+in vec2 vTexCoord;
+
+uniform vec4 uVirtualParams;	// xy: virtual size in texels, z: page size, w: mip count
+uniform float uVirtualTextureId;
+uniform float uFeedbackScale;	// Screen pixels per feedback pixel
+
+layout(location = 0) out vec4 oPage;
+
+void main()
+{
+	vec2 uv = clamp(vTexCoord, 0.0, 0.99999);
+	// Derivatives are measured at feedback resolution, scale them to screen pixels
+	vec2 texels = uv * uVirtualParams.xy;
+	vec2 dx = dFdx(texels) / uFeedbackScale;
+	vec2 dy = dFdy(texels) / uFeedbackScale;
+	float mip = clamp(floor(0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0))), 0.0, uVirtualParams.w - 1.0);
+
+	vec2 pages = max(floor(uVirtualParams.xy / uVirtualParams.z / exp2(mip)), vec2(1.0));
+	vec2 page = floor(uv * pages);
+	oPage = vec4(page.x, page.y, mip + uVirtualTextureId * 16.0, 255.0) / 255.0;
+}
+
+#endif
+#endif
+
+
+
+#ifdef POINT_CLOUD
+
+#if defined(VERTEX)///////////////////////////////////////////////////
+layout(location = 0) in vec3 aPosition;
+layout(location = 1) in vec4 aColor;
+
+uniform float uPointSize;	// Pixels, grows where the finer nodes aren't drawn
+
+#include "common.glsl"
+
+out vec4 vColor;
+
+void main()
+{
+	vColor = aColor;
+	gl_Position = ProjectPosition(aPosition);
+	gl_PointSize = uPointSize;
+}
+
+#elif defined(FRAGMENT)	///////////////////////////////////////////////////////
+
+in vec4 vColor;
+
+layout(location = 0) out vec4 oColor;
+
+void main()
+{
+	oColor = vColor;
+}
+
+#endif
+#endif
 
 
 // NOTE: You can write several shaders in the same file if you want as
 // long as you embrace them within an #ifdef block (as you can see above).
 // The third parameter of the LoadProgram function in engine.cpp allows
-// chosing the shader you want to load by name.
+// chosing the shader you want to load by name, the fourth one the variant
+// features (ShaderFeatureDefines in shader_preprocessor.cpp) to define.
+// Files can be shared with #include "file", relative to the including file.
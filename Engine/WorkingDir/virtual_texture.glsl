@@ -0,0 +1,38 @@
+///////////////////////////////////////////////////////////////////////
+// virtual_texture.glsl: Sampling of virtual textures, see virtual_texture.h
+///////////////////////////////////////////////////////////////////////
+
+#ifndef VIRTUAL_TEXTURE_GLSL
+#define VIRTUAL_TEXTURE_GLSL
+
+// Texels around each page in the cache, VIRTUAL_TEXTURE_PAGE_BORDER on the CPU
+#define VIRTUAL_PAGE_BORDER 4.0
+
+uniform sampler2D uIndirection;	// One texel per page and mip: cache slot (xy), resident mip (z)
+uniform sampler2D uPageCache;
+uniform vec4 uVirtualParams;	// xy: virtual size in texels, z: page size, w: mip count
+
+vec4 SampleVirtualTexture(vec2 uv, vec3 fallbackColor)
+{
+	uv = clamp(uv, 0.0, 0.99999);
+	vec2 texels = uv * uVirtualParams.xy;
+	vec2 dx = dFdx(texels);
+	vec2 dy = dFdy(texels);
+	float mip = clamp(floor(0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0))), 0.0, uVirtualParams.w - 1.0);
+
+	ivec2 pages = textureSize(uIndirection, int(mip));
+	vec4 entry = texelFetch(uIndirection, ivec2(uv * vec2(pages)), int(mip)) * 255.0;
+	if (entry.a == 0.0)
+		return vec4(fallbackColor, 1.0);
+
+	// The page found may belong to a coarser mip if the one wanted isn't loaded yet
+	vec2 residentPages = vec2(textureSize(uIndirection, int(entry.z + 0.5)));
+	vec2 inPage = fract(uv * residentPages);
+
+	// Slots hold the page surrounded by its border, only the inner area is addressed
+	float slotSize = uVirtualParams.z + 2.0 * VIRTUAL_PAGE_BORDER;
+	vec2 cacheTexel = entry.xy * slotSize + VIRTUAL_PAGE_BORDER + inPage * uVirtualParams.z;
+	return textureLod(uPageCache, cacheTexel / vec2(textureSize(uPageCache, 0)), 0.0);
+}
+
+#endif
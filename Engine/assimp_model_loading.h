@@ -7,11 +7,45 @@
 #include "engine.h"
 #include "platform.h"
 
+// Returns the model already loaded from that file, if any
+u32 FindModel(App* app, const char* filename);
+
 u32 LoadModel(App* app, const char* filename);
 
-void ProcessAssimpNode(const aiScene* scene, aiNode* node, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
+// Runs the assimp import only, it doesn't touch the App nor OpenGL so it can
+// be called from a worker thread
+const aiScene* ImportAssimpScene(const char* filename);
+
+// Creates the model from an imported scene and releases the scene
+u32 LoadModelFromScene(App* app, const aiScene* scene, const char* filename);
+
+// Creates the model from an imported scene and its mesh, already holding the
+// submeshes of CollectSubmeshAssimpMeshes(), and releases the scene
+u32 AddModelFromScene(App* app, const aiScene* scene, const char* filename, u32 meshIdx);
+
+// Meshes referenced by the node and its children, in traversal order
+void CollectAssimpMeshes(const aiScene* scene, const aiNode* node, std::vector<const aiMesh*>& meshes);
+
+// The meshes of CollectAssimpMeshes() that become submeshes, point clouds left out
+std::vector<const aiMesh*> CollectSubmeshAssimpMeshes(const aiScene* scene, u32 minCloudPoints);
+
+// Vertex and index bytes of the submeshes ProcessAssimpMesh() builds from the meshes
+void GetAssimpGeometryBytes(const std::vector<const aiMesh*>& meshes, u64* vertexBytes, u64* indexBytes);
+
+// Bytes per vertex of the submesh ProcessAssimpMesh() builds from the mesh
+u32 GetAssimpVertexStride(const aiMesh* mesh);
+
+// GL_TRIANGLES, GL_LINES or GL_POINTS
+GLenum GetAssimpPrimitiveType(const aiMesh* mesh);
+
+// Zero for points, which are drawn without indices
+u64 GetAssimpIndexCount(const aiMesh* mesh);
+
+// Converts the mesh to interleaved vertices. It doesn't touch the App nor
+// OpenGL so it can be called from a worker thread.
+SubmeshData ProcessAssimpMesh(const aiMesh* mesh);
 
-void ProcessAssimpMesh(const aiScene* scene, aiMesh* mesh, Mesh* myMesh, u32 baseMeshMaterialIndex, std::vector<u32>& submeshMaterialIndices);
+void GetAssimpTexturePath(aiMaterial* material, aiTextureType type, String directory, std::string& filepath);
 
 void ProcessAssimpMaterial(App* app, aiMaterial* material, Material& myMaterial, String directory);
 